@@ -0,0 +1,205 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Reads a file in blocks using asynchronous I/O, and adds up all of its bytes.
+ * Each block's continuation adds up that block, and the final merge only runs
+ * once every read has finished. */
+
+static unsigned long  block_size;
+static unsigned long  count;
+static unsigned long  block_count;
+static int  fd = -1;
+static unsigned char  *buf;
+static unsigned long  expected;
+static unsigned long  result;
+
+#define byte_at(j)  ((unsigned char) ((j) % 251))
+
+static void
+configure(int argc, char **argv)
+{
+    char  path[] = "/tmp/fleet-async-read-XXXXXX";
+    unsigned char  *contents;
+    unsigned long  j;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: async_read [block size] [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    block_size = flt_parse_ulong(argv[0]);
+    count = flt_parse_ulong(argv[1]);
+    block_count = (count + block_size - 1) / block_size;
+
+    /* Create a scratch file containing `count` bytes.  We unlink it right away,
+     * so that it goes away once we close it. */
+    if (fd != -1) {
+        close(fd);
+        free(buf);
+    }
+    fd = mkstemp(path);
+    if (fd == -1) {
+        perror("async_read: Cannot create scratch file");
+        exit(EXIT_FAILURE);
+    }
+    unlink(path);
+
+    contents = malloc(count);
+    expected = 0;
+    for (j = 0; j < count; j++) {
+        contents[j] = byte_at(j);
+        expected += contents[j];
+    }
+    if (write(fd, contents, count) != (ssize_t) count) {
+        perror("async_read: Cannot write scratch file");
+        exit(EXIT_FAILURE);
+    }
+    free(contents);
+    buf = malloc(block_count * block_size);
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "async_read:%lu:%lu", block_size, count);
+}
+
+static unsigned long
+block_length(unsigned long i)
+{
+    unsigned long  offset = i * block_size;
+    return (count - offset < block_size)? count - offset: block_size;
+}
+
+static unsigned long
+sum_block(unsigned long i, unsigned long length)
+{
+    unsigned char  *block = buf + i * block_size;
+    unsigned long  sum = 0;
+    unsigned long  j;
+    for (j = 0; j < length; j++) {
+        sum += block[j];
+    }
+    return sum;
+}
+
+static void
+run_native(void)
+{
+    unsigned long  sum = 0;
+    unsigned long  i;
+    for (i = 0; i < block_count; i++) {
+        unsigned long  length = block_length(i);
+        if (pread(fd, buf + i * block_size, length, i * block_size) !=
+            (ssize_t) length) {
+            perror("async_read: Cannot read scratch file");
+            exit(EXIT_FAILURE);
+        }
+        sum += sum_block(i, length);
+    }
+    result = sum;
+}
+
+static flt_task  add_block;
+static flt_task  read_block;
+static flt_task  merge;
+static flt_task  schedule;
+
+static void
+add_block(struct flt *flt, void *ud, size_t i)
+{
+    struct flt_local  *local = ud;
+    unsigned long  *result = flt_local_get(flt, local, unsigned long);
+    ssize_t  length = flt_io_result(flt);
+    if (length != (ssize_t) block_length(i)) {
+        /* Make sure that verify notices. */
+        *result += count * 256;
+        return;
+    }
+    *result += sum_block(i, length);
+}
+
+static void
+read_block(struct flt *flt, void *ud, size_t i)
+{
+    struct flt_task  *task = flt_task_new(flt, add_block, ud, i);
+    flt_read_async(flt, fd, buf + i * block_size, block_length(i),
+                   i * block_size, task);
+}
+
+static void
+merge_one(struct flt *flt, unsigned long *sum, int dummy)
+{
+    result += *sum;
+}
+
+static void
+merge(struct flt *flt, void *ud, size_t i)
+{
+    struct flt_local  *local = ud;
+    flt_local_visit(flt, local, unsigned long, merge_one, 0);
+    flt_local_free(flt, local);
+}
+
+static void
+ulong_init(struct flt *flt, void *ud, void *vinstance)
+{
+}
+
+static void
+ulong_done(struct flt *flt, void *ud, void *vinstance)
+{
+}
+
+static void
+schedule(struct flt *flt, void *ud, size_t i)
+{
+    struct flt_local  *local;
+    struct flt_task_group  *group;
+    struct flt_task  *task;
+    local = flt_local_new(flt, unsigned long, NULL, ulong_init, ulong_done);
+    group = flt_task_group_new(flt);
+    flt_task_group_run_after_current(flt, group);
+    task = flt_task_new(flt, merge, local, 0);
+    flt_task_group_add(flt, group, task);
+    task = flt_bulk_task_new(flt, read_block, local, 0, block_count);
+    flt_run(flt, task);
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    result = 0;
+    memset(buf, 0, block_count * block_size);
+    flt_fleet_run(fleet, schedule, NULL, 0);
+}
+
+static int
+verify(void)
+{
+    flt_check_result(async_read, "%lu", result, expected);
+    return 0;
+}
+
+struct flt_example  async_read = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
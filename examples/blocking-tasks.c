@@ -0,0 +1,136 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Every so often, a task makes a (simulated) blocking syscall.  It detaches
+ * from its execution context while it's blocked, so that the rest of the
+ * context's tasks can keep running. */
+
+#define BLOCK_EVERY  100
+
+static unsigned long  min;
+static unsigned long  max;
+static unsigned long  result;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 1) {
+        fprintf(stderr, "Usage: blocking_tasks [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    min = 0;
+    max = flt_parse_ulong(argv[0]);
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "blocking_tasks:%lu", max);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  sum = 0;
+    unsigned long  i;
+    for (i = min; i < max; i++) {
+        if (i % BLOCK_EVERY == 0) {
+            usleep(10);
+        }
+        sum += i;
+    }
+    result = sum;
+}
+
+static flt_task  add_one;
+static flt_task  merge;
+static flt_task  schedule;
+
+static void
+add_one(struct flt *flt, void *ud, size_t i)
+{
+    struct flt_local  *local = ud;
+    unsigned long  *result = flt_local_get(flt, local, unsigned long);
+    if (i % BLOCK_EVERY == 0) {
+        flt_detach(flt);
+        usleep(10);
+        flt_reattach(flt);
+    }
+    *result += i;
+}
+
+static void
+merge_one(struct flt *flt, unsigned long *sum, int dummy)
+{
+    result += *sum;
+}
+
+static void
+merge(struct flt *flt, void *ud, size_t i)
+{
+    struct flt_local  *local = ud;
+    flt_local_visit(flt, local, unsigned long, merge_one, 0);
+    flt_local_free(flt, local);
+}
+
+static void
+ulong_init(struct flt *flt, void *ud, void *vinstance)
+{
+}
+
+static void
+ulong_done(struct flt *flt, void *ud, void *vinstance)
+{
+}
+
+static void
+schedule(struct flt *flt, void *ud, size_t i)
+{
+    struct flt_local  *local;
+    struct flt_task_group  *group;
+    struct flt_task  *task;
+    local = flt_local_new(flt, unsigned long, NULL, ulong_init, ulong_done);
+    group = flt_task_group_new(flt);
+    flt_task_group_run_after_current(flt, group);
+    task = flt_task_new(flt, merge, local, 0);
+    flt_task_group_add(flt, group, task);
+    task = flt_bulk_task_new(flt, add_one, local, min, max);
+    flt_run(flt, task);
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    result = 0;
+    flt_fleet_run(fleet, schedule, NULL, 0);
+}
+
+static int
+verify(void)
+{
+    unsigned long  expected = max / 2 * (max - 1);
+    flt_check_result(blocking_tasks, "%lu", result, expected);
+    return 0;
+}
+
+struct flt_example  blocking_tasks = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
@@ -0,0 +1,192 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Submits more jobs to a fleet in service mode than its job limit allows, once
+ * with each submission policy, and makes sure that the fleet never runs more
+ * jobs at a time than the limit. */
+
+struct job_state {
+    volatile unsigned long  result;
+};
+
+static unsigned long  job_limit;
+static unsigned long  job_count;
+static unsigned long  count;
+static struct job_state  *jobs;
+static struct flt_job  **handles;
+static volatile unsigned long  running;
+static volatile unsigned long  max_running;
+static unsigned long  accepted;
+static unsigned long  correct;
+static size_t  final_queue_depth;
+
+static const enum flt_submit_policy  policies[] = {
+    FLT_SUBMIT_BLOCK,
+    FLT_SUBMIT_FAIL,
+    FLT_SUBMIT_SPILL
+};
+#define POLICY_COUNT  (sizeof(policies) / sizeof(policies[0]))
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: bounded_jobs [limit] [job count] [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    job_limit = flt_parse_ulong(argv[0]);
+    job_count = flt_parse_ulong(argv[1]);
+    count = flt_parse_ulong(argv[2]);
+    free(jobs);
+    free(handles);
+    jobs = calloc(job_count, sizeof(struct job_state));
+    handles = calloc(job_count, sizeof(struct flt_job *));
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "bounded_jobs:%lu:%lu:%lu", job_limit, job_count, count);
+}
+
+static unsigned long
+expected_result(void)
+{
+    return count / 2 * (count - 1);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  p;
+    unsigned long  j;
+    accepted = 0;
+    correct = 0;
+    for (p = 0; p < POLICY_COUNT; p++) {
+        for (j = 0; j < job_count; j++) {
+            unsigned long  sum = 0;
+            unsigned long  i;
+            for (i = 0; i < count; i++) {
+                sum += i;
+            }
+            jobs[j].result = sum;
+            accepted++;
+            correct += (sum == expected_result());
+        }
+    }
+    max_running = 1;
+    final_queue_depth = 0;
+}
+
+static flt_range_task  add_range;
+static flt_task  finish_job;
+static flt_task  run_job;
+
+static void
+add_range(struct flt *flt, void *ud, size_t min, size_t max)
+{
+    struct job_state  *job = ud;
+    unsigned long  sum = 0;
+    size_t  i;
+    for (i = min; i < max; i++) {
+        sum += i;
+    }
+    __sync_fetch_and_add(&job->result, sum);
+}
+
+static void
+finish_job(struct flt *flt, void *ud, size_t j)
+{
+    __sync_fetch_and_sub(&running, 1);
+}
+
+static void
+run_job(struct flt *flt, void *ud, size_t j)
+{
+    struct job_state  *job = &jobs[j];
+    struct flt_task_group  *group;
+    struct flt_task  *task;
+    unsigned long  now = __sync_add_and_fetch(&running, 1);
+    unsigned long  max;
+    while ((max = max_running) < now) {
+        (void) __sync_bool_compare_and_swap(&max_running, max, now);
+    }
+
+    group = flt_task_group_new(flt);
+    flt_task_group_run_after_current(flt, group);
+    task = flt_task_new(flt, finish_job, NULL, j);
+    flt_task_group_add(flt, group, task);
+    task = flt_range_task_new(flt, add_range, job, 0, count);
+    flt_run(flt, task);
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    unsigned long  p;
+    unsigned long  j;
+    accepted = 0;
+    correct = 0;
+    running = 0;
+    max_running = 0;
+    final_queue_depth = 0;
+
+    for (p = 0; p < POLICY_COUNT; p++) {
+        flt_fleet_set_job_limit(fleet, job_limit, policies[p]);
+        flt_fleet_start(fleet);
+        for (j = 0; j < job_count; j++) {
+            jobs[j].result = 0;
+            handles[j] = flt_fleet_submit(fleet, run_job, NULL, j);
+        }
+        for (j = 0; j < job_count; j++) {
+            if (handles[j] != NULL) {
+                flt_job_wait(handles[j]);
+                accepted++;
+                correct += (jobs[j].result == expected_result());
+            }
+        }
+        final_queue_depth += flt_fleet_queue_depth(fleet);
+        flt_fleet_stop(fleet);
+    }
+    flt_fleet_set_job_limit(fleet, 0, FLT_SUBMIT_BLOCK);
+}
+
+static int
+verify(void)
+{
+    /* Only the FLT_SUBMIT_FAIL round can reject jobs, and it has to accept at
+     * least the first `job_limit` of them. */
+    if (accepted < 2 * job_count + job_limit || accepted > 3 * job_count) {
+        fprintf(stderr, "bounded_jobs: Accepted %lu jobs\n", accepted);
+        return -1;
+    }
+    if (max_running > job_limit) {
+        fprintf(stderr, "bounded_jobs: Ran %lu jobs at once (limit %lu)\n",
+                max_running, job_limit);
+        return -1;
+    }
+    flt_check_result(bounded_jobs, "%lu", correct, accepted);
+    flt_check_result(bounded_jobs, "%zu", final_queue_depth, (size_t) 0);
+    return 0;
+}
+
+struct flt_example  bounded_jobs = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
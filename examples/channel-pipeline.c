@@ -0,0 +1,164 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* A two-stage pipeline.  A bulk producer task sends each integer in a range
+ * into the first stage, which turns `i` into `2i + 1` and sends that into the
+ * second stage, which adds up everything it receives.  The sum of the first
+ * `count` odd numbers is `count²`. */
+
+static unsigned long  max;
+static unsigned long  result;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 1) {
+        fprintf(stderr, "Usage: channel_pipeline [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    max = flt_parse_ulong(argv[0]);
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "channel_pipeline:%lu", max);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  sum = 0;
+    unsigned long  i;
+    for (i = 0; i < max; i++) {
+        sum += 2 * i + 1;
+    }
+    result = sum;
+}
+
+struct pipeline {
+    struct flt_channel  *odd;
+    struct flt_channel  *sum;
+    struct flt_local  *sums;
+};
+
+static struct pipeline  pipeline;
+
+static flt_task  add_odd;
+static flt_task  make_odd;
+static flt_task  produce;
+static flt_task  merge_sums;
+static flt_task  schedule;
+
+static void
+add_odd(struct flt *flt, void *ud, size_t unused)
+{
+    struct flt_channel_data  *cdata = ud;
+    struct flt_local  *sums = cdata->ud;
+    unsigned long  *sum = flt_local_get(flt, sums, unsigned long);
+    *sum += (uintptr_t) cdata->data;
+}
+
+static void
+make_odd(struct flt *flt, void *ud, size_t unused)
+{
+    struct flt_channel_data  *cdata = ud;
+    struct pipeline  *pipeline = cdata->ud;
+    uintptr_t  i = (uintptr_t) cdata->data;
+    void  *odd = (void *) (2 * i + 1);
+
+    /* Exercise each of the different ways to send a message. */
+    if (i % 3 == 0) {
+        flt_channel_send(pipeline->sum, flt, odd);
+    } else if (i % 3 == 1) {
+        flt_channel_send_later(pipeline->sum, flt, odd);
+    } else {
+        flt_channel_return_to(pipeline->sum, flt, odd);
+    }
+}
+
+static void
+produce(struct flt *flt, void *ud, size_t i)
+{
+    struct pipeline  *pipeline = ud;
+    flt_channel_send(pipeline->odd, flt, (void *) (uintptr_t) i);
+}
+
+static void
+merge_one_sum(struct flt *flt, unsigned long *sum, int dummy)
+{
+    result += *sum;
+}
+
+static void
+merge_sums(struct flt *flt, void *ud, size_t unused)
+{
+    struct pipeline  *pipeline = ud;
+    flt_local_visit(flt, pipeline->sums, unsigned long, merge_one_sum, 0);
+    flt_local_free(flt, pipeline->sums);
+    flt_channel_free(pipeline->odd);
+    flt_channel_free(pipeline->sum);
+}
+
+static void
+ulong_init(struct flt *flt, void *ud, void *vinstance)
+{
+    unsigned long  *instance = vinstance;
+    *instance = 0;
+}
+
+static void
+ulong_done(struct flt *flt, void *ud, void *vinstance)
+{
+}
+
+static void
+schedule(struct flt *flt, void *ud, size_t unused)
+{
+    struct flt_task_group  *group;
+    pipeline.sums =
+        flt_local_new(flt, unsigned long, NULL, ulong_init, ulong_done);
+    pipeline.odd = flt_channel_new(flt, make_odd, &pipeline);
+    pipeline.sum = flt_channel_new(flt, add_odd, pipeline.sums);
+    group = flt_task_group_new(flt);
+    flt_task_group_run_after_current(flt, group);
+    flt_task_group_add(flt, group, flt_task_new(flt, merge_sums, &pipeline, 0));
+    flt_run(flt, flt_bulk_task_new(flt, produce, &pipeline, 0, max));
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    result = 0;
+    flt_fleet_run(fleet, schedule, NULL, 0);
+}
+
+static int
+verify(void)
+{
+    unsigned long  expected = max * max;
+    flt_check_result(channel_pipeline, "%lu", result, expected);
+    return 0;
+}
+
+struct flt_example  channel_pipeline = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
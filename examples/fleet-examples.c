@@ -12,10 +12,27 @@
 
 #include "examples.h"
 
+extern struct flt_example  async_read;
+extern struct flt_example  blocking_tasks;
+extern struct flt_example  bounded_jobs;
+extern struct flt_example  channel_pipeline;
 extern struct flt_example  concurrent_batched;
+extern struct flt_example  concurrent_batched_range;
 extern struct flt_example  concurrent_unbatched;
+extern struct flt_example  future_pipeline;
+extern struct flt_example  inline_args;
+extern struct flt_example  malloc_alloc;
+extern struct flt_example  malloc_args;
+extern struct flt_example  pool_alloc;
+extern struct flt_example  recursive_wait;
+extern struct flt_example  repeated_runs;
 extern struct flt_example  sequential_return;
 extern struct flt_example  sequential_run;
+extern struct flt_example  service_jobs;
+extern struct flt_example  service_wait;
+extern struct flt_example  speculative_search;
+extern struct flt_example  task_dag;
+extern struct flt_example  timers;
 
 #define run_example(name, ...) \
     do { \
@@ -34,6 +51,25 @@ run_all_examples(void)
     run_example(concurrent_batched, "16", "100000000");
     run_example(concurrent_batched, "256", "100000000");
     run_example(concurrent_batched, "1024", "100000000");
+    run_example(concurrent_batched_range, "16", "100000000");
+    run_example(concurrent_batched_range, "256", "100000000");
+    run_example(concurrent_batched_range, "1024", "100000000");
+    run_example(repeated_runs, "100000");
+    run_example(blocking_tasks, "100000");
+    run_example(async_read, "4096", "100000000");
+    run_example(service_jobs, "1000", "100000");
+    run_example(service_wait, "1000", "1000");
+    run_example(bounded_jobs, "16", "1000", "100000");
+    run_example(timers, "1000000", "50000");
+    run_example(speculative_search, "100000000", "10000000");
+    run_example(task_dag, "100", "200");
+    run_example(future_pipeline, "1024", "100000000");
+    run_example(recursive_wait, "1024", "100000000");
+    run_example(channel_pipeline, "10000000");
+    run_example(malloc_alloc, "256", "10000000");
+    run_example(pool_alloc, "256", "10000000");
+    run_example(inline_args, "10000000");
+    run_example(malloc_args, "10000000");
 }
 
 #define run_named_example(name) \
@@ -55,6 +91,23 @@ run_named_examples(int argc, char **argv)
     run_named_example(sequential_run);
     run_named_example(concurrent_unbatched);
     run_named_example(concurrent_batched);
+    run_named_example(concurrent_batched_range);
+    run_named_example(repeated_runs);
+    run_named_example(blocking_tasks);
+    run_named_example(async_read);
+    run_named_example(service_jobs);
+    run_named_example(service_wait);
+    run_named_example(bounded_jobs);
+    run_named_example(timers);
+    run_named_example(speculative_search);
+    run_named_example(task_dag);
+    run_named_example(future_pipeline);
+    run_named_example(recursive_wait);
+    run_named_example(channel_pipeline);
+    run_named_example(malloc_alloc);
+    run_named_example(pool_alloc);
+    run_named_example(inline_args);
+    run_named_example(malloc_args);
     fprintf(stderr, "Unknown example %s\n", example_name);
     exit(EXIT_FAILURE);
 }
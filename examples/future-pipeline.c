@@ -0,0 +1,222 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Sums up a range of integers by passing partial sums along through futures,
+ * instead of through context-local storage.  The range is split in half until
+ * each piece is small enough to sum directly; each inner node waits for both
+ * of its halves with flt_when_all.  At the top, we race the tree against a
+ * closed-form calculation with flt_when_any, and wait for both of them with
+ * flt_when_all so that we can check that they agree. */
+
+struct node {
+    unsigned long  min;
+    unsigned long  max;
+    struct flt_future  *future;
+    struct node  *halves[2];
+};
+
+static unsigned long  min;
+static unsigned long  max;
+static unsigned long  batch_size;
+static unsigned long  result;
+static unsigned long  any_result;
+static volatile unsigned long  mismatches;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: future_pipeline [batch size] [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    min = 0;
+    max = flt_parse_ulong(argv[1]);
+    batch_size = flt_parse_ulong(argv[0]);
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "future_pipeline:%lu:%lu", batch_size, max);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  sum = 0;
+    unsigned long  i;
+    for (i = min; i < max; i++) {
+        sum += i;
+    }
+    result = sum;
+    any_result = sum;
+}
+
+static flt_task  sum_node;
+static flt_task  merge_halves;
+static flt_task  sum_closed_form;
+static flt_task  record_any;
+static flt_task  compare_both;
+static flt_task  schedule;
+
+#define ulong_value(ptr)  ((unsigned long) (uintptr_t) (ptr))
+#define value_ulong(n)    ((void *) (uintptr_t) (n))
+
+static unsigned long
+closed_form(void)
+{
+    return max / 2 * (max - 1) + (max % 2) * (max - 1) / 2;
+}
+
+static struct node *
+node_new(struct flt *flt, unsigned long min, unsigned long max)
+{
+    struct node  *node = malloc(sizeof(struct node));
+    node->min = min;
+    node->max = max;
+    node->future = flt_future_new(flt);
+    return node;
+}
+
+static void
+node_free(struct flt *flt, struct node *node)
+{
+    flt_future_free(flt, node->future);
+    free(node);
+}
+
+static void
+sum_node(struct flt *flt, void *ud, size_t unused)
+{
+    struct node  *node = ud;
+    struct flt_future  *both[2];
+    struct flt_future  *all;
+    unsigned long  mid;
+
+    if (node->max - node->min <= batch_size) {
+        unsigned long  sum = 0;
+        unsigned long  i;
+        for (i = node->min; i < node->max; i++) {
+            sum += i;
+        }
+        flt_future_set(flt, node->future, value_ulong(sum));
+        return;
+    }
+
+    mid = node->min + (node->max - node->min) / 2;
+    node->halves[0] = node_new(flt, node->min, mid);
+    node->halves[1] = node_new(flt, mid, node->max);
+    both[0] = node->halves[0]->future;
+    both[1] = node->halves[1]->future;
+    all = flt_when_all(flt, both, 2);
+    flt_then(flt, all, flt_task_new(flt, merge_halves, node, 0));
+    flt_future_free(flt, all);
+    flt_run(flt, flt_task_new(flt, sum_node, node->halves[0], 0));
+    flt_run(flt, flt_task_new(flt, sum_node, node->halves[1], 0));
+}
+
+static void
+merge_halves(struct flt *flt, void *ud, size_t unused)
+{
+    struct node  *node = ud;
+    unsigned long  sum =
+        ulong_value(flt_future_get(flt, node->halves[0]->future)) +
+        ulong_value(flt_future_get(flt, node->halves[1]->future));
+    node_free(flt, node->halves[0]);
+    node_free(flt, node->halves[1]);
+    flt_future_set(flt, node->future, value_ulong(sum));
+}
+
+static void
+sum_closed_form(struct flt *flt, void *ud, size_t unused)
+{
+    struct flt_future  *future = ud;
+    flt_future_set(flt, future, value_ulong(closed_form()));
+}
+
+static void
+record_any(struct flt *flt, void *ud, size_t unused)
+{
+    any_result = ulong_value(flt_future_value(flt));
+}
+
+static void
+compare_both(struct flt *flt, void *ud, size_t unused)
+{
+    struct flt_future  **both = ud;
+    unsigned long  tree = ulong_value(flt_future_get(flt, both[0]));
+    unsigned long  closed = ulong_value(flt_future_get(flt, both[1]));
+    if (tree != closed) {
+        mismatches++;
+    }
+    result = tree;
+    flt_future_free(flt, both[0]);
+    flt_future_free(flt, both[1]);
+    free(both);
+}
+
+static struct node  root;
+
+static void
+schedule(struct flt *flt, void *ud, size_t unused)
+{
+    struct flt_future  **both = malloc(2 * sizeof(struct flt_future *));
+    struct flt_future  *any;
+    struct flt_future  *all;
+
+    /* compare_both takes over our references to both of these. */
+    root.min = min;
+    root.max = max;
+    root.future = flt_future_new(flt);
+    both[0] = root.future;
+    both[1] = flt_future_new(flt);
+    any = flt_when_any(flt, both, 2);
+    all = flt_when_all(flt, both, 2);
+    flt_then(flt, any, flt_task_new(flt, record_any, NULL, 0));
+    flt_then(flt, all, flt_task_new(flt, compare_both, both, 0));
+    flt_future_free(flt, any);
+    flt_future_free(flt, all);
+
+    flt_run(flt, flt_task_new(flt, sum_closed_form, both[1], 0));
+    flt_run(flt, flt_task_new(flt, sum_node, &root, 0));
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    result = 0;
+    any_result = 0;
+    mismatches = 0;
+    flt_fleet_run(fleet, schedule, NULL, 0);
+}
+
+static int
+verify(void)
+{
+    unsigned long  expected = closed_form();
+    flt_check_result(future_pipeline, "%lu", mismatches, 0UL);
+    flt_check_result(future_pipeline, "%lu", result, expected);
+    flt_check_result(future_pipeline, "%lu", any_result, expected);
+    return 0;
+}
+
+struct flt_example  future_pipeline = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
@@ -0,0 +1,184 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Spawns a separate task for each integer `i` in a range, passing it the pair
+ * `(i, i + 1)` as its arguments; each task adds together the two halves of its
+ * pair.  The sum of the first `count` odd numbers is `count²`.  inline_args
+ * copies each pair into its task with flt_task_new_with_data; malloc_args is
+ * the same computation, allocating each pair separately. */
+
+struct pair {
+    unsigned long  a;
+    unsigned long  b;
+};
+
+static unsigned long  max;
+static unsigned long  result;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 1) {
+        fprintf(stderr, "Usage: inline_args [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    max = flt_parse_ulong(argv[0]);
+}
+
+static void
+inline_print_name(FILE *out)
+{
+    fprintf(out, "inline_args:%lu", max);
+}
+
+static void
+malloc_print_name(FILE *out)
+{
+    fprintf(out, "malloc_args:%lu", max);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  sum = 0;
+    unsigned long  i;
+    for (i = 0; i < max; i++) {
+        sum += i + (i + 1);
+    }
+    result = sum;
+}
+
+static struct flt_local  *sums;
+
+static flt_task  add_inline_pair;
+static flt_task  add_malloc_pair;
+static flt_task  merge_sums;
+static flt_task  schedule;
+static flt_task  spawn;
+
+static void
+add_inline_pair(struct flt *flt, void *ud, size_t unused)
+{
+    struct pair  *pair = ud;
+    unsigned long  *sum = flt_local_get(flt, sums, unsigned long);
+    *sum += pair->a + pair->b;
+}
+
+static void
+add_malloc_pair(struct flt *flt, void *ud, size_t unused)
+{
+    struct pair  *pair = ud;
+    unsigned long  *sum = flt_local_get(flt, sums, unsigned long);
+    *sum += pair->a + pair->b;
+    free(pair);
+}
+
+/* The spawning task's own arguments are copied into it, too, so that each half
+ * of the bulk task gets its own copy when it's split. */
+struct spawn_args {
+    int  use_inline;
+};
+
+static void
+spawn(struct flt *flt, void *ud, size_t i)
+{
+    struct spawn_args  *args = ud;
+    if (args->use_inline) {
+        struct pair  pair = { i, i + 1 };
+        flt_run(flt, flt_task_new_with_data(flt, add_inline_pair, &pair, 0));
+    } else {
+        struct pair  *pair = malloc(sizeof(struct pair));
+        pair->a = i;
+        pair->b = i + 1;
+        flt_run(flt, flt_task_new(flt, add_malloc_pair, pair, 0));
+    }
+}
+
+static void
+merge_one_sum(struct flt *flt, unsigned long *sum, int dummy)
+{
+    result += *sum;
+}
+
+static void
+merge_sums(struct flt *flt, void *ud, size_t unused)
+{
+    flt_local_visit(flt, sums, unsigned long, merge_one_sum, 0);
+    flt_local_free(flt, sums);
+}
+
+static void
+ulong_init(struct flt *flt, void *ud, void *vinstance)
+{
+    unsigned long  *instance = vinstance;
+    *instance = 0;
+}
+
+static void
+ulong_done(struct flt *flt, void *ud, void *vinstance)
+{
+}
+
+static void
+schedule(struct flt *flt, void *ud, size_t use_inline)
+{
+    struct flt_task_group  *group;
+    struct spawn_args  args;
+    args.use_inline = use_inline;
+    sums = flt_local_new(flt, unsigned long, NULL, ulong_init, ulong_done);
+    group = flt_task_group_new(flt);
+    flt_task_group_run_after_current(flt, group);
+    flt_task_group_add(flt, group, flt_task_new(flt, merge_sums, NULL, 0));
+    flt_run(flt, flt_bulk_task_new_with_data(flt, spawn, &args, 0, max));
+}
+
+static void
+inline_run_in_fleet(struct flt_fleet *fleet)
+{
+    result = 0;
+    flt_fleet_run(fleet, schedule, NULL, 1);
+}
+
+static void
+malloc_run_in_fleet(struct flt_fleet *fleet)
+{
+    result = 0;
+    flt_fleet_run(fleet, schedule, NULL, 0);
+}
+
+static int
+verify(void)
+{
+    unsigned long  expected = max * max;
+    flt_check_result(inline_args, "%lu", result, expected);
+    return 0;
+}
+
+struct flt_example  inline_args = {
+    configure,
+    inline_print_name,
+    run_native,
+    inline_run_in_fleet,
+    verify
+};
+
+struct flt_example  malloc_args = {
+    configure,
+    malloc_print_name,
+    run_native,
+    malloc_run_in_fleet,
+    verify
+};
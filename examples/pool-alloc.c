@@ -0,0 +1,189 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Allocates a small record for each integer in a range, in batches.  Each
+ * batch of records is added up (and freed) by a separate task, which is
+ * usually stolen by some other context, so most records are freed by a
+ * different context than the one that allocated them.  pool_alloc allocates
+ * the records from an flt_pool; malloc_alloc is the same computation using
+ * malloc and free, for comparison. */
+
+struct record {
+    struct record  *next;
+    unsigned long  value;
+    char  payload[48];
+};
+
+static unsigned long  max;
+static unsigned long  batch_size;
+static unsigned long  result;
+static struct flt_pool  *pool;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: pool_alloc [batch size] [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    max = flt_parse_ulong(argv[1]);
+    batch_size = flt_parse_ulong(argv[0]);
+}
+
+static void
+pool_print_name(FILE *out)
+{
+    fprintf(out, "pool_alloc:%lu:%lu", batch_size, max);
+}
+
+static void
+malloc_print_name(FILE *out)
+{
+    fprintf(out, "malloc_alloc:%lu:%lu", batch_size, max);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  sum = 0;
+    unsigned long  i;
+    for (i = 0; i < max; i++) {
+        struct record  *record = malloc(sizeof(struct record));
+        record->value = i;
+        sum += record->value;
+        free(record);
+    }
+    result = sum;
+}
+
+static struct record *
+record_new(struct flt *flt)
+{
+    if (pool == NULL) {
+        return malloc(sizeof(struct record));
+    } else {
+        return flt_pool_new_instance(pool, flt);
+    }
+}
+
+static void
+record_free(struct flt *flt, struct record *record)
+{
+    if (pool == NULL) {
+        free(record);
+    } else {
+        flt_pool_free_instance(pool, flt, record);
+    }
+}
+
+static flt_task  add_batch;
+static flt_task  fill_batch;
+static flt_task  free_pool;
+static flt_task  schedule;
+
+static void
+add_batch(struct flt *flt, void *ud, size_t unused)
+{
+    struct record  *record = ud;
+    unsigned long  sum = 0;
+    while (record != NULL) {
+        struct record  *next = record->next;
+        sum += record->value;
+        record_free(flt, record);
+        record = next;
+    }
+    __sync_add_and_fetch(&result, sum);
+}
+
+static void
+fill_batch(struct flt *flt, void *ud, size_t i)
+{
+    struct record  *head = NULL;
+    unsigned long  j = i * batch_size;
+    unsigned long  end = j + batch_size;
+    if (end > max) {
+        end = max;
+    }
+    for (; j < end; j++) {
+        struct record  *record = record_new(flt);
+        record->value = j;
+        record->payload[0] = (char) j;
+        record->next = head;
+        head = record;
+    }
+    flt_run(flt, flt_task_new(flt, add_batch, head, 0));
+}
+
+static void
+free_pool(struct flt *flt, void *ud, size_t unused)
+{
+    if (pool != NULL) {
+        flt_pool_free(pool);
+        pool = NULL;
+    }
+}
+
+static void
+schedule(struct flt *flt, void *ud, size_t use_pool)
+{
+    struct flt_task_group  *group;
+    unsigned long  batch_count = (max + batch_size - 1) / batch_size;
+    if (use_pool) {
+        pool = flt_pool_new(flt, struct record, NULL, NULL, NULL, NULL);
+    }
+    group = flt_task_group_new(flt);
+    flt_task_group_run_after_current(flt, group);
+    flt_task_group_add(flt, group, flt_task_new(flt, free_pool, NULL, 0));
+    flt_run(flt, flt_bulk_task_new(flt, fill_batch, NULL, 0, batch_count));
+}
+
+static void
+pool_run_in_fleet(struct flt_fleet *fleet)
+{
+    result = 0;
+    flt_fleet_run(fleet, schedule, NULL, 1);
+}
+
+static void
+malloc_run_in_fleet(struct flt_fleet *fleet)
+{
+    result = 0;
+    flt_fleet_run(fleet, schedule, NULL, 0);
+}
+
+static int
+verify(void)
+{
+    unsigned long  expected = max / 2 * (max - 1) + (max % 2) * (max - 1) / 2;
+    flt_check_result(pool_alloc, "%lu", result, expected);
+    return 0;
+}
+
+struct flt_example  pool_alloc = {
+    configure,
+    pool_print_name,
+    run_native,
+    pool_run_in_fleet,
+    verify
+};
+
+struct flt_example  malloc_alloc = {
+    configure,
+    malloc_print_name,
+    run_native,
+    malloc_run_in_fleet,
+    verify
+};
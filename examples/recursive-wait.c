@@ -0,0 +1,129 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Sums up a range of integers with a plain divide-and-conquer recursion.  Each
+ * task that's too big to sum directly puts its two halves into a new group,
+ * waits for the group, and then adds up the results that its children left in
+ * its own stack frame.  That only works because the fleet runs tasks in
+ * fibers. */
+
+struct half {
+    unsigned long  min;
+    unsigned long  max;
+    unsigned long  sum;
+};
+
+static unsigned long  min;
+static unsigned long  max;
+static unsigned long  batch_size;
+static unsigned long  result;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: recursive_wait [batch size] [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    min = 0;
+    max = flt_parse_ulong(argv[1]);
+    batch_size = flt_parse_ulong(argv[0]);
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "recursive_wait:%lu:%lu", batch_size, max);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  sum = 0;
+    unsigned long  i;
+    for (i = min; i < max; i++) {
+        sum += i;
+    }
+    result = sum;
+}
+
+static flt_task  sum_half;
+static flt_task  schedule;
+
+static void
+sum_half(struct flt *flt, void *ud, size_t unused)
+{
+    struct half  *self = ud;
+    struct half  halves[2];
+    struct flt_task_group  *group;
+    unsigned long  mid;
+
+    if (self->max - self->min <= batch_size) {
+        unsigned long  sum = 0;
+        unsigned long  i;
+        for (i = self->min; i < self->max; i++) {
+            sum += i;
+        }
+        self->sum = sum;
+        return;
+    }
+
+    mid = self->min + (self->max - self->min) / 2;
+    halves[0].min = self->min;
+    halves[0].max = mid;
+    halves[1].min = mid;
+    halves[1].max = self->max;
+    group = flt_task_group_new(flt);
+    flt_task_group_add(flt, group, flt_task_new(flt, sum_half, &halves[0], 0));
+    flt_task_group_add(flt, group, flt_task_new(flt, sum_half, &halves[1], 0));
+    flt_task_group_start(flt, group);
+    flt_task_group_wait(flt, group);
+    self->sum = halves[0].sum + halves[1].sum;
+}
+
+static void
+schedule(struct flt *flt, void *ud, size_t unused)
+{
+    struct half  all;
+    all.min = min;
+    all.max = max;
+    sum_half(flt, &all, 0);
+    result = all.sum;
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    result = 0;
+    flt_fleet_set_task_mode(fleet, FLT_TASK_FIBERS);
+    flt_fleet_run(fleet, schedule, NULL, 0);
+}
+
+static int
+verify(void)
+{
+    unsigned long  expected = max / 2 * (max - 1) + (max % 2) * (max - 1) / 2;
+    flt_check_result(recursive_wait, "%lu", result, expected);
+    return 0;
+}
+
+struct flt_example  recursive_wait = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
@@ -0,0 +1,81 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Runs a fleet many times in a row, with a root task that does almost nothing.
+ * This measures the fixed overhead of starting and finishing a fleet run. */
+
+static unsigned long  count;
+static unsigned long  result;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 1) {
+        fprintf(stderr, "Usage: repeated_runs [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    count = flt_parse_ulong(argv[0]);
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "repeated_runs:%lu", count);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  i;
+    result = 0;
+    for (i = 0; i < count; i++) {
+        result += 1;
+    }
+}
+
+static flt_task  add_one;
+
+static void
+add_one(struct flt *flt, void *ud, size_t i)
+{
+    unsigned long  *result = ud;
+    *result += 1;
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    unsigned long  i;
+    result = 0;
+    for (i = 0; i < count; i++) {
+        flt_fleet_run(fleet, add_one, &result, i);
+    }
+}
+
+static int
+verify(void)
+{
+    flt_check_result(repeated_runs, "%lu", result, count);
+    return 0;
+}
+
+struct flt_example  repeated_runs = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
@@ -14,6 +14,7 @@
 #include <string.h>
 #include <sys/resource.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "fleet.h"
 #include "examples.h"
@@ -122,6 +123,69 @@ run_4core(FILE *out, struct flt_example *example)
     flt_fleet_free(fleet);
 }
 
+static void
+run_4core_lazy(FILE *out, struct flt_example *example)
+{
+    struct flt_fleet  *fleet = flt_fleet_new();
+    flt_fleet_set_context_count(fleet, 4);
+    flt_fleet_set_split_policy(fleet, FLT_SPLIT_LAZY);
+    run("4core_lazy", example->run_in_fleet(fleet));
+    flt_fleet_free(fleet);
+}
+
+static void
+run_4core_pinned(FILE *out, struct flt_example *example)
+{
+    struct flt_fleet  *fleet = flt_fleet_new();
+    flt_fleet_set_context_count(fleet, 4);
+    flt_fleet_set_affinity(fleet, FLT_AFFINITY_COMPACT);
+    run("4core_pinned", example->run_in_fleet(fleet));
+    flt_fleet_free(fleet);
+}
+
+static void
+run_4core_spin(FILE *out, struct flt_example *example)
+{
+    struct flt_fleet  *fleet = flt_fleet_new();
+    flt_fleet_set_context_count(fleet, 4);
+    flt_fleet_set_idle_policy(fleet, FLT_IDLE_SPIN);
+    run("4core_spin", example->run_in_fleet(fleet));
+    flt_fleet_free(fleet);
+}
+
+static void
+run_4core_yield(FILE *out, struct flt_example *example)
+{
+    struct flt_fleet  *fleet = flt_fleet_new();
+    flt_fleet_set_context_count(fleet, 4);
+    flt_fleet_set_idle_policy(fleet, FLT_IDLE_YIELD);
+    run("4core_yield", example->run_in_fleet(fleet));
+    flt_fleet_free(fleet);
+}
+
+static void
+run_count(FILE *out, struct flt_example *example, unsigned int count)
+{
+    char  config[32];
+    struct flt_fleet  *fleet = flt_fleet_new();
+    flt_fleet_set_context_count(fleet, count);
+    snprintf(config, sizeof(config), "%ucore", count);
+    run(config, example->run_in_fleet(fleet));
+    flt_fleet_free(fleet);
+}
+
+/* Runs the example with 1, 2, 4, ... contexts, up to one context for each
+ * processor on the machine. */
+static void
+run_scaling(FILE *out, struct flt_example *example)
+{
+    unsigned int  max_count = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int  count;
+    for (count = 1; count < max_count; count *= 2) {
+        run_count(out, example, count);
+    }
+    run_count(out, example, max_count);
+}
 
 void
 flt_run_example(FILE *out, struct flt_example *example)
@@ -149,6 +213,11 @@ flt_run_example_config(FILE *out, const char *config,
     try_config(single);
     try_config(2core);
     try_config(4core);
+    try_config(4core_lazy);
+    try_config(4core_pinned);
+    try_config(4core_spin);
+    try_config(4core_yield);
+    try_config(scaling);
     fprintf(stderr, "Unknown config %s\n", config);
     exit(EXIT_FAILURE);
 }
@@ -0,0 +1,184 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Runs a fleet in service mode, and submits a bunch of independent jobs to it
+ * from two threads outside of the fleet.  Each job adds up a range of numbers
+ * using a bulk task, and then merges the per-context sums in a group that runs
+ * after the bulk task; the job's handle shouldn't report that it's finished
+ * until the merge is done, too.  Each job also starts an empty group (like a
+ * fan-out over zero items), which must not keep the job from finishing. */
+
+#define SUBMITTER_COUNT  2
+
+struct job_state {
+    struct flt_local  *local;
+    unsigned long  result;
+};
+
+static unsigned long  job_count;
+static unsigned long  count;
+static struct job_state  *jobs;
+static struct flt_fleet  *service;
+static unsigned long  firsts[SUBMITTER_COUNT];
+/* The number of jobs whose handles fired before the job was done */
+static volatile unsigned long  premature;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: service_jobs [job count] [count]\n");
+        exit(EXIT_FAILURE);
+    }
+    job_count = flt_parse_ulong(argv[0]);
+    count = flt_parse_ulong(argv[1]);
+    free(jobs);
+    jobs = calloc(job_count, sizeof(struct job_state));
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "service_jobs:%lu:%lu", job_count, count);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  j;
+    for (j = 0; j < job_count; j++) {
+        unsigned long  sum = 0;
+        unsigned long  i;
+        for (i = 0; i < count; i++) {
+            sum += i;
+        }
+        jobs[j].result = sum;
+    }
+}
+
+static flt_task  add_one;
+static flt_task  merge;
+static flt_task  run_job;
+
+static void
+add_one(struct flt *flt, void *ud, size_t i)
+{
+    struct job_state  *job = ud;
+    unsigned long  *result = flt_local_get(flt, job->local, unsigned long);
+    *result += i;
+}
+
+static void
+merge_one(struct flt *flt, unsigned long *sum, struct job_state *job)
+{
+    job->result += *sum;
+}
+
+static void
+merge(struct flt *flt, void *ud, size_t i)
+{
+    struct job_state  *job = ud;
+    flt_local_visit(flt, job->local, unsigned long, merge_one, job);
+    flt_local_free(flt, job->local);
+}
+
+static void
+ulong_init(struct flt *flt, void *ud, void *vinstance)
+{
+    unsigned long  *instance = vinstance;
+    *instance = 0;
+}
+
+static void
+ulong_done(struct flt *flt, void *ud, void *vinstance)
+{
+}
+
+static void
+run_job(struct flt *flt, void *ud, size_t j)
+{
+    struct job_state  *job = &jobs[j];
+    struct flt_task_group  *group;
+    struct flt_task  *task;
+    job->result = 0;
+    job->local =
+        flt_local_new(flt, unsigned long, NULL, ulong_init, ulong_done);
+    group = flt_task_group_new(flt);
+    flt_task_group_run_after_current(flt, group);
+    task = flt_task_new(flt, merge, job, 0);
+    flt_task_group_add(flt, group, task);
+    task = flt_bulk_task_new(flt, add_one, job, 0, count);
+    flt_run(flt, task);
+    flt_task_group_start(flt, flt_task_group_new(flt));
+}
+
+static void *
+submit_jobs(void *ud)
+{
+    unsigned long  first = *(unsigned long *) ud;
+    unsigned long  j;
+    struct flt_job  **handles = calloc(job_count, sizeof(struct flt_job *));
+    for (j = first; j < job_count; j += SUBMITTER_COUNT) {
+        handles[j] = flt_fleet_submit(service, run_job, NULL, j);
+    }
+    for (j = first; j < job_count; j += SUBMITTER_COUNT) {
+        flt_job_wait(handles[j]);
+        if (jobs[j].result != count / 2 * (count - 1)) {
+            __sync_fetch_and_add(&premature, 1);
+        }
+    }
+    free(handles);
+    return NULL;
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    pthread_t  submitters[SUBMITTER_COUNT];
+    unsigned long  s;
+    service = fleet;
+    premature = 0;
+    flt_fleet_start(fleet);
+    for (s = 0; s < SUBMITTER_COUNT; s++) {
+        firsts[s] = s;
+        pthread_create(&submitters[s], NULL, submit_jobs, &firsts[s]);
+    }
+    for (s = 0; s < SUBMITTER_COUNT; s++) {
+        pthread_join(submitters[s], NULL);
+    }
+    flt_fleet_stop(fleet);
+}
+
+static int
+verify(void)
+{
+    unsigned long  expected = count / 2 * (count - 1);
+    unsigned long  j;
+    flt_check_result(service_jobs, "%lu", premature, 0UL);
+    for (j = 0; j < job_count; j++) {
+        flt_check_result(service_jobs, "%lu", jobs[j].result, expected);
+    }
+    return 0;
+}
+
+struct flt_example  service_jobs = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
@@ -0,0 +1,142 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Runs a fleet in service mode using fibers, and submits a bunch of jobs to
+ * it.  Each job starts a series of task groups, one at a time, waiting for each
+ * one to finish before starting the next; each group adds one number to the
+ * job's sum.  Once they're all done, the job waits on every one of its groups
+ * again.  A job's groups must stay valid until the whole job has finished, no
+ * matter how many other groups it (or any other job) creates in the meantime,
+ * so those second waits should all return right away.  Each job also waits for
+ * an empty group, which finishes as soon as it starts. */
+
+struct job_state {
+    struct flt_task_group  **groups;
+    unsigned long  result;
+};
+
+static unsigned long  job_count;
+static unsigned long  group_count;
+static struct job_state  *jobs;
+static struct flt_task_group  **groups;
+
+static void
+configure(int argc, char **argv)
+{
+    unsigned long  j;
+    if (argc != 2) {
+        fprintf(stderr, "Usage: service_wait [job count] [group count]\n");
+        exit(EXIT_FAILURE);
+    }
+    job_count = flt_parse_ulong(argv[0]);
+    group_count = flt_parse_ulong(argv[1]);
+    free(jobs);
+    free(groups);
+    jobs = calloc(job_count, sizeof(struct job_state));
+    groups = calloc(job_count * group_count, sizeof(struct flt_task_group *));
+    for (j = 0; j < job_count; j++) {
+        jobs[j].groups = &groups[j * group_count];
+    }
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "service_wait:%lu:%lu", job_count, group_count);
+}
+
+static void
+run_native(void)
+{
+    unsigned long  j;
+    for (j = 0; j < job_count; j++) {
+        unsigned long  sum = 0;
+        unsigned long  i;
+        for (i = 0; i < group_count; i++) {
+            sum += i;
+        }
+        jobs[j].result = sum;
+    }
+}
+
+static flt_task  add_one;
+static flt_task  run_job;
+
+static void
+add_one(struct flt *flt, void *ud, size_t i)
+{
+    struct job_state  *job = ud;
+    job->result += i;
+}
+
+static void
+run_job(struct flt *flt, void *ud, size_t j)
+{
+    struct job_state  *job = &jobs[j];
+    struct flt_task_group  *empty;
+    unsigned long  i;
+    job->result = 0;
+    empty = flt_task_group_new(flt);
+    flt_task_group_start(flt, empty);
+    flt_task_group_wait(flt, empty);
+    for (i = 0; i < group_count; i++) {
+        struct flt_task_group  *group = flt_task_group_new(flt);
+        job->groups[i] = group;
+        flt_task_group_add(flt, group, flt_task_new(flt, add_one, job, i));
+        flt_task_group_start(flt, group);
+        flt_task_group_wait(flt, group);
+    }
+    for (i = 0; i < group_count; i++) {
+        flt_task_group_wait(flt, job->groups[i]);
+    }
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    struct flt_job  **handles = calloc(job_count, sizeof(struct flt_job *));
+    unsigned long  j;
+    flt_fleet_set_task_mode(fleet, FLT_TASK_FIBERS);
+    flt_fleet_start(fleet);
+    for (j = 0; j < job_count; j++) {
+        handles[j] = flt_fleet_submit(fleet, run_job, NULL, j);
+    }
+    for (j = 0; j < job_count; j++) {
+        flt_job_wait(handles[j]);
+    }
+    flt_fleet_stop(fleet);
+    free(handles);
+}
+
+static int
+verify(void)
+{
+    unsigned long  expected = group_count / 2 * (group_count - 1) +
+        (group_count % 2) * (group_count - 1) / 2;
+    unsigned long  j;
+    for (j = 0; j < job_count; j++) {
+        flt_check_result(service_wait, "%lu", jobs[j].result, expected);
+    }
+    return 0;
+}
+
+struct flt_example  service_wait = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
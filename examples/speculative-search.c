@@ -0,0 +1,173 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Searches a range of numbers for the one whose hash matches a target, using a
+ * range task.  The task that finds the match cancels its group, so that no one
+ * bothers searching the rest of the range.  We do this twice: once with a
+ * cancellation policy that still runs the groups that come after the search,
+ * and once with a policy that cancels them, too. */
+
+#define ROUND_COUNT  2
+/* The number of groups that run after each search */
+#define AFTER_COUNT  2
+
+static const enum flt_cancel_policy  policies[ROUND_COUNT] = {
+    FLT_CANCEL_RUN_AFTERS,
+    FLT_CANCEL_PROPAGATE
+};
+
+static unsigned long  count;
+static unsigned long  target;
+static volatile unsigned long  found[ROUND_COUNT];
+static volatile unsigned long  afters_run[ROUND_COUNT];
+static volatile unsigned long  searched[ROUND_COUNT];
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: speculative_search [count] [target]\n");
+        exit(EXIT_FAILURE);
+    }
+    count = flt_parse_ulong(argv[0]);
+    target = flt_parse_ulong(argv[1]);
+    if (target >= count) {
+        fprintf(stderr, "Target must be less than count\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "speculative_search:%lu:%lu", count, target);
+}
+
+static unsigned long
+hash(unsigned long i)
+{
+    unsigned int  j;
+    for (j = 0; j < 8; j++) {
+        i ^= i >> 17;
+        i *= 0xed5ad4bbUL;
+        i ^= i >> 11;
+    }
+    return i;
+}
+
+static void
+run_native(void)
+{
+    unsigned long  expected = hash(target);
+    unsigned int  r;
+    for (r = 0; r < ROUND_COUNT; r++) {
+        unsigned long  i;
+        for (i = 0; i < count; i++) {
+            if (hash(i) == expected && i == target) {
+                break;
+            }
+        }
+        found[r] = i;
+        afters_run[r] = (policies[r] == FLT_CANCEL_PROPAGATE)? 0: AFTER_COUNT;
+        searched[r] = i + 1;
+    }
+}
+
+static flt_range_task  search;
+static flt_task  after_search;
+static flt_task  start_search;
+
+static void
+search(struct flt *flt, void *ud, size_t min, size_t max)
+{
+    size_t  r = (size_t) (unsigned long) ud;
+    unsigned long  expected = hash(target);
+    size_t  i;
+    for (i = min; i < max; i++) {
+        /* Checking for cancellation is cheap, but not free, so don't do it on
+         * every iteration. */
+        if ((i & 0x3f) == 0 && flt_is_cancelled(flt)) {
+            break;
+        }
+        if (hash(i) == expected && i == target) {
+            found[r] = i;
+            flt_task_group_cancel_current(flt, policies[r]);
+        }
+    }
+    __sync_fetch_and_add(&searched[r], i - min);
+}
+
+static void
+after_search(struct flt *flt, void *ud, size_t r)
+{
+    __sync_fetch_and_add(&afters_run[r], 1);
+}
+
+static void
+start_search(struct flt *flt, void *ud, size_t r)
+{
+    struct flt_task_group  *group = flt_task_group_new(flt);
+    struct flt_task_group  *prev = group;
+    unsigned int  j;
+    flt_task_group_add
+        (flt, group,
+         flt_range_task_new(flt, search, (void *) (unsigned long) r, 0, count));
+    for (j = 0; j < AFTER_COUNT; j++) {
+        struct flt_task_group  *after = flt_task_group_new(flt);
+        flt_task_group_add(flt, after, flt_task_new(flt, after_search, NULL, r));
+        flt_task_group_run_after(flt, prev, after);
+        prev = after;
+    }
+    flt_task_group_start(flt, group);
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    unsigned int  r;
+    for (r = 0; r < ROUND_COUNT; r++) {
+        found[r] = count;
+        afters_run[r] = 0;
+        searched[r] = 0;
+        flt_fleet_run(fleet, start_search, NULL, r);
+    }
+}
+
+static int
+verify(void)
+{
+    unsigned int  r;
+    for (r = 0; r < ROUND_COUNT; r++) {
+        flt_check_result(speculative_search, "%lu", found[r], target);
+        flt_check_result(speculative_search, "%lu", afters_run[r],
+                         (policies[r] == FLT_CANCEL_PROPAGATE)?
+                         0UL: (unsigned long) AFTER_COUNT);
+        if (searched[r] <= target || searched[r] > count) {
+            fprintf(stderr, "speculative_search: Searched %lu of %lu\n",
+                    searched[r], count);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct flt_example  speculative_search = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
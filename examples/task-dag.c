@@ -0,0 +1,191 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Builds a layered dependency graph out of task groups.  Each node in a layer
+ * depends on about half of the nodes in the previous layer, so there's lots of
+ * fan-in and fan-out, and lots of diamonds.  Each node's value is one more than
+ * the sum of its predecessors' values.  A node must never run before all of its
+ * predecessors have finished.  Halfway down, there's also an empty barrier
+ * group, which runs after every node in the layer above it, and which every node
+ * in the layer below it runs after. */
+
+struct node {
+    struct flt_task_group  *group;
+    unsigned long  value;
+    volatile int  done;
+};
+
+static unsigned long  depth;
+static unsigned long  width;
+static struct node  *nodes;
+static volatile unsigned long  out_of_order;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: task_dag [depth] [width]\n");
+        exit(EXIT_FAILURE);
+    }
+    depth = flt_parse_ulong(argv[0]);
+    width = flt_parse_ulong(argv[1]);
+    free(nodes);
+    nodes = calloc(depth * width, sizeof(struct node));
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "task_dag:%lu:%lu", depth, width);
+}
+
+#define node_at(layer, i)  (&nodes[(layer) * width + (i)])
+
+static int
+depends_on(unsigned long layer, unsigned long i, unsigned long j)
+{
+    return i == j || ((i + j + layer) % 2) == 0;
+}
+
+static unsigned long
+node_value(unsigned long layer, unsigned long i)
+{
+    unsigned long  value = 1;
+    unsigned long  j;
+    if (layer > 0) {
+        for (j = 0; j < width; j++) {
+            if (depends_on(layer, i, j)) {
+                struct node  *pred = node_at(layer - 1, j);
+                if (!pred->done) {
+                    __sync_fetch_and_add(&out_of_order, 1);
+                }
+                value += pred->value;
+            }
+        }
+    }
+    return value;
+}
+
+static void
+run_native(void)
+{
+    unsigned long  layer;
+    unsigned long  i;
+    for (layer = 0; layer < depth; layer++) {
+        for (i = 0; i < width; i++) {
+            struct node  *node = node_at(layer, i);
+            node->value = node_value(layer, i);
+            node->done = 1;
+        }
+    }
+}
+
+static flt_task  compute_node;
+static flt_task  build_graph;
+
+static void
+compute_node(struct flt *flt, void *ud, size_t index)
+{
+    struct node  *node = &nodes[index];
+    node->value = node_value(index / width, index % width);
+    node->done = 1;
+}
+
+static void
+build_graph(struct flt *flt, void *ud, size_t unused)
+{
+    unsigned long  layer;
+    unsigned long  i;
+    unsigned long  j;
+    struct flt_task_group  *barrier = NULL;
+
+    for (layer = 0; layer < depth; layer++) {
+        if (layer > 0 && layer == depth / 2) {
+            barrier = flt_task_group_new(flt);
+            for (j = 0; j < width; j++) {
+                flt_task_group_run_after
+                    (flt, node_at(layer - 1, j)->group, barrier);
+            }
+        }
+        for (i = 0; i < width; i++) {
+            struct node  *node = node_at(layer, i);
+            node->group = flt_task_group_new(flt);
+            flt_task_group_add
+                (flt, node->group,
+                 flt_task_new(flt, compute_node, NULL, layer * width + i));
+            if (layer > 0) {
+                for (j = 0; j < width; j++) {
+                    if (depends_on(layer, i, j)) {
+                        flt_task_group_run_after
+                            (flt, node_at(layer - 1, j)->group, node->group);
+                    }
+                }
+            }
+            if (barrier != NULL && layer == depth / 2) {
+                flt_task_group_run_after(flt, barrier, node->group);
+            }
+        }
+    }
+
+    /* Only the first layer has to be started explicitly. */
+    for (i = 0; i < width; i++) {
+        flt_task_group_start(flt, node_at(0, i)->group);
+    }
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    unsigned long  i;
+    for (i = 0; i < depth * width; i++) {
+        nodes[i].value = 0;
+        nodes[i].done = 0;
+    }
+    out_of_order = 0;
+    flt_fleet_run(fleet, build_graph, NULL, 0);
+}
+
+static int
+verify(void)
+{
+    unsigned long  layer;
+    unsigned long  i;
+    unsigned long  j;
+    flt_check_result(task_dag, "%lu", out_of_order, 0UL);
+    for (layer = 0; layer < depth; layer++) {
+        for (i = 0; i < width; i++) {
+            unsigned long  expected = 1;
+            if (layer > 0) {
+                for (j = 0; j < width; j++) {
+                    if (depends_on(layer, i, j)) {
+                        expected += node_at(layer - 1, j)->value;
+                    }
+                }
+            }
+            flt_check_result(task_dag, "%lu", node_at(layer, i)->value,
+                             expected);
+        }
+    }
+    return 0;
+}
+
+struct flt_example  task_dag = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
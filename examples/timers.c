@@ -0,0 +1,165 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fleet.h"
+#include "examples.h"
+
+
+/* Schedules a large number of timers, spread out over a short interval, along
+ * with a bulk task that runs at the end of the interval, and a periodic task
+ * that stops itself after a few runs.  None of them should run before their
+ * deadlines, and a group that runs after the root task shouldn't start until
+ * all of them are done. */
+
+#define BULK_COUNT  10000
+#define TICK_COUNT  5
+/* 1ms */
+#define TICK_PERIOD  1000000
+
+static unsigned long  count;
+static unsigned long  spread;
+static uint64_t  start;
+static volatile unsigned long  fired;
+static volatile unsigned long  bulk_fired;
+static volatile unsigned long  ticks;
+static volatile unsigned long  early;
+static unsigned long  seen_by_check;
+
+static void
+configure(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: timers [count] [spread (usec)]\n");
+        exit(EXIT_FAILURE);
+    }
+    count = flt_parse_ulong(argv[0]);
+    spread = flt_parse_ulong(argv[1]);
+    if (spread == 0) {
+        fprintf(stderr, "Spread must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+print_name(FILE *out)
+{
+    fprintf(out, "timers:%lu:%lu", count, spread);
+}
+
+static uint64_t
+delay_for(size_t i)
+{
+    return (uint64_t) ((i * 7919) % spread) * 1000;
+}
+
+static void
+run_native(void)
+{
+    fired = count;
+    bulk_fired = BULK_COUNT;
+    ticks = TICK_COUNT;
+    early = 0;
+    seen_by_check = count + BULK_COUNT + TICK_COUNT;
+}
+
+static flt_task  fire;
+static flt_task  fire_bulk;
+static flt_task  tick;
+static flt_task  check;
+static flt_task  start_timers;
+
+static void
+fire(struct flt *flt, void *ud, size_t i)
+{
+    if (flt_now() < start + delay_for(i)) {
+        __sync_fetch_and_add(&early, 1);
+    }
+    __sync_fetch_and_add(&fired, 1);
+}
+
+static void
+fire_bulk(struct flt *flt, void *ud, size_t i)
+{
+    if (flt_now() < start + (uint64_t) spread * 1000) {
+        __sync_fetch_and_add(&early, 1);
+    }
+    __sync_fetch_and_add(&bulk_fired, 1);
+}
+
+static void
+tick(struct flt *flt, void *ud, size_t i)
+{
+    /* Only one run of a periodic task can be in flight at a time. */
+    if (flt_now() < start + ticks * TICK_PERIOD) {
+        __sync_fetch_and_add(&early, 1);
+    }
+    if (++ticks == TICK_COUNT) {
+        flt_stop_periodic(flt);
+    }
+}
+
+static void
+check(struct flt *flt, void *ud, size_t i)
+{
+    seen_by_check = fired + bulk_fired + ticks;
+}
+
+static void
+start_timers(struct flt *flt, void *ud, size_t unused)
+{
+    struct flt_task_group  *group;
+    size_t  i;
+
+    group = flt_task_group_new(flt);
+    flt_task_group_run_after_current(flt, group);
+    flt_task_group_add(flt, group, flt_task_new(flt, check, NULL, 0));
+
+    start = flt_now();
+    for (i = 0; i < count; i++) {
+        flt_run_after_delay(flt, delay_for(i), flt_task_new(flt, fire, NULL, i));
+    }
+    flt_run_at(flt, start + (uint64_t) spread * 1000,
+               flt_bulk_task_new(flt, fire_bulk, NULL, 0, BULK_COUNT));
+    flt_run_periodic_after_delay
+        (flt, 0, TICK_PERIOD, flt_task_new(flt, tick, NULL, 0));
+}
+
+static void
+run_in_fleet(struct flt_fleet *fleet)
+{
+    fired = 0;
+    bulk_fired = 0;
+    ticks = 0;
+    early = 0;
+    seen_by_check = 0;
+    flt_fleet_run(fleet, start_timers, NULL, 0);
+}
+
+static int
+verify(void)
+{
+    flt_check_result(timers, "%lu", fired, count);
+    flt_check_result(timers, "%lu", bulk_fired, (unsigned long) BULK_COUNT);
+    flt_check_result(timers, "%lu", ticks, (unsigned long) TICK_COUNT);
+    flt_check_result(timers, "%lu", early, 0UL);
+    flt_check_result(timers, "%lu", seen_by_check,
+                     count + BULK_COUNT + TICK_COUNT);
+    return 0;
+}
+
+struct flt_example  timers = {
+    configure,
+    print_name,
+    run_native,
+    run_in_fleet,
+    verify
+};
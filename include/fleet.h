@@ -11,6 +11,8 @@
 #define FLEET_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 
 #define FLT_CACHE_LINE_SIZE  64
@@ -30,6 +32,9 @@ struct flt_task;
 typedef void
 flt_task(struct flt *flt, void *ud, size_t i);
 
+typedef void
+flt_range_task(struct flt *flt, void *ud, size_t min, size_t max);
+
 struct flt {
     unsigned int  index;
     unsigned int  count;
@@ -44,6 +49,31 @@ struct flt {
 #define flt_bulk_task_new(flt, func, ud, min, max) \
     ((flt)->new_task((flt), #func, (func), (ud), (min), (max)))
 
+struct flt_task *
+flt_range_task_new_(struct flt *flt, const char *name, flt_range_task *func,
+                    void *ud, size_t min, size_t max);
+
+#define flt_range_task_new(flt, func, ud, min, max) \
+    (flt_range_task_new_((flt), #func, (func), (ud), (min), (max)))
+
+/* A task can carry up to this many bytes of arguments inline, without having
+ * to allocate them separately. */
+#define FLT_TASK_DATA_SIZE  16
+
+/* Copies `size` bytes from `data` into the task; `ud` will point at the copy.
+ * `size` can be at most FLT_TASK_DATA_SIZE. */
+struct flt_task *
+flt_task_new_with_data_(struct flt *flt, const char *name, flt_task *func,
+                        const void *data, size_t size, size_t min, size_t max);
+
+#define flt_task_new_with_data(flt, func, data, i) \
+    (flt_task_new_with_data_((flt), #func, (func), \
+                             (data), sizeof(*(data)), (i), (i)+1))
+
+#define flt_bulk_task_new_with_data(flt, func, data, min, max) \
+    (flt_task_new_with_data_((flt), #func, (func), \
+                             (data), sizeof(*(data)), (min), (max)))
+
 
 void
 flt_run(struct flt *flt, struct flt_task *task);
@@ -53,6 +83,13 @@ flt_run_later(struct flt *flt, struct flt_task *task);
 
 #define flt_return_to(flt, task, ud, i)  ((task)((flt), (ud), (i)))
 
+/* Call these around a blocking syscall.  You can't use `flt` in between. */
+void
+flt_detach(struct flt *flt);
+
+void
+flt_reattach(struct flt *flt);
+
 
 /*-----------------------------------------------------------------------
  * Task groups
@@ -71,15 +108,165 @@ flt_task_group_add(struct flt *flt, struct flt_task_group *group,
 void
 flt_task_group_start(struct flt *flt, struct flt_task_group *group);
 
-/* Thread-safe for `group`, but not for `after` */
+/* Thread-safe.  `after` can run after any number of groups. */
 void
 flt_task_group_run_after(struct flt *flt, struct flt_task_group *group,
                          struct flt_task_group *after);
 
-/* Not thread-safe for `after` */
 void
 flt_task_group_run_after_current(struct flt *flt, struct flt_task_group *after);
 
+void
+flt_task_group_run_after_all(struct flt *flt, struct flt_task_group **groups,
+                             size_t group_count, struct flt_task_group *after);
+
+enum flt_cancel_policy {
+    FLT_CANCEL_RUN_AFTERS,
+    FLT_CANCEL_PROPAGATE
+};
+
+/* Thread-safe */
+void
+flt_task_group_cancel(struct flt *flt, struct flt_task_group *group,
+                      enum flt_cancel_policy policy);
+
+void
+flt_task_group_cancel_current(struct flt *flt, enum flt_cancel_policy policy);
+
+int
+flt_task_group_is_cancelled(struct flt *flt, struct flt_task_group *group);
+
+/* Whether the current task's group has been cancelled */
+int
+flt_is_cancelled(struct flt *flt);
+
+/* Only when running tasks in fibers.  Lets the context run other tasks until
+ * `group` finishes. */
+void
+flt_task_group_wait(struct flt *flt, struct flt_task_group *group);
+
+
+/*-----------------------------------------------------------------------
+ * Asynchronous I/O
+ */
+
+/* `task` is scheduled in the current group once the I/O finishes */
+void
+flt_read_async(struct flt *flt, int fd, void *buf, size_t len, off_t offset,
+               struct flt_task *task);
+
+void
+flt_write_async(struct flt *flt, int fd, const void *buf, size_t len,
+                off_t offset, struct flt_task *task);
+
+/* Bytes transferred, or a negative errno value */
+ssize_t
+flt_io_result(struct flt *flt);
+
+
+/*-----------------------------------------------------------------------
+ * Timers
+ */
+
+/* Nanoseconds, from a monotonic clock */
+uint64_t
+flt_now(void);
+
+/* `task` is scheduled in the current group once the timer expires */
+void
+flt_run_at(struct flt *flt, uint64_t when, struct flt_task *task);
+
+void
+flt_run_after_delay(struct flt *flt, uint64_t delay, struct flt_task *task);
+
+void
+flt_run_periodic_at(struct flt *flt, uint64_t when, uint64_t period,
+                    struct flt_task *task);
+
+void
+flt_run_periodic_after_delay(struct flt *flt, uint64_t delay, uint64_t period,
+                             struct flt_task *task);
+
+/* Call this from a periodic task to keep it from running again */
+void
+flt_stop_periodic(struct flt *flt);
+
+
+/*-----------------------------------------------------------------------
+ * Futures
+ */
+
+struct flt_future;
+
+struct flt_future *
+flt_future_new(struct flt *flt);
+
+/* Releases the caller's reference to `future` */
+void
+flt_future_free(struct flt *flt, struct flt_future *future);
+
+/* Thread-safe.  Each future can only be completed once. */
+void
+flt_future_set(struct flt *flt, struct flt_future *future, void *value);
+
+int
+flt_future_is_set(struct flt *flt, struct flt_future *future);
+
+/* Only valid once `future` has been completed */
+void *
+flt_future_get(struct flt *flt, struct flt_future *future);
+
+/* Thread-safe.  `task` is scheduled in the current group once `future` is
+ * completed. */
+void
+flt_then(struct flt *flt, struct flt_future *future, struct flt_task *task);
+
+/* The value of the future whose completion scheduled the current task */
+void *
+flt_future_value(struct flt *flt);
+
+/* Completed (with a NULL value) once all of `futures` are */
+struct flt_future *
+flt_when_all(struct flt *flt, struct flt_future **futures,
+             size_t future_count);
+
+/* Completed with the value of whichever of `futures` is completed first */
+struct flt_future *
+flt_when_any(struct flt *flt, struct flt_future **futures,
+             size_t future_count);
+
+
+/*-----------------------------------------------------------------------
+ * Channels
+ */
+
+struct flt_channel;
+
+/* The `ud` of each receiver invocation.  Only valid during the invocation. */
+struct flt_channel_data {
+    void  *ud;
+    void  *data;
+};
+
+struct flt_channel *
+flt_channel_new(struct flt *flt, flt_task *receiver, void *ud);
+
+void
+flt_channel_free(struct flt_channel *channel);
+
+/* Messages that a task sends are delivered in batches, once the task finishes */
+void
+flt_channel_send(struct flt_channel *channel, struct flt *flt, void *data);
+
+void
+flt_channel_send_later(struct flt_channel *channel, struct flt *flt,
+                       void *data);
+
+/* Calls the receiver directly */
+void
+flt_channel_return_to(struct flt_channel *channel, struct flt *flt,
+                      void *data);
+
 
 /*-----------------------------------------------------------------------
  * Fleets
@@ -97,6 +284,54 @@ void
 flt_fleet_set_context_count(struct flt_fleet *fleet,
                             unsigned int context_count);
 
+enum flt_idle_policy {
+    FLT_IDLE_SPIN,
+    FLT_IDLE_YIELD,
+    FLT_IDLE_PARK
+};
+
+void
+flt_fleet_set_idle_policy(struct flt_fleet *fleet,
+                          enum flt_idle_policy policy);
+
+enum flt_split_policy {
+    FLT_SPLIT_EAGER,
+    FLT_SPLIT_LAZY
+};
+
+void
+flt_fleet_set_split_policy(struct flt_fleet *fleet,
+                           enum flt_split_policy policy);
+
+enum flt_task_mode {
+    FLT_TASK_PLAIN,
+    FLT_TASK_FIBERS
+};
+
+void
+flt_fleet_set_task_mode(struct flt_fleet *fleet, enum flt_task_mode mode);
+
+/* Only used for FLT_TASK_FIBERS */
+void
+flt_fleet_set_fiber_stack_size(struct flt_fleet *fleet, size_t stack_size);
+
+enum flt_affinity_policy {
+    FLT_AFFINITY_NONE,
+    FLT_AFFINITY_COMPACT,
+    FLT_AFFINITY_SCATTER,
+    FLT_AFFINITY_AVOID_SMT,
+    FLT_AFFINITY_EXPLICIT
+};
+
+void
+flt_fleet_set_affinity(struct flt_fleet *fleet,
+                       enum flt_affinity_policy policy);
+
+/* Implies FLT_AFFINITY_EXPLICIT.  Copies `cpus`. */
+void
+flt_fleet_set_affinity_cpus(struct flt_fleet *fleet,
+                            const unsigned int *cpus, unsigned int cpu_count);
+
 void
 flt_fleet_run_(struct flt_fleet *fleet, const char *name,
                flt_task *func, void *ud, size_t i);
@@ -105,12 +340,58 @@ flt_fleet_run_(struct flt_fleet *fleet, const char *name,
     flt_fleet_run_(fleet, #func, func, ud, i)
 
 
+/*-----------------------------------------------------------------------
+ * Service mode
+ */
+
+struct flt_job;
+
+void
+flt_fleet_start(struct flt_fleet *fleet);
+
+/* Thread-safe.  Returns NULL if the job is rejected. */
+struct flt_job *
+flt_fleet_submit_(struct flt_fleet *fleet, const char *name,
+                  flt_task *func, void *ud, size_t i);
+
+#define flt_fleet_submit(fleet, func, ud, i) \
+    flt_fleet_submit_(fleet, #func, func, ud, i)
+
+enum flt_submit_policy {
+    FLT_SUBMIT_BLOCK,
+    FLT_SUBMIT_FAIL,
+    FLT_SUBMIT_SPILL
+};
+
+/* A `limit` of 0 means unlimited.  Must not be called while the fleet is
+ * running. */
+void
+flt_fleet_set_job_limit(struct flt_fleet *fleet, size_t limit,
+                        enum flt_submit_policy policy);
+
+/* Thread-safe */
+size_t
+flt_fleet_queue_depth(struct flt_fleet *fleet);
+
+/* Waits for all submitted jobs to finish */
+void
+flt_fleet_stop(struct flt_fleet *fleet);
+
+int
+flt_job_is_finished(struct flt_job *job);
+
+/* Frees `job` */
+void
+flt_job_wait(struct flt_job *job);
+
+
 /*-----------------------------------------------------------------------
  * Context-local data
  */
 
 struct flt_local {
-    void  *instances;
+    /* Each execution context's instance, indexed by the context's index */
+    void  **instances;
 };
 
 typedef void
@@ -131,18 +412,16 @@ void
 flt_local_free(struct flt *flt, struct flt_local *local);
 
 #define flt_local_get_index(flt, local, type, i) \
-    ((type *) \
-     ((char *) (local)->instances + \
-      (i) * flt_round_to_cache_line(sizeof(type))))
+    ((type *) (local)->instances[(i)])
 
 #define flt_local_get(flt, local, type) \
     flt_local_get_index(flt, local, type, (flt)->index)
 
 #define flt_local_foreach(flt, local, i, type, inst) \
-    for ((i) = 0, (inst) = (local)->instances; (i) < (flt)->count; \
-         (i)++, \
-         (inst) = ((type *) (((char *) (inst)) + \
-             flt_round_to_cache_line(sizeof(type)))))
+    for ((i) = 0; \
+         (i) < (flt)->count && \
+         ((inst) = (type *) (local)->instances[(i)], 1); \
+         (i)++)
 
 #define flt_local_visit(flt, local, type, visit, ...) \
     do { \
@@ -154,4 +433,39 @@ flt_local_free(struct flt *flt, struct flt_local *local);
     } while (0)
 
 
+/*-----------------------------------------------------------------------
+ * Memory pools
+ */
+
+struct flt_pool;
+
+typedef void
+flt_pool_init_f(void *ud, void *instance);
+
+typedef void
+flt_pool_reuse_f(void *ud, void *instance);
+
+typedef void
+flt_pool_done_f(void *ud, void *instance);
+
+/* Any of the callbacks can be NULL */
+struct flt_pool *
+flt_pool_new_size(struct flt *flt, size_t instance_size, void *ud,
+                  flt_pool_init_f *init, flt_pool_reuse_f *reuse,
+                  flt_pool_done_f *done);
+
+#define flt_pool_new(flt, type, ud, init, reuse, done) \
+    flt_pool_new_size((flt), sizeof(type), (ud), (init), (reuse), (done))
+
+void
+flt_pool_free(struct flt_pool *pool);
+
+void *
+flt_pool_new_instance(struct flt_pool *pool, struct flt *flt);
+
+/* `instance` can come from any context */
+void
+flt_pool_free_instance(struct flt_pool *pool, struct flt *flt, void *instance);
+
+
 #endif /* FLEET_H */
@@ -0,0 +1,280 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef FLEET_DEQUE_H
+#define FLEET_DEQUE_H
+
+#include "libcork/core.h"
+
+#include "fleet.h"
+#include "fleet/threads.h"
+#include "fleet/topology.h"
+
+
+struct flt_task;
+
+
+/*-----------------------------------------------------------------------
+ * Work-stealing deques
+ */
+
+/* A lock-free work-stealing deque, based on the dynamic circular deque from
+ * Chase and Lev [1].  Each deque has exactly one owner, which can push and pop
+ * tasks at the bottom end.  Any other execution context can steal tasks from
+ * the top end.  None of these operations need a lock; the only synchronization
+ * is a CAS on `top`, which is only needed for steals and for popping the very
+ * last task in the deque.
+ *
+ * We extend the original algorithm in one way: the owner can also push a task
+ * onto the *top* of the deque, which is how we implement flt_run_later.  That
+ * means `top` can move in both directions, which opens us up to the ABA
+ * problem: a thief could read `top`, stall while the owner pushes onto the top
+ * and another thief steals that task, and then successfully CAS a `top` that
+ * looks unchanged but now refers to a different task.  To prevent this, `top`
+ * holds a 32-bit index in its low half and a 32-bit tag in its high half.  The
+ * tag is incremented every time the owner pushes onto the top, so that every
+ * CAS from a stale thief fails.
+ *
+ * Indices are 32-bit unsigned values that are allowed to wrap around; we always
+ * compare them by looking at the sign of their difference.
+ *
+ * The task array is a power-of-two-sized ring buffer.  When it fills up, the
+ * owner allocates a new array that's twice as large.  Thieves might still be
+ * reading from the old array, so we don't free it until the deque itself is
+ * freed.  Each array is allocated on the owner's NUMA node.
+ *
+ * [1] David Chase and Yossi Lev.  "Dynamic circular work-stealing deque".
+ *     SPAA 2005.
+ */
+
+struct flt_deque_array {
+    struct flt_deque_array  *prev;
+    uint32_t  mask;
+    struct flt_task  *tasks[];
+};
+
+struct flt_deque {
+    /* `top` is written by thieves, `bottom` and `array` are only written by the
+     * owner.  Keep them on separate cache lines. */
+    uint8_t  pre_padding[FLT_CACHE_LINE_SIZE];
+    volatile uint64_t  top;
+    uint8_t  top_padding[FLT_CACHE_LINE_SIZE];
+    volatile uint32_t  bottom;
+    struct flt_deque_array * volatile  array;
+    const struct flt_topology  *topology;
+    unsigned int  node;
+    uint8_t  post_padding[FLT_CACHE_LINE_SIZE];
+};
+
+#define FLT_DEQUE_INITIAL_SIZE  1024
+
+#define flt_deque_top_index(top)  ((uint32_t) (top))
+#define flt_deque_top_tag(top)    ((uint32_t) ((top) >> 32))
+#define flt_deque_top_make(tag, index) \
+    ((((uint64_t) (tag)) << 32) | ((uint64_t) (uint32_t) (index)))
+
+#define flt_deque_top_cas(dq, oldv, newv) \
+    (__sync_val_compare_and_swap(&(dq)->top, (oldv), (newv)))
+
+/* The number of tasks in the deque.  This is only an estimate if called from
+ * any thread other than the deque's owner. */
+#define flt_deque_size_(bottom, top) \
+    ((int32_t) ((bottom) - flt_deque_top_index(top)))
+
+CORK_ATTR_UNUSED
+static inline size_t
+flt_deque_size(struct flt_deque *dq)
+{
+    uint64_t  top = dq->top;
+    int32_t  size = flt_deque_size_(dq->bottom, top);
+    return (size < 0)? 0: size;
+}
+
+#define flt_deque_is_empty(dq)  (flt_deque_size((dq)) == 0)
+
+/* The task array only holds pointers, so the tasks themselves can be scattered
+ * across the task batches of every context that they've passed through.  Since
+ * a task spans two cache lines, we prefetch both of them.  (A prefetch never
+ * faults, so it's safe even if some thief has already stolen and freed the
+ * task.) */
+#define flt_deque_prefetch_task(task) \
+    do { \
+        __builtin_prefetch((task)); \
+        __builtin_prefetch(((char *) (task)) + FLT_CACHE_LINE_SIZE); \
+    } while (0)
+
+#define flt_deque_array_size(size) \
+    (sizeof(struct flt_deque_array) + (size) * sizeof(struct flt_task *))
+
+CORK_ATTR_UNUSED
+static struct flt_deque_array *
+flt_deque_array_new(struct flt_deque *dq, uint32_t size)
+{
+    struct flt_deque_array  *array =
+        flt_node_alloc(dq->topology, dq->node, flt_deque_array_size(size));
+    array->prev = NULL;
+    array->mask = size - 1;
+    return array;
+}
+
+CORK_ATTR_UNUSED
+static void
+flt_deque_init(struct flt_deque *dq, const struct flt_topology *topology,
+               unsigned int node)
+{
+    dq->top = 0;
+    dq->bottom = 0;
+    dq->topology = topology;
+    dq->node = node;
+    dq->array = flt_deque_array_new(dq, FLT_DEQUE_INITIAL_SIZE);
+}
+
+CORK_ATTR_UNUSED
+static void
+flt_deque_done(struct flt_deque *dq)
+{
+    struct flt_deque_array  *array = dq->array;
+    while (array != NULL) {
+        struct flt_deque_array  *prev = array->prev;
+        flt_node_free(dq->topology, array,
+                      flt_deque_array_size(array->mask + 1));
+        array = prev;
+    }
+}
+
+/* Owner only.  Copies all of the live tasks in [top, bottom) into an array
+ * that's twice as large. */
+CORK_ATTR_UNUSED
+static struct flt_deque_array *
+flt_deque_grow(struct flt_deque *dq, uint32_t bottom, uint32_t top)
+{
+    struct flt_deque_array  *old_array = dq->array;
+    struct flt_deque_array  *new_array =
+        flt_deque_array_new(dq, (old_array->mask + 1) * 2);
+    uint32_t  i;
+    for (i = top; i != bottom; i++) {
+        new_array->tasks[i & new_array->mask] =
+            old_array->tasks[i & old_array->mask];
+    }
+    new_array->prev = old_array;
+    flt_write_barrier();
+    dq->array = new_array;
+    return new_array;
+}
+
+/* Owner only. */
+CORK_ATTR_UNUSED
+static inline void
+flt_deque_push_bottom(struct flt_deque *dq, struct flt_task *task)
+{
+    uint32_t  bottom = dq->bottom;
+    uint32_t  top = flt_deque_top_index(dq->top);
+    struct flt_deque_array  *array = dq->array;
+    if (CORK_UNLIKELY(bottom - top > array->mask)) {
+        array = flt_deque_grow(dq, bottom, top);
+    }
+    array->tasks[bottom & array->mask] = task;
+    flt_write_barrier();
+    dq->bottom = bottom + 1;
+}
+
+/* Owner only. */
+CORK_ATTR_UNUSED
+static inline void
+flt_deque_push_top(struct flt_deque *dq, struct flt_task *task)
+{
+    uint64_t  top;
+    uint64_t  new_top;
+    do {
+        uint32_t  bottom = dq->bottom;
+        uint32_t  index;
+        struct flt_deque_array  *array = dq->array;
+        top = dq->top;
+        index = flt_deque_top_index(top);
+        if (CORK_UNLIKELY(bottom - index > array->mask)) {
+            array = flt_deque_grow(dq, bottom, index);
+        }
+        array->tasks[(index - 1) & array->mask] = task;
+        flt_write_barrier();
+        new_top = flt_deque_top_make(flt_deque_top_tag(top) + 1, index - 1);
+    } while (CORK_UNLIKELY(flt_deque_top_cas(dq, top, new_top) != top));
+}
+
+/* Owner only.  Returns NULL if the deque is empty. */
+CORK_ATTR_UNUSED
+static inline struct flt_task *
+flt_deque_pop_bottom(struct flt_deque *dq)
+{
+    uint32_t  bottom = dq->bottom - 1;
+    struct flt_deque_array  *array = dq->array;
+    uint64_t  top;
+    int32_t  size;
+    struct flt_task  *task;
+
+    dq->bottom = bottom;
+    flt_full_barrier();
+    top = dq->top;
+    size = flt_deque_size_(bottom, top);
+
+    if (CORK_UNLIKELY(size < 0)) {
+        /* The deque was already empty. */
+        dq->bottom = bottom + 1;
+        return NULL;
+    }
+
+    task = array->tasks[bottom & array->mask];
+    if (CORK_LIKELY(size > 0)) {
+        /* There's more than one task in the deque, so no thief can be trying
+         * to steal this one.  Start pulling in the task that we'll most likely
+         * pop next, so that it's in cache once we've finished with this one. */
+        flt_deque_prefetch_task(array->tasks[(bottom - 1) & array->mask]);
+        return task;
+    }
+
+    /* This is the last task in the deque, so we have to race any thieves for
+     * it. */
+    if (flt_deque_top_cas
+        (dq, top, flt_deque_top_make
+         (flt_deque_top_tag(top), flt_deque_top_index(top) + 1)) != top) {
+        task = NULL;
+    }
+    dq->bottom = bottom + 1;
+    return task;
+}
+
+/* Any thread.  Returns NULL if the deque is empty, or if we lose a race with
+ * the owner or some other thief. */
+CORK_ATTR_UNUSED
+static inline struct flt_task *
+flt_deque_steal(struct flt_deque *dq)
+{
+    uint64_t  top = dq->top;
+    uint32_t  bottom;
+    struct flt_deque_array  *array;
+    struct flt_task  *task;
+
+    flt_full_barrier();
+    bottom = dq->bottom;
+    if (flt_deque_size_(bottom, top) <= 0) {
+        return NULL;
+    }
+
+    array = dq->array;
+    flt_read_barrier();
+    task = array->tasks[flt_deque_top_index(top) & array->mask];
+    if (flt_deque_top_cas
+        (dq, top, flt_deque_top_make
+         (flt_deque_top_tag(top), flt_deque_top_index(top) + 1)) != top) {
+        return NULL;
+    }
+    return task;
+}
+
+
+#endif /* FLEET_DEQUE_H */
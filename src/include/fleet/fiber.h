@@ -0,0 +1,96 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef FLEET_FIBER_H
+#define FLEET_FIBER_H
+
+#include "libcork/core.h"
+
+#include "fleet/topology.h"
+
+#if defined(__x86_64__) && defined(__ELF__)
+#define FLT_FIBER_ASM  1
+#else
+#define FLT_FIBER_ASM  0
+#include <ucontext.h>
+#endif
+
+
+struct flt_priv;
+
+typedef void
+flt_fiber_entry(void *ud);
+
+/*-----------------------------------------------------------------------
+ * Fibers
+ */
+
+/* A fiber is a separately allocated stack that we can switch in and out of
+ * without involving the kernel.  Each stack has a guard page below it, so that
+ * an overflow crashes instead of silently scribbling over some other fiber's
+ * stack.  The flt_fiber instance itself lives at the top of its own stack
+ * mapping.
+ *
+ * On x86-64 we switch stacks with a few instructions of assembly, which only
+ * save the callee-saved registers; elsewhere we fall back on ucontext, which
+ * is much slower, since it saves and restores the signal mask, too.
+ *
+ * A "native" fiber represents a thread's original stack.  You can switch out of
+ * one and back into it, but it doesn't have a stack of its own to free. */
+
+struct flt_fiber {
+    /* The next fiber in whichever list this fiber is currently in: a context's
+     * pool, the waiters of a task group, or a context's resumed fibers */
+    struct flt_fiber  *next;
+    /* The next fiber that was allocated by the same context */
+    struct flt_fiber  *sibling;
+    /* The context whose pool this fiber belongs to.  A fiber only ever runs in
+     * its own context. */
+    struct flt_priv  *flt;
+#if FLT_FIBER_ASM
+    void  *sp;
+#else
+    ucontext_t  context;
+    flt_fiber_entry  *entry;
+    void  *ud;
+#endif
+    /* The whole mapping, including the guard page */
+    void  *mapping;
+    size_t  mapping_size;
+};
+
+/* `stack_size` is rounded up to a whole number of pages.  The stack's pages
+ * prefer NUMA node `node`. */
+CORK_LOCAL
+struct flt_fiber *
+flt_fiber_new(const struct flt_topology *topology, unsigned int node,
+              size_t stack_size);
+
+CORK_LOCAL
+void
+flt_fiber_free(struct flt_fiber *fiber);
+
+CORK_LOCAL
+void
+flt_fiber_init_native(struct flt_fiber *fiber);
+
+/* The next time that someone switches into `fiber`, it will start executing
+ * `entry` from the top of its stack.  `entry` must never return. */
+CORK_LOCAL
+void
+flt_fiber_prepare(struct flt_fiber *fiber, flt_fiber_entry *entry, void *ud);
+
+/* Saves the current state into `from`, and then switches to `to`.  Returns once
+ * someone switches back into `from`. */
+CORK_LOCAL
+void
+flt_fiber_switch(struct flt_fiber *from, struct flt_fiber *to);
+
+
+#endif /* FLEET_FIBER_H */
@@ -0,0 +1,82 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef FLEET_IO_H
+#define FLEET_IO_H
+
+#include <sys/types.h>
+
+#include "libcork/core.h"
+
+#include "fleet.h"
+
+
+struct flt_fleet;
+struct flt_priv;
+
+
+/*-----------------------------------------------------------------------
+ * Asynchronous I/O
+ */
+
+/* Each fleet has at most one I/O backend, which is shared by all of its
+ * execution contexts.  On Linux, we use an io_uring, and a single completion
+ * thread that waits for operations to finish.  Everywhere else (or if the
+ * kernel doesn't support io_uring), the completion thread performs each
+ * operation itself, using a blocking pread or pwrite.  Either way, there's only
+ * one extra thread, no matter how many operations are in flight.
+ *
+ * While an operation is in flight, its continuation task is counted in its
+ * group's `task_count` for the context that submitted it, and that context's
+ * leaf of the fleet's active indicator holds an arrival on its behalf.  That
+ * keeps the group, and the fleet's run, from finishing until the operation
+ * completes and the continuation has been scheduled. */
+
+enum flt_io_op {
+    FLT_IO_READ,
+    FLT_IO_WRITE
+};
+
+struct flt_io_request {
+    /* The next request in the fleet's `io_completed` stack */
+    struct flt_io_request  *next;
+    struct flt_task  *task;
+    /* The context that submitted this request */
+    struct flt_priv  *flt;
+    enum flt_io_op  op;
+    int  fd;
+    void  *buf;
+    size_t  len;
+    off_t  offset;
+    ssize_t  result;
+};
+
+struct flt_io;
+
+CORK_LOCAL
+struct flt_io *
+flt_io_new(struct flt_fleet *fleet);
+
+/* There must not be any requests in flight. */
+CORK_LOCAL
+void
+flt_io_free(struct flt_io *io);
+
+/* Thread-safe */
+CORK_LOCAL
+void
+flt_io_submit(struct flt_io *io, struct flt_io_request *req);
+
+/* Called by the I/O backend when an operation finishes.  Thread-safe. */
+CORK_LOCAL
+void
+flt_fleet_io_complete(struct flt_fleet *fleet, struct flt_io_request *req);
+
+
+#endif /* FLEET_IO_H */
@@ -0,0 +1,141 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef FLEET_SNZI_H
+#define FLEET_SNZI_H
+
+#include "libcork/core.h"
+
+#include "fleet.h"
+
+
+/*-----------------------------------------------------------------------
+ * Scalable non-zero indicators
+ */
+
+/* A hierarchical counter that can only tell you whether it's zero, based on the
+ * SNZI ("scalable non-zero indicator") of Ellen et al. [1].  Each execution
+ * context arrives at and departs from a leaf node that it shares with a small
+ * number of nearby contexts.  A leaf only arrives at (or departs from) its
+ * parent when its own count moves between zero and non-zero, so most updates
+ * only touch a cache line that's shared within a socket, and the root only
+ * changes when an entire leaf goes idle or becomes busy.
+ *
+ * Naively combining counters like this is not enough, since a context could
+ * bump its leaf from 0 to 1 and then stall before telling the root; any other
+ * context that arrives at that leaf in the meantime would see a non-zero leaf,
+ * and continue on its way even though the root might still be zero.  To prevent
+ * this, a leaf moves from 0 to a special "1/2" state first.  Anyone who sees a
+ * 1/2 leaf helps by arriving at the parent themselves, and then tries to move
+ * the leaf to 1.  Only one of them will succeed; the rest undo their extra
+ * arrival at the parent.  A leaf is never >= 1 unless its parent has been told.
+ *
+ * The leaf's count lives in the low half of `state`, and a version number,
+ * which is incremented every time the leaf moves from 0 to 1/2, lives in the
+ * high half.  The root (which has no parent) is a plain counter.
+ *
+ * [1] Faith Ellen, Yossi Lev, Victor Luchangco, and Mark Moir.  "SNZI:
+ *     Scalable nonzero indicators".  PODC 2007.
+ */
+
+struct flt_snzi_node {
+    uint8_t  pre_padding[FLT_CACHE_LINE_SIZE];
+    volatile uint64_t  state;
+    struct flt_snzi_node  *parent;
+    uint8_t  post_padding[FLT_CACHE_LINE_SIZE];
+};
+
+#define FLT_SNZI_HALF  ((uint32_t) -1)
+
+#define flt_snzi_count(state)    ((uint32_t) (state))
+#define flt_snzi_version(state)  ((uint32_t) ((state) >> 32))
+#define flt_snzi_make(version, count) \
+    ((((uint64_t) (version)) << 32) | ((uint64_t) (uint32_t) (count)))
+
+#define flt_snzi_cas(node, oldv, newv) \
+    (__sync_bool_compare_and_swap(&(node)->state, (oldv), (newv)))
+
+/* Not thread-safe */
+CORK_ATTR_UNUSED
+static void
+flt_snzi_init(struct flt_snzi_node *node, struct flt_snzi_node *parent)
+{
+    node->state = 0;
+    node->parent = parent;
+}
+
+#define flt_snzi_is_zero(root)  (flt_snzi_count((root)->state) == 0)
+
+/* Returns true if this departure brought the entire tree to zero. */
+CORK_ATTR_UNUSED
+static bool
+flt_snzi_depart(struct flt_snzi_node *node)
+{
+    if (node->parent == NULL) {
+        return flt_snzi_count(__sync_sub_and_fetch(&node->state, 1)) == 0;
+    }
+
+    while (true) {
+        uint64_t  state = node->state;
+        if (flt_snzi_cas(node, state, state - 1)) {
+            if (flt_snzi_count(state) == 1) {
+                return flt_snzi_depart(node->parent);
+            }
+            return false;
+        }
+    }
+}
+
+CORK_ATTR_UNUSED
+static void
+flt_snzi_arrive(struct flt_snzi_node *node)
+{
+    unsigned int  undo_count = 0;
+
+    if (node->parent == NULL) {
+        (void) __sync_add_and_fetch(&node->state, 1);
+        return;
+    }
+
+    while (true) {
+        uint64_t  state = node->state;
+        uint32_t  count = flt_snzi_count(state);
+        if (count == 0) {
+            uint64_t  half =
+                flt_snzi_make(flt_snzi_version(state) + 1, FLT_SNZI_HALF);
+            if (!flt_snzi_cas(node, state, half)) {
+                continue;
+            }
+            state = half;
+        } else if (count != FLT_SNZI_HALF) {
+            if (flt_snzi_cas(node, state, state + 1)) {
+                break;
+            }
+            continue;
+        }
+
+        /* The leaf is at 1/2, so whoever moved it there might not have told the
+         * parent yet.  Do it ourselves. */
+        flt_snzi_arrive(node->parent);
+        if (flt_snzi_cas
+            (node, state, flt_snzi_make(flt_snzi_version(state), 1))) {
+            break;
+        }
+        undo_count++;
+    }
+
+    /* Our own arrival is now reflected in the parent, so none of these extra
+     * departures can bring it to zero. */
+    while (undo_count-- > 0) {
+        (void) flt_snzi_depart(node->parent);
+    }
+}
+
+
+#endif /* FLEET_SNZI_H */
@@ -10,12 +10,20 @@
 #ifndef FLEET_TASK_H
 #define FLEET_TASK_H
 
+#include <pthread.h>
+
 #include "libcork/core.h"
 #include "libcork/ds.h"
 #include "libcork/threads.h"
 
+#include "fleet/deque.h"
+#include "fleet/fiber.h"
+#include "fleet/io.h"
+#include "fleet/snzi.h"
 #include "fleet/threads.h"
+#include "fleet/timer.h"
 #include "fleet/timing.h"
+#include "fleet/topology.h"
 
 
 struct flt_priv;
@@ -31,59 +39,294 @@ struct flt_priv;
  *
  * If task is detached, then it will not be in any linked list.  If it's
  * pending, it will be in in `tasks` list of one of the instances in
- * `group->ctxs`.  If it's ready, it will be in the `ready` list of one of the
- * fleet's execution contexts. */
+ * `group->ctxs`.  If it's ready, it will be in the `ready` deque of one of the
+ * fleet's execution contexts, or it will be the `current` task of one of
+ * them. */
 
 struct flt_task {
     struct cork_dllist_item  item;
     const char  *name;
     struct flt_task_group  *group;
     flt_task  *func;
+    /* Only used for range tasks, in which case `func` is NULL */
+    flt_range_task  *range_func;
     void  *ud;
     size_t  min;
     size_t  max;
+    /* The result that a continuation was resumed with.  `io_result` is only
+     * used for continuations of asynchronous I/O operations, and `value` only
+     * for continuations of futures (it's the value that the future was
+     * completed with), so they can share storage. */
+    union {
+        ssize_t  io_result;
+        void  *value;
+    };
+    /* Only used for tasks that were scheduled via a timer.  A non-zero
+     * `period` means that the task is periodic. */
+    uint64_t  period;
+    /* `deadline` is only used for tasks that were scheduled via a timer.
+     * Until a future is completed, each of its continuations is linked into
+     * the future's `waiting` stack via `item.next`, and `waiting_in` is the
+     * context whose share of the task's group is counting it.  A task can't
+     * be doing both at once. */
+    union {
+        uint64_t  deadline;
+        struct flt_priv  *waiting_in;
+    };
+    /* The batch that this task was allocated from */
+    struct flt_task_batch  *batch;
+    /* Small arguments that were copied into the task by
+     * flt_task_new_with_data; `ud` points here when they're used.  This fills
+     * out the rest of the task's second cache line. */
+    void  *data[FLT_TASK_DATA_SIZE / sizeof(void *)];
 };
 
+/* Tasks are allocated in batches, whose first task-sized slot holds this
+ * header instead.  `in_use` counts the tasks in the batch that aren't in the
+ * owner's `unused` list, and is only touched by the owner. */
+struct flt_task_batch {
+    struct cork_dllist_item  item;
+    struct flt_priv  *owner;
+    size_t  in_use;
+};
+
+/* 8Kb batches */
+#define TASK_BATCH_SIZE  8192
+#define TASK_BATCH_COUNT  (TASK_BATCH_SIZE / sizeof(struct flt_task))
+
+/* Once a context has freed this many tasks that some other context allocated,
+ * it hands them back to their owners. */
+#define TASK_RETURN_COUNT  TASK_BATCH_COUNT
+
+/* Once a context has more than this many unused tasks, it frees any batch
+ * whose tasks are all unused. */
+#define TASK_HIGH_WATER  (4 * TASK_BATCH_COUNT)
+
 #define flt_task_run(f, t, i)  ((t)->func((f), (t)->ud, (i)))
 
+/* Runs iterations [min, max) of a bulk or range task. */
+CORK_ATTR_UNUSED
+static inline void
+flt_task_run_range(struct flt *flt, struct flt_task *task,
+                   size_t min, size_t max)
+{
+    size_t  i;
+    if (task->range_func != NULL) {
+        task->range_func(flt, task->ud, min, max);
+    } else {
+        for (i = min; i < max; i++) {
+            flt_task_run(flt, task, i);
+        }
+    }
+}
+
 
 /*-----------------------------------------------------------------------
  * Task groups
  */
 
 /* Each task group maintains some per-context state so that we can do certain
- * operations without needing any thread synchronization.
+ * operations without needing any thread synchronization.  Most groups are only
+ * ever touched by a handful of contexts, so a context's share of a group is
+ * only allocated (from that context's `group_ctxs` slab) the first time that
+ * the context needs it; see flt_task_group_get_ctx.  Only a context itself
+ * ever fills in its slot in the group's `ctxs` array.  Any other context that
+ * looks at that slot (a thief updating its victim's `task_count`, say) only
+ * does so because of a task that the owner counted, so the slot is already
+ * filled in.
  *
- * An execution context is "active" for a particular task group if the group has
- * been started, and there are any ready tasks in the group that are currently
- * assigned to that context (ie, the tasks are in the `ready` queue of that
- * context). */
+ * An execution context is "active" for a particular task group if there are any
+ * pending or ready tasks in the group that are currently assigned to that
+ * context.  Once the group is started, a ready task is assigned to the context
+ * whose `ready` deque it's in, or which is currently executing it.
+ *
+ * Since thieves can take tasks out of a context's deque without that context
+ * knowing about it, a thief has to update the `task_count` of the context it
+ * steals from, which means that `task_count` must be updated atomically.  To
+ * make sure that a group's `active_ctx_count` can never drop to zero while a
+ * task is in flight, we always increment the count for a task's new context
+ * before decrementing the count for its old one. */
+
+/* Task groups form a dependency graph.  Each group has a join counter, which
+ * counts the groups that it's still waiting for.  Each edge in the graph lives
+ * in one of its predecessor's per-context `after` lists, so a group can have
+ * any number of successors and predecessors, and adding an edge only touches
+ * the current context's share of the predecessor.  When a group finishes, it
+ * decrements the counter of each of its successors; whichever context brings a
+ * counter to zero starts that successor, which puts all of its tasks into that
+ * context's deque, right next to the data that the predecessor just produced. */
+
+struct flt_task_group_edge {
+    struct flt_task_group_edge  *next;
+    struct flt_task_group  *after;
+};
 
 struct flt_task_group_ctx {
     /* The group that this per-context object belongs to */
     struct flt_task_group  *group;
-    /* A linked list of groups that will be started after this group finishes */
-    struct flt_task_group  *after;
+    /* A linked list of groups that are waiting for this group to finish */
+    struct flt_task_group_edge  *after;
     /* A list of pending tasks that belong to this group.  (This will be empty
      * once the group is started.) */
     struct cork_dllist  tasks;
     /* The number of pending or ready tasks in this group assigned to this
      * execution context. */
-    size_t  task_count;
-    /* The number of individual executions (including bulk tasks) in this group
-     * assigned to this execution context. */
-    size_t  execution_count;
+    volatile size_t  task_count;
 };
 
+/* A group is finished once it has been started, all of its tasks have run, and
+ * we've started any groups that were waiting for it.  Nothing refers to a
+ * finished group anymore, so it can be freed. */
 #define FLT_TASK_GROUP_STOPPED  0
 #define FLT_TASK_GROUP_STARTED  1
+#define FLT_TASK_GROUP_FINISHED  2
+
+/* A cancelled group's tasks are discarded (and counted as finished) instead of
+ * run, whenever a context pops one off of its deque.  A context that's in the
+ * middle of a bulk task checks in between rounds, and gives up on the rest of
+ * the task's range.  So cancelling a group is cheap, but it can take a moment
+ * for the group to actually finish.  `cancel_policy` is only valid once
+ * `cancelled` is set. */
+
+/* A task running in a fiber can wait for a group to finish; see
+ * flt_task_group_wait.  The waiting fibers form a stack, and once the group
+ * finishes, it swaps in FLT_TASK_GROUP_NO_WAITERS, so a fiber that loses the race
+ * to push itself onto the stack knows that it doesn't have to wait. */
+
+#define FLT_TASK_GROUP_NO_WAITERS  ((struct flt_fiber *) 1)
+
+/* Finished groups are recycled via their context's `unused_groups` list, since
+ * applications often create a group for every request that they handle. */
 
 struct flt_task_group {
     struct cork_dllist_item  item;
-    struct flt_local  *ctxs;
-    struct flt_counter  active_ctx_count;
-    struct flt_task_group  *next_after;
-    unsigned int  state;
+    volatile unsigned int  active_ctx_count;
+    /* The number of groups that have to finish before this one starts */
+    volatile unsigned int  join_count;
+    struct flt_fiber * volatile  waiters;
+    /* The job that this group belongs to, if it was created while running a
+     * task that was submitted via flt_fleet_submit. */
+    struct flt_job  *job;
+    volatile unsigned int  state;
+    volatile bool  cancelled;
+    enum flt_cancel_policy  cancel_policy;
+    /* Each context's share of the group, or NULL if the context hasn't needed
+     * one yet */
+    struct flt_task_group_ctx * volatile  ctxs[];
+};
+
+CORK_LOCAL
+struct flt_task_group_ctx *
+flt_task_group_ctx_new(struct flt_priv *flt, struct flt_task_group *group);
+
+#define flt_task_group_get_ctx(flt, group) \
+    (CORK_LIKELY((group)->ctxs[(flt)->public.index] != NULL)? \
+     (group)->ctxs[(flt)->public.index]: \
+     flt_task_group_ctx_new((flt), (group)))
+
+
+/*-----------------------------------------------------------------------
+ * Futures
+ */
+
+/* A future starts off with an empty stack of waiting continuations.  Completing
+ * it swaps in FLT_FUTURE_SET, so a continuation that loses the race to push
+ * itself onto the stack knows that it can run right away.  A future is freed
+ * once its reference count drops to zero; the task that created it holds one
+ * reference, and each pending step of a combinator holds another. */
+
+#define FLT_FUTURE_SET  ((struct cork_dllist_item *) 1)
+
+struct flt_future {
+    struct cork_dllist_item * volatile  waiting;
+    void  *value;
+    /* Only used by flt_when_all and flt_when_any: the number of inputs that
+     * still have to complete before this future does. */
+    volatile size_t  pending;
+    volatile unsigned int  ref_count;
+};
+
+
+/*-----------------------------------------------------------------------
+ * Channels
+ */
+
+/* Messages that a context sends into a channel are collected into a batch in
+ * the channel's slot for that context, and the whole batch is delivered by a
+ * single range task.  We schedule a context's batches once it finishes the
+ * task that's sending the messages (or as soon as a batch fills up), so every
+ * batch belongs to the sender's group.  A batch is freed once each of its
+ * messages has been delivered; `remaining` counts the ones that haven't been
+ * yet, since the delivery task might be split across several contexts. */
+
+#define FLT_CHANNEL_BATCH_SIZE  1024
+
+struct flt_channel_batch {
+    struct flt_channel  *channel;
+    volatile size_t  remaining;
+    size_t  count;
+    /* Whether to deliver the batch via flt_run_later */
+    bool  later;
+    void  *data[];
+};
+
+#define FLT_CHANNEL_BATCH_CAPACITY \
+    ((FLT_CHANNEL_BATCH_SIZE - sizeof(struct flt_channel_batch)) / \
+     sizeof(void *))
+
+/* Only touched by the context that owns it.  There are separate batches for
+ * messages sent via flt_channel_send and flt_channel_send_later, indexed by
+ * the batch's `later` field.  A slot is in its context's `pending_channels`
+ * list if it might have a batch that we haven't scheduled yet. */
+struct flt_channel_slot {
+    struct flt_channel  *channel;
+    struct flt_channel_batch  *batches[2];
+    struct flt_channel_slot  *next;
+    bool  pending;
+};
+
+struct flt_channel {
+    flt_task  *receiver;
+    void  *ud;
+    struct flt_local  *slots;
+    /* The context that created the channel, which we need to free `slots` */
+    struct flt  *flt;
+};
+
+
+/*-----------------------------------------------------------------------
+ * Jobs
+ */
+
+/* A job is a root task that was submitted to a running fleet from some other
+ * thread.  Until a context picks it up, it lives in the fleet's `injected`
+ * stack.  After that, every group that's created by one of the job's tasks
+ * belongs to the job, and `group_count` counts how many of those have been
+ * started but haven't finished yet.  A group that starts another group (either
+ * directly, or because the new group runs after it) always does so before it
+ * finishes, so this count only drops to zero once everything in the job is
+ * done.
+ *
+ * That also means that once a job has finished, none of its tasks can still be
+ * running (or waiting to run), so nothing can refer to any of its groups
+ * anymore.  Each job keeps a stack of all of its groups, linked via their
+ * `item.next` fields.  When the job finishes, we move that stack over to the
+ * fleet's `retired_groups` stack, and the next context that reaps jobs (or
+ * runs out of groups to reuse) recycles them. */
+
+struct flt_job {
+    /* The next job in the fleet's `injected` stack, or in its spill list */
+    struct flt_job  *next;
+    struct flt_fleet  *fleet;
+    const char  *name;
+    flt_task  *func;
+    void  *ud;
+    size_t  i;
+    volatile unsigned int  group_count;
+    struct cork_dllist_item * volatile  groups;
+    pthread_mutex_t  lock;
+    pthread_cond_t  cond;
+    bool  finished;
 };
 
 
@@ -91,20 +334,109 @@ struct flt_task_group {
  * Execution contexts
  */
 
+/* A free list of small fixed-size objects, which are allocated in batches on
+ * the owning context's NUMA node.  A free object's first word links it into
+ * `unused`; the first object in each batch links the batch into `batches`. */
+
+struct flt_slab {
+    void  *unused;
+    void  *batches;
+};
+
+/* An execution context is "active" if it has any tasks in its `ready` deque, or
+ * if it's currently executing a task.  The fleet is finished once there are no
+ * active contexts.  A thief marks itself as active *before* trying to steal,
+ * since the context it steals from might notice that its deque is empty (and
+ * mark itself inactive) as soon as the steal succeeds.
+ *
+ * Contexts keep track of this by arriving at (and departing from) the fleet's
+ * `active` non-zero indicator, via the leaf that they share with the other
+ * contexts on their last-level cache. */
+
 struct flt_priv {
-    struct flt_spinlock  lock;
+    struct flt_deque  ready;
     struct flt  public;
     struct flt_fleet  *fleet;
-    struct cork_dllist  ready;
+    struct flt_task  *current;
     struct cork_dllist  unused;
+    size_t  unused_count;
     struct cork_dllist  batches;
+    /* Tasks that we've freed that some other context allocated, linked via
+     * their `item.next` fields, and tasks of ours that other contexts have
+     * handed back to us; see flt_task_free. */
+    struct cork_dllist_item  *foreign;
+    size_t  foreign_count;
+    struct cork_dllist_item * volatile  returned_tasks;
+    /* The groups that we've created that don't belong to a job; we recycle
+     * these at the end of each run. */
     struct cork_dllist  groups;
-    size_t  execution_count;
+    /* Finished groups that we can reuse, linked via their `item.next` fields */
+    struct cork_dllist_item  *unused_groups;
+    unsigned int  unused_group_count;
+    /* Per-context shares of task groups, task group edges, futures, and
+     * channel batches are allocated in batches, too */
+    struct flt_slab  group_ctxs;
+    struct flt_slab  edges;
+    struct flt_slab  futures;
+    struct flt_slab  channel_batches;
+    /* Channel slots whose batches we have to schedule once the current task
+     * finishes */
+    struct flt_channel_slot  *pending_channels;
     struct cork_thread  *thread;
     struct cork_thread_body  body;
-    unsigned int  next_to_steal_from;
-    struct flt_priv * volatile  waiting_to_steal;
     bool  active;
+    struct flt_snzi_node  *active_leaf;
+    /* The last value that we wrote into the fleet's load board */
+    uint8_t  published_load;
+
+    /* If the fleet runs tasks in fibers, `fiber` is the one that's running
+     * right now, and `native` is the original stack of the thread that's
+     * holding the context, which we switch back to once the thread has to give
+     * the context up.  `spare` is whether that thread is a spare (see
+     * flt_detach).  Unused fibers wait in `unused_fibers`, and `fibers` links
+     * together every fiber that we've allocated.  When a group finishes, other
+     * contexts hand any of our fibers that were waiting for it back to us via
+     * the `resumed` stack, holding an arrival at our active leaf for each one;
+     * we move them into `ready_fibers` before switching to them.
+     * `waiting_fibers` counts the fibers that are waiting for a group and
+     * haven't been handed back yet. */
+    struct flt_fiber  *fiber;
+    struct flt_fiber  *native;
+    bool  spare;
+    struct flt_fiber  *unused_fibers;
+    struct flt_fiber  *fibers;
+    struct flt_fiber * volatile  resumed;
+    struct flt_fiber  *ready_fibers;
+    size_t  waiting_fibers;
+
+    /* Tasks that this context has scheduled to run at some later time; see
+     * flt_run_at.  While there are any, we hold an extra arrival at our leaf
+     * of the fleet's active indicator on their behalf. */
+    struct flt_timer_wheel  timers;
+    unsigned int  timer_countdown;
+
+    /* Only one thread at a time can execute tasks in this context.  That's
+     * normally the context's own worker thread, but see flt_detach.  Threads
+     * that want to reattach to the context take a ticket, and wait (on the
+     * fleet's `detach_cond`) until the current holder reaches a point where it
+     * can hand the context over.  `reattach_waiting` lets the holder check
+     * for this without taking the fleet's lock.  All of these fields, along
+     * with the `detached` list, are protected by the fleet's `lock`. */
+    bool  held;
+    unsigned int  next_ticket;
+    unsigned int  now_serving;
+    volatile unsigned int  reattach_waiting;
+    struct cork_dllist  detached;
+
+    /* The CPU that we expect this context to run on */
+    const struct flt_cpu  *cpu;
+    /* The other contexts in the fleet, in the order that we should try to
+     * steal from them.  The contexts in [victim_tier_end[t-1],
+     * victim_tier_end[t]) are all in tier `t` relative to this context's CPU;
+     * within a tier, we start at a random position, to spread out thieves. */
+    unsigned int  *victims;
+    unsigned int  victim_tier_end[FLT_TIER_COUNT];
+    uint32_t  rng;
 
 #if FLT_MEASURE_TIMING
     struct flt_stopwatch  stopwatch;
@@ -112,16 +444,15 @@ struct flt_priv {
         uint64_t  choosing_to_steal;
         uint64_t  executing;
         uint64_t  stealing;
-        uint64_t  waiting_to_execute;
-        uint64_t  waiting_to_steal;
-        uint64_t  waiting_to_be_stolen_from;
+        uint64_t  parked;
     } timing;
 #endif
 };
 
 CORK_LOCAL
 struct flt_priv *
-flt_new(struct flt_fleet *fleet, size_t index, size_t count);
+flt_new(struct flt_fleet *fleet, size_t index, size_t count,
+        const struct flt_cpu *cpu);
 
 CORK_LOCAL
 void
@@ -143,8 +474,81 @@ flt_current_group(struct flt_priv *flt);
 struct flt_fleet {
     struct flt_priv  **contexts;
     unsigned int  count;
-    struct flt_counter  active_count;
+    struct flt_topology  topology;
+    struct flt_snzi_node  active;
+    struct flt_snzi_node  **active_leaves;
+    unsigned int  active_leaf_count;
+    /* An approximate load for each context; see flt_publish_load */
+    volatile uint8_t  *load_board;
     struct cork_buffer  buf;
+
+    /* How to place contexts onto CPUs.  `cpu_ids` is only used for
+     * FLT_AFFINITY_EXPLICIT. */
+    enum flt_affinity_policy  affinity_policy;
+    unsigned int  *cpu_ids;
+    unsigned int  cpu_id_count;
+
+    /* How bulk tasks are split into stealable pieces */
+    enum flt_split_policy  split_policy;
+
+    /* Whether tasks run in fibers, and how big each fiber's stack is */
+    enum flt_task_mode  task_mode;
+    size_t  fiber_stack_size;
+
+    /* Used to park idle contexts in the middle of a run.  A context that wants
+     * to sleep increments `sleeper_count`, and then waits on the `wake_seq`
+     * futex.  Wakers bump `wake_seq` before calling futex_wake, so that a
+     * context that's about to sleep will notice that it's been woken. */
+    enum flt_idle_policy  idle_policy;
+    struct flt_counter  sleeper_count;
+    struct flt_padded_uint  wake_seq;
+
+    /* Used to park the worker threads in between runs */
+    pthread_mutex_t  lock;
+    pthread_cond_t  run_cond;
+    pthread_cond_t  done_cond;
+    unsigned int  generation;
+    unsigned int  running_count;
+    bool  stopping;
+
+    /* Asynchronous I/O operations.  `io` is created the first time that a task
+     * submits an I/O operation.  Its completion thread pushes finished
+     * operations onto `io_completed`, and idle contexts pick them up from
+     * there; see flt_reap_io. */
+    struct flt_io * volatile  io;
+    struct flt_io_request * volatile  io_completed;
+
+    /* Service mode; see flt_fleet_start.  Context 0 runs in `service_thread`,
+     * and jobs submitted from other threads wait in `injected` until an idle
+     * context picks them up. */
+    bool  serving;
+    struct cork_thread  *service_thread;
+    struct cork_thread_body  service_body;
+    struct flt_job * volatile  injected;
+    /* The groups of jobs that have finished, linked via their `item.next`
+     * fields; see flt_job */
+    struct cork_dllist_item * volatile  retired_groups;
+
+    /* Admission control for submitted jobs.  If `job_limit` is non-zero, at
+     * most that many jobs can be admitted (in `injected`, or running) at a
+     * time, and `job_lock` protects `job_count` and the spill list.  Otherwise,
+     * `job_count` is only updated atomically, and isn't checked.
+     * `queue_depth` counts jobs that have been submitted but not started yet,
+     * including spilled ones.  The limit and policy can't change while the
+     * fleet is serving. */
+    size_t  job_limit;
+    enum flt_submit_policy  submit_policy;
+    pthread_mutex_t  job_lock;
+    pthread_cond_t  job_cond;
+    volatile size_t  job_count;
+    volatile size_t  queue_depth;
+    struct flt_job  *spill_head;
+    struct flt_job  *spill_tail;
+
+    /* Spare threads that take over a context while its thread is detached */
+    pthread_cond_t  detach_cond;
+    pthread_cond_t  spare_cond;
+    struct cork_dllist  spares;
 };
 
 
@@ -68,6 +68,10 @@
  * have to use a full memory barrier anyway.  We use the GCC intrinsics if we
  * can; otherwise, we fall back on assembly.
  *
+ * flt_full_barrier also orders earlier stores against later loads, which
+ * neither of the other two barriers do.  On x86_64, a locked instruction on the
+ * top of the stack does that at a fraction of the cost of mfence.
+ *
  * [1] http://gcc.gnu.org/bugzilla/show_bug.cgi?id=36793
  */
 
@@ -87,6 +91,13 @@ flt_write_barrier(void)
     __asm__ __volatile__ ("sfence" ::: "memory");
 }
 
+CORK_ATTR_UNUSED
+static inline void
+flt_full_barrier(void)
+{
+    __asm__ __volatile__ ("lock; orl $0, (%%rsp)" ::: "memory", "cc");
+}
+
 #elif (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__) > 40300
 
 CORK_ATTR_UNUSED
@@ -103,6 +114,13 @@ flt_write_barrier(void)
     __sync_synchronize();
 }
 
+CORK_ATTR_UNUSED
+static inline void
+flt_full_barrier(void)
+{
+    __sync_synchronize();
+}
+
 #elif defined(__GNUC__) && defined(__i386__)
 
 CORK_ATTR_UNUSED
@@ -121,11 +139,71 @@ flt_write_barrier(void)
     __asm__ __volatile__ ("lock orl $0, %0" : "+m" (a));
 }
 
+CORK_ATTR_UNUSED
+static inline void
+flt_full_barrier(void)
+{
+    int  a = 0;
+    __asm__ __volatile__ ("lock orl $0, %0" : "+m" (a));
+}
+
 #else
 #error "No memory barrier implementation!"
 #endif
 
 
+/*-----------------------------------------------------------------------
+ * Futexes
+ */
+
+/* flt_futex_wait blocks the current thread as long as `*addr == val`.
+ * flt_futex_wait_timeout gives up after `ns` nanoseconds.
+ * flt_futex_wake wakes up at most `count` threads that are blocked on `addr`.
+ * Spurious wakeups are allowed, so callers must always recheck whatever
+ * condition they were waiting for.  On platforms without futexes, waiting
+ * degrades into a short sleep, and waking does nothing. */
+
+#if defined(__linux__)
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#define FLT_FUTEX_WAKE_ALL  INT_MAX
+
+#define flt_futex_wait(addr, val) \
+    ((void) syscall(SYS_futex, (addr), FUTEX_WAIT_PRIVATE, (val), \
+                    NULL, NULL, 0))
+
+#define flt_futex_wait_timeout(addr, val, ns) \
+    do { \
+        struct timespec  __timeout; \
+        __timeout.tv_sec = (ns) / 1000000000; \
+        __timeout.tv_nsec = (ns) % 1000000000; \
+        (void) syscall(SYS_futex, (addr), FUTEX_WAIT_PRIVATE, (val), \
+                       &__timeout, NULL, 0); \
+    } while (0)
+
+#define flt_futex_wake(addr, count) \
+    ((void) syscall(SYS_futex, (addr), FUTEX_WAKE_PRIVATE, (count), \
+                    NULL, NULL, 0))
+
+#else
+#define FLT_FUTEX_WAKE_ALL  0
+
+#define flt_futex_wait(addr, val) \
+    ((void) (addr), (void) (val), usleep(1000))
+
+#define flt_futex_wait_timeout(addr, val, ns) \
+    ((void) (addr), (void) (val), \
+     usleep(((ns) < 1000000)? (ns) / 1000: 1000))
+
+#define flt_futex_wake(addr, count) \
+    ((void) (addr), (void) (count))
+
+#endif
+
+
 /*-----------------------------------------------------------------------
  * Cache-line-padded integers
  */
@@ -0,0 +1,94 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef FLEET_TIMER_H
+#define FLEET_TIMER_H
+
+#include "libcork/core.h"
+#include "libcork/ds.h"
+
+#include "fleet.h"
+
+
+struct flt_task;
+
+
+/*-----------------------------------------------------------------------
+ * Timer wheels
+ */
+
+/* A hierarchical timing wheel, as described by Varghese and Lauck [1].  Time is
+ * divided into ticks of FLT_TIMER_TICK nanoseconds.  Level 0 has one slot for
+ * each of the next FLT_TIMER_SLOT_COUNT ticks; each slot in level `l` covers
+ * FLT_TIMER_SLOT_COUNT times as many ticks as a slot in level `l-1`.  A timer
+ * goes into the lowest level whose range covers its deadline, in the slot that
+ * contains its deadline.  When the wheel reaches the start of a higher-level
+ * slot, it "cascades" that slot's timers down into the lower levels.  Adding a
+ * timer is O(1), and each timer is cascaded at most once per level, so we can
+ * keep a very large number of timers pending without having to keep them
+ * sorted.
+ *
+ * Timers that are further away than the top level can reach are placed in
+ * the top level's furthest slot, and are placed again when it cascades.  Each
+ * level has a bitmap of its non-empty slots, so that we can skip straight to
+ * the next tick that has anything to do.
+ *
+ * Each pending timer is a task, linked into its slot via its `item` field.  A
+ * wheel is not thread-safe; each execution context has its own.
+ *
+ * [1] George Varghese and Tony Lauck.  "Hashed and hierarchical timing wheels:
+ *     data structures for the efficient implementation of a timer facility".
+ *     SOSP 1987.
+ */
+
+/* 1ms */
+#define FLT_TIMER_TICK  UINT64_C(1000000)
+#define FLT_TIMER_LEVEL_BITS  6
+#define FLT_TIMER_SLOT_COUNT  (1 << FLT_TIMER_LEVEL_BITS)
+#define FLT_TIMER_LEVEL_COUNT  4
+
+struct flt_timer_wheel {
+    /* The next tick that we haven't processed yet */
+    uint64_t  next;
+    /* The number of timers in the wheel */
+    size_t  count;
+    uint64_t  occupied[FLT_TIMER_LEVEL_COUNT];
+    struct cork_dllist  slots[FLT_TIMER_LEVEL_COUNT][FLT_TIMER_SLOT_COUNT];
+};
+
+/* Nanoseconds since some arbitrary point in the past */
+CORK_LOCAL
+uint64_t
+flt_timer_now(void);
+
+CORK_LOCAL
+void
+flt_timer_wheel_init(struct flt_timer_wheel *wheel);
+
+/* Adds `task` to the wheel, based on its `deadline`.  Returns false (and leaves
+ * the task alone) if the deadline has already passed. */
+CORK_LOCAL
+bool
+flt_timer_wheel_add(struct flt_timer_wheel *wheel, struct flt_task *task,
+                    uint64_t now);
+
+/* Moves every timer whose deadline is at or before `now` into `expired`. */
+CORK_LOCAL
+void
+flt_timer_wheel_advance(struct flt_timer_wheel *wheel, uint64_t now,
+                        struct cork_dllist *expired);
+
+/* Returns how long we can wait before we need to advance the wheel again.  The
+ * wheel must not be empty. */
+CORK_LOCAL
+uint64_t
+flt_timer_wheel_delay(struct flt_timer_wheel *wheel, uint64_t now);
+
+
+#endif /* FLEET_TIMER_H */
@@ -0,0 +1,152 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef FLEET_TOPOLOGY_H
+#define FLEET_TOPOLOGY_H
+
+#include "libcork/core.h"
+
+#include "fleet.h"
+
+
+/*-----------------------------------------------------------------------
+ * CPU topology
+ */
+
+/* Describes where each online CPU lives in the machine's memory hierarchy.
+ * Each of the `core`, `llc`, and `node` fields is an opaque identifier; two
+ * CPUs share a physical core (or last-level cache, or NUMA node) if and only if
+ * they have the same value for that field. */
+
+struct flt_cpu {
+    /* The OS's identifier for this CPU */
+    unsigned int  id;
+    unsigned int  core;
+    unsigned int  llc;
+    unsigned int  node;
+    /* This CPU's position among the hardware threads of its core */
+    unsigned int  smt_index;
+};
+
+struct flt_node_arena;
+
+struct flt_topology {
+    unsigned int  cpu_count;
+    struct flt_cpu  *cpus;
+    /* The number of distinct NUMA nodes that have online CPUs */
+    unsigned int  node_count;
+    /* Where flt_node_alloc carves out small regions, indexed by node ID.  NULL
+     * on machines with a single node. */
+    struct flt_node_arena  *arenas;
+    unsigned int  arena_count;
+};
+
+/* How "far apart" two CPUs are.  Stealing from a closer context is cheaper,
+ * since the stolen task's data is more likely to be in a cache that we
+ * share. */
+enum flt_topology_tier {
+    FLT_TIER_SAME_CORE = 0,
+    FLT_TIER_SAME_LLC,
+    FLT_TIER_SAME_NODE,
+    FLT_TIER_REMOTE,
+    FLT_TIER_COUNT
+};
+
+/* Reads the topology of the current machine from `sysfs_path` (which should
+ * usually be "/sys/devices/system/cpu").  If we can't read the topology, we
+ * treat each CPU as its own core, with all of them sharing a single cache and
+ * NUMA node. */
+CORK_LOCAL
+void
+flt_topology_init(struct flt_topology *topology, const char *sysfs_path);
+
+CORK_LOCAL
+void
+flt_topology_done(struct flt_topology *topology);
+
+CORK_LOCAL
+enum flt_topology_tier
+flt_topology_distance(const struct flt_cpu *a, const struct flt_cpu *b);
+
+/* Fills in `victims` with the index of every CPU in `cpus` other than
+ * `cpus[self]`, sorted by their distance from it (and by index within each
+ * tier).  The victims in tier `t` end at `tier_end[t]`.  `victims` must have
+ * room for `count` entries. */
+CORK_LOCAL
+void
+flt_topology_order_victims(const struct flt_cpu * const *cpus,
+                           unsigned int count, unsigned int self,
+                           unsigned int *victims, unsigned int *tier_end);
+
+
+/*-----------------------------------------------------------------------
+ * Placement
+ */
+
+/* Chooses a CPU for each of `count` execution contexts, according to `policy`.
+ * `cpu_ids` is only used for FLT_AFFINITY_EXPLICIT.  With FLT_AFFINITY_NONE,
+ * contexts aren't pinned, and so the placement is only a guess. */
+CORK_LOCAL
+void
+flt_topology_place(struct flt_topology *topology,
+                   enum flt_affinity_policy policy,
+                   const unsigned int *cpu_ids, unsigned int cpu_id_count,
+                   unsigned int count, const struct flt_cpu **dest);
+
+/* Restricts the current thread to run only on `cpu`. */
+CORK_LOCAL
+void
+flt_cpu_pin_current_thread(const struct flt_cpu *cpu);
+
+/* Saves and restores the set of CPUs that the current thread can run on. */
+struct flt_saved_affinity;
+
+CORK_LOCAL
+struct flt_saved_affinity *
+flt_affinity_save(void);
+
+CORK_LOCAL
+void
+flt_affinity_restore(struct flt_saved_affinity *saved);
+
+
+/*-----------------------------------------------------------------------
+ * Node-local memory
+ */
+
+/* Allocates a zeroed region of memory whose pages live on NUMA node `node`.  On
+ * machines with a single node this is just cork_calloc.  You must free the
+ * region with flt_node_free, passing in the same topology and size.  Small
+ * regions are carved out of a per-node arena, so they're cheap to allocate and
+ * free, but they're only aligned to the smaller of their size (rounded up to a
+ * power of two) and the page size, and their memory isn't given back to the OS
+ * until the topology is freed. */
+CORK_LOCAL
+void *
+flt_node_alloc(const struct flt_topology *topology, unsigned int node,
+               size_t size);
+
+CORK_LOCAL
+void
+flt_node_free(const struct flt_topology *topology, void *ptr, size_t size);
+
+/* Moves any pages that lie entirely within an existing region allocated by
+ * flt_node_alloc onto `node`.  (Has no effect on single-node machines.) */
+CORK_LOCAL
+void
+flt_node_bind(const struct flt_topology *topology, unsigned int node,
+              void *ptr, size_t size);
+
+/* The granularity at which flt_node_bind works */
+CORK_LOCAL
+size_t
+flt_node_page_size(const struct flt_topology *topology);
+
+
+#endif /* FLEET_TOPOLOGY_H */
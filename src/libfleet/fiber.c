@@ -0,0 +1,217 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "libcork/core.h"
+
+#include "fleet.h"
+#include "fleet/fiber.h"
+#include "fleet/topology.h"
+
+#if !defined(MAP_STACK)
+#define MAP_STACK  0
+#endif
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS  MAP_ANON
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Stacks
+ */
+
+#define flt_round_up(sz, unit)  (((sz) + (unit) - 1) / (unit) * (unit))
+
+/* The part of the mapping that's reserved for the flt_fiber instance itself */
+#define FLT_FIBER_HEADER_SIZE  flt_round_to_cache_line(sizeof(struct flt_fiber))
+
+struct flt_fiber *
+flt_fiber_new(const struct flt_topology *topology, unsigned int node,
+              size_t stack_size)
+{
+    size_t  page_size = sysconf(_SC_PAGESIZE);
+    size_t  mapping_size =
+        page_size + flt_round_up(stack_size + FLT_FIBER_HEADER_SIZE, page_size);
+    char  *mapping;
+    struct flt_fiber  *fiber;
+
+    mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (CORK_UNLIKELY(mapping == MAP_FAILED)) {
+        fprintf(stderr, "fleet: Cannot allocate %zu-byte fiber stack\n",
+                mapping_size);
+        abort();
+    }
+    if (CORK_UNLIKELY(mprotect(mapping, page_size, PROT_NONE) != 0)) {
+        fprintf(stderr, "fleet: Cannot protect fiber stack guard page\n");
+        abort();
+    }
+    flt_node_bind(topology, node, mapping + page_size,
+                  mapping_size - page_size);
+
+    fiber = (struct flt_fiber *)
+        (mapping + mapping_size - FLT_FIBER_HEADER_SIZE);
+    fiber->next = NULL;
+    fiber->sibling = NULL;
+    fiber->flt = NULL;
+    fiber->mapping = mapping;
+    fiber->mapping_size = mapping_size;
+    return fiber;
+}
+
+void
+flt_fiber_free(struct flt_fiber *fiber)
+{
+    munmap(fiber->mapping, fiber->mapping_size);
+}
+
+void
+flt_fiber_init_native(struct flt_fiber *fiber)
+{
+    fiber->next = NULL;
+    fiber->sibling = NULL;
+    fiber->flt = NULL;
+    fiber->mapping = NULL;
+    fiber->mapping_size = 0;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Switching
+ */
+
+#if FLT_FIBER_ASM
+
+/* flt_fiber__swap pushes the callee-saved registers (and the SSE and x87
+ * control words) onto the current stack, saves the stack pointer into
+ * `*from_sp`, and then pops the same things off of `to_sp`.  A new fiber's stack
+ * is set up to look like it was saved by flt_fiber__swap, with a return address
+ * of flt_fiber__start, which calls `entry` (from r13) with `ud` (from r12). */
+
+CORK_LOCAL
+void
+flt_fiber__swap(void **from_sp, void *to_sp);
+
+CORK_LOCAL
+void
+flt_fiber__start(void);
+
+__asm__ (
+    ".text\n"
+    ".globl flt_fiber__swap\n"
+    ".hidden flt_fiber__swap\n"
+    ".type flt_fiber__swap, @function\n"
+    "flt_fiber__swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size flt_fiber__swap, .-flt_fiber__swap\n"
+    "\n"
+    ".globl flt_fiber__start\n"
+    ".hidden flt_fiber__start\n"
+    ".type flt_fiber__start, @function\n"
+    "flt_fiber__start:\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    ".size flt_fiber__start, .-flt_fiber__start\n"
+);
+
+/* The initial MXCSR and x87 control words, as set up by the ABI */
+#define FLT_MXCSR_DEFAULT  UINT32_C(0x1f80)
+#define FLT_X87CW_DEFAULT  UINT16_C(0x037f)
+
+void
+flt_fiber_prepare(struct flt_fiber *fiber, flt_fiber_entry *entry, void *ud)
+{
+    /* The fiber instance sits at the top of the stack, and is aligned to a
+     * cache line, so the stack below it starts out 16-byte aligned. */
+    uint64_t  *top = (uint64_t *) fiber;
+    uint64_t  *frame = top - 10;
+    frame[0] = FLT_MXCSR_DEFAULT | ((uint64_t) FLT_X87CW_DEFAULT << 32);
+    frame[1] = 0;                               /* r15 */
+    frame[2] = 0;                               /* r14 */
+    frame[3] = (uint64_t) (uintptr_t) entry;    /* r13 */
+    frame[4] = (uint64_t) (uintptr_t) ud;       /* r12 */
+    frame[5] = 0;                               /* rbx */
+    frame[6] = 0;                               /* rbp */
+    frame[7] = (uint64_t) (uintptr_t) flt_fiber__start;
+    frame[8] = 0;
+    frame[9] = 0;
+    /* Once flt_fiber__swap returns into flt_fiber__start, the stack pointer
+     * is 16-byte aligned, as it should be right before a call. */
+    fiber->sp = frame;
+}
+
+void
+flt_fiber_switch(struct flt_fiber *from, struct flt_fiber *to)
+{
+    flt_fiber__swap(&from->sp, to->sp);
+}
+
+#else /* !FLT_FIBER_ASM */
+
+/* makecontext can only pass int parameters to the fiber's entry point, so we
+ * split the fiber pointer in half. */
+
+static void
+flt_fiber__start(int hi, int lo)
+{
+    struct flt_fiber  *fiber = (struct flt_fiber *) (uintptr_t)
+        (((uint64_t) (unsigned int) hi << 32) | (unsigned int) lo);
+    fiber->entry(fiber->ud);
+    abort();
+}
+
+void
+flt_fiber_prepare(struct flt_fiber *fiber, flt_fiber_entry *entry, void *ud)
+{
+    char  *stack = (char *) fiber->mapping + sysconf(_SC_PAGESIZE);
+    uint64_t  ptr = (uintptr_t) fiber;
+    fiber->entry = entry;
+    fiber->ud = ud;
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = stack;
+    fiber->context.uc_stack.ss_size = (char *) fiber - stack;
+    fiber->context.uc_link = NULL;
+    makecontext(&fiber->context, (void (*)(void)) flt_fiber__start, 2,
+                (int) (ptr >> 32), (int) (ptr & 0xffffffff));
+}
+
+void
+flt_fiber_switch(struct flt_fiber *from, struct flt_fiber *to)
+{
+    swapcontext(&from->context, &to->context);
+}
+
+#endif /* FLT_FIBER_ASM */
@@ -7,6 +7,10 @@
  * ----------------------------------------------------------------------
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "libcork/core.h"
 #include "libcork/ds.h"
 
@@ -32,69 +36,188 @@ static struct flt_spinlock  debug_lock = FLT_SPINLOCK_INIT();
 #define DEBUG(flt, ...)  ((void) (flt))
 #endif
 
+#if FLT_MEASURE_TIMING
+#define flt_start_stopwatch(flt)  flt_stopwatch_start(&(flt)->stopwatch)
+#define flt_measure_time(flt, which) \
+    (flt)->timing.which += flt_stopwatch_get_delta(&(flt)->stopwatch)
+#else
+#define flt_start_stopwatch(flt)      /* do nothing */
+#define flt_measure_time(flt, which)  /* do nothing */
+#endif
+
 
 /*-----------------------------------------------------------------------
  * Tasks
  */
 
-/* 8Kb batches */
-#define TASK_BATCH_SIZE  8192
-#define TASK_BATCH_COUNT  (TASK_BATCH_SIZE / sizeof(struct flt_task))
-
 /* Create a new batch of task instances.  Link them all together via their next
- * fields */
+ * fields.  The batch lives on this context's NUMA node. */
 static struct flt_task *
 flt_task_batch_new(struct flt_priv *flt)
 {
     size_t  i;
-    struct flt_task  *task = cork_malloc(TASK_BATCH_SIZE);
+    struct flt_task_batch  *batch =
+        flt_node_alloc(&flt->fleet->topology, flt->cpu->node, TASK_BATCH_SIZE);
     struct flt_task  *first;
     struct flt_task  *curr;
 
     /* The first task in the batch is reserved, and is used to keep track of the
      * batches that are owned by this context. */
-    cork_dllist_add_to_tail(&flt->batches, &task->item);
+    cork_dllist_add_to_tail(&flt->batches, &batch->item);
+    batch->owner = flt;
+    batch->in_use = 1;
 
     /* This whole operation was kicked off because someone wants to create a new
      * task instance; the second instance is the batch is the one we'll use for
      * that. */
-    first = task + 1;
+    first = (struct flt_task *) batch + 1;
+    first->batch = batch;
 
     /* The remaining tasks in the batch can be used by the scheduler.  These
      * task instances start off local to this context, but might migrate to
-     * other contexts while the scheduler runs.  That's perfectly fine; we keep
-     * track of the batches separately so that we can free everything safely
-     * when the fleet is freed. */
+     * other contexts while the scheduler runs; see flt_task_free. */
     for (i = 2, curr = first + 1; i < TASK_BATCH_COUNT; i++, curr++) {
+        curr->batch = batch;
         cork_dllist_add_to_tail(&flt->unused, &curr->item);
     }
+    flt->unused_count += TASK_BATCH_COUNT - 2;
 
     return first;
 }
 
 static void
-flt_task_batch_free(struct flt_priv *flt, struct flt_task *batch)
+flt_task_batch_free(struct flt_priv *flt, struct flt_task_batch *batch)
+{
+    flt_node_free(&flt->fleet->topology, batch, TASK_BATCH_SIZE);
+}
+
+/* All of the batch's tasks are in our `unused` list; take them out and give the
+ * batch back to the OS. */
+static void
+flt_task_batch_trim(struct flt_priv *flt, struct flt_task_batch *batch)
 {
-    free(batch);
+    size_t  i;
+    struct flt_task  *curr;
+    DEBUG(flt, "Free unused task batch %p", batch);
+    for (i = 1, curr = (struct flt_task *) batch + 1; i < TASK_BATCH_COUNT;
+         i++, curr++) {
+        cork_dllist_remove(&curr->item);
+    }
+    flt->unused_count -= TASK_BATCH_COUNT - 1;
+    cork_dllist_remove(&batch->item);
+    flt_task_batch_free(flt, batch);
 }
 
 static struct flt_task *
 flt_reuse_task(struct flt *pflt, const char *name, flt_task *func, void *ud,
                size_t min, size_t max);
 
+/* Puts one of our own tasks back into our `unused` list. */
+static void
+flt_task_release(struct flt_priv *flt, struct flt_task *task)
+{
+    struct flt_task_batch  *batch = task->batch;
+    cork_dllist_add_to_head(&flt->unused, &task->item);
+    flt->unused_count++;
+    if (CORK_UNLIKELY(--batch->in_use == 0 &&
+                      flt->unused_count > TASK_HIGH_WATER)) {
+        flt_task_batch_trim(flt, batch);
+    }
+}
+
+/* Takes back all of the tasks that other contexts have returned to us. */
+static void
+flt_task_reclaim(struct flt_priv *flt)
+{
+    struct cork_dllist_item  *curr;
+    if (CORK_LIKELY(flt->returned_tasks == NULL)) {
+        return;
+    }
+    curr = __sync_lock_test_and_set(&flt->returned_tasks, NULL);
+    while (curr != NULL) {
+        struct cork_dllist_item  *next = curr->next;
+        flt_task_release(flt, cork_container_of(curr, struct flt_task, item));
+        curr = next;
+    }
+    if (!cork_dllist_is_empty(&flt->unused)) {
+        flt->public.new_task = flt_reuse_task;
+    }
+}
+
+/* Hands each of the tasks in our `foreign` list back to the context that
+ * allocated it, pushing all of the tasks for each owner with a single CAS. */
+static void
+flt_task_return_foreign(struct flt_priv *flt)
+{
+    struct cork_dllist_item  *remaining = flt->foreign;
+    flt->foreign = NULL;
+    flt->foreign_count = 0;
+    while (remaining != NULL) {
+        struct flt_task  *first =
+            cork_container_of(remaining, struct flt_task, item);
+        struct flt_priv  *owner = first->batch->owner;
+        struct cork_dllist_item  *head = NULL;
+        struct cork_dllist_item  *tail = NULL;
+        struct cork_dllist_item  *others = NULL;
+        struct cork_dllist_item  *curr = remaining;
+        struct cork_dllist_item  *old_head;
+
+        while (curr != NULL) {
+            struct cork_dllist_item  *next = curr->next;
+            struct flt_task  *task =
+                cork_container_of(curr, struct flt_task, item);
+            if (task->batch->owner == owner) {
+                if (tail == NULL) {
+                    tail = curr;
+                }
+                curr->next = head;
+                head = curr;
+            } else {
+                curr->next = others;
+                others = curr;
+            }
+            curr = next;
+        }
+
+        DEBUG(flt, "Return tasks to context %u", owner->public.index);
+        do {
+            old_head = owner->returned_tasks;
+            tail->next = old_head;
+        } while (!__sync_bool_compare_and_swap
+                 (&owner->returned_tasks, old_head, head));
+        remaining = others;
+    }
+}
+
 static struct flt_task *
 flt_create_task(struct flt *pflt, const char *name, flt_task *func, void *ud,
                 size_t min, size_t max)
 {
     struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
-    struct flt_task  *task = flt_task_batch_new(flt);
-    flt->public.new_task = flt_reuse_task;
+    struct flt_task  *task;
+
+    /* Before allocating a new batch, see if we can reuse any tasks that other
+     * contexts have given back to us, or any of theirs that we're holding on
+     * to. */
+    flt_task_reclaim(flt);
+    if (!cork_dllist_is_empty(&flt->unused)) {
+        return flt_reuse_task(pflt, name, func, ud, min, max);
+    } else if (flt->foreign != NULL) {
+        task = cork_container_of(flt->foreign, struct flt_task, item);
+        flt->foreign = task->item.next;
+        flt->foreign_count--;
+    } else {
+        task = flt_task_batch_new(flt);
+        flt->public.new_task = flt_reuse_task;
+    }
     task->name = name;
     task->func = func;
+    task->range_func = NULL;
     task->ud = ud;
     task->min = min;
     task->max = max;
     task->group = NULL;
+    task->period = 0;
     return task;
 }
 
@@ -109,603 +232,2513 @@ flt_reuse_task(struct flt *pflt, const char *name, flt_task *func, void *ud,
         flt->public.new_task = flt_create_task;
     }
     cork_dllist_remove(head);
+    flt->unused_count--;
+    task->batch->in_use++;
     task->name = name;
     task->func = func;
+    task->range_func = NULL;
     task->ud = ud;
     task->min = min;
     task->max = max;
     task->group = NULL;
+    task->period = 0;
     return task;
 }
 
+/* Tasks often finish in a different context than the one that allocated them,
+ * since thieves take tasks from other contexts.  If a thief kept those tasks,
+ * a context that produces more tasks than it runs would keep allocating new
+ * batches, while the unused tasks piled up in the thieves.  Instead, a thief
+ * collects the tasks that it frees into its `foreign` list (which it can still
+ * reuse if it runs out of its own), and hands them back to their owners once
+ * it has a batch's worth.  Owners take back returned tasks whenever they run
+ * out of unused tasks, or out of work.
+ *
+ * Each batch counts how many of its tasks aren't in its owner's `unused` list.
+ * Once that drops to zero, and the owner has more unused tasks than it's
+ * likely to need, the owner frees the batch, so that a long-running fleet gives
+ * memory back to the OS after a burst of tasks. */
 static void
 flt_task_free(struct flt_priv *flt, struct flt_task *task)
 {
-    cork_dllist_add_to_head(&flt->unused, &task->item);
-    flt->public.new_task = flt_reuse_task;
+    if (CORK_LIKELY(task->batch->owner == flt)) {
+        flt_task_release(flt, task);
+        flt->public.new_task = flt_reuse_task;
+    } else {
+        task->item.next = flt->foreign;
+        flt->foreign = &task->item;
+        if (CORK_UNLIKELY(++flt->foreign_count >= TASK_RETURN_COUNT)) {
+            flt_task_return_foreign(flt);
+        }
+    }
+}
+
+struct flt_task *
+flt_range_task_new_(struct flt *flt, const char *name, flt_range_task *func,
+                    void *ud, size_t min, size_t max)
+{
+    struct flt_task  *task = flt->new_task(flt, name, NULL, ud, min, max);
+    task->range_func = func;
+    return task;
+}
+
+struct flt_task *
+flt_task_new_with_data_(struct flt *flt, const char *name, flt_task *func,
+                        const void *data, size_t size, size_t min, size_t max)
+{
+    struct flt_task  *task;
+    if (CORK_UNLIKELY(size > FLT_TASK_DATA_SIZE)) {
+        fprintf(stderr, "fleet: Task data for %s is too large (%zu bytes)\n",
+                name, size);
+        abort();
+    }
+    task = flt->new_task(flt, name, func, NULL, min, max);
+    memcpy(task->data, data, size);
+    task->ud = task->data;
+    return task;
 }
 
 
 /*-----------------------------------------------------------------------
- * Task groups
+ * Slabs
  */
 
-static void
-flt_task_group_ctx__init(struct flt *pflt, void *ud, void *vctx)
+/* 4Kb batches */
+#define SLAB_BATCH_SIZE  4096
+
+/* Like tasks, slab objects are allocated by whichever context needs one, and
+ * returned to whichever context frees them. */
+static void *
+flt_slab_alloc(struct flt_priv *flt, struct flt_slab *slab, size_t size)
 {
-    struct flt_task_group_ctx  *ctx = vctx;
-    ctx->group = ud;
-    ctx->after = NULL;
-    cork_dllist_init(&ctx->tasks);
-    ctx->task_count = 0;
-    ctx->execution_count = 0;
+    void  **obj = slab->unused;
+    if (CORK_UNLIKELY(obj == NULL)) {
+        size_t  i;
+        size_t  count = SLAB_BATCH_SIZE / size;
+        char  *batch = flt_node_alloc
+            (&flt->fleet->topology, flt->cpu->node, SLAB_BATCH_SIZE);
+        *(void **) batch = slab->batches;
+        slab->batches = batch;
+        for (i = 2; i < count; i++) {
+            obj = (void **) (batch + i * size);
+            *obj = slab->unused;
+            slab->unused = obj;
+        }
+        return batch + size;
+    }
+    slab->unused = *obj;
+    return obj;
 }
 
 static void
-flt_task_group_ctx__done(struct flt *pflt, void *ud, void *vctx)
+flt_slab_free(struct flt_slab *slab, void *obj)
 {
-    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
-    struct flt_task_group_ctx  *ctx = vctx;
-    struct cork_dllist_item  *curr;
-    struct cork_dllist_item  *next;
-    struct flt_task  *task;
+    *(void **) obj = slab->unused;
+    slab->unused = obj;
+}
 
-    /* If there any pending tasks that were never scheduled, free them now. */
-    cork_dllist_foreach(&ctx->tasks, curr, next, struct flt_task, task, item) {
-        flt_task_free(flt, task);
+static void
+flt_slab_done(struct flt_priv *flt, struct flt_slab *slab)
+{
+    void  *batch = slab->batches;
+    while (batch != NULL) {
+        void  *next = *(void **) batch;
+        flt_node_free(&flt->fleet->topology, batch, SLAB_BATCH_SIZE);
+        batch = next;
     }
 }
 
-struct flt_task_group *
-flt_task_group_new(struct flt *pflt)
+
+/*-----------------------------------------------------------------------
+ * Load board
+ */
+
+/* Each context publishes an approximate count of the tasks in its ready deque
+ * into the fleet's load board, so that thieves can find a loaded victim by
+ * scanning one compact array, instead of probing each victim's deque (whose
+ * `top` is on a contended cache line).  To keep the board's cache lines from
+ * ping-ponging, we only publish the bit length of the deque size, and only
+ * write to the board when that changes.  When we pop a task, we only publish
+ * the smaller load once it has dropped by at least two buckets (or to zero,
+ * once the deque is drained); otherwise a context that pushes and pops one
+ * task at a time would write to the board for every task.  Only the owner
+ * writes its entry, so it's always based on the real size of the deque, but it
+ * can be stale if thieves have stolen from us since we last published it. */
+
+static inline uint8_t
+flt_load_bucket(size_t size)
 {
-    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
-    struct flt_task_group  *group = cork_new(struct flt_task_group);
-    DEBUG(flt, "New task group %p", group);
-    group->ctxs = flt_local_new
-        (&flt->public, struct flt_task_group_ctx, group,
-         flt_task_group_ctx__init, flt_task_group_ctx__done);
-    flt_counter_init(&group->active_ctx_count);
-    group->next_after = NULL;
-    group->state = FLT_TASK_GROUP_STOPPED;
-    cork_dllist_add_to_head(&flt->groups, &group->item);
-    return group;
+    return (size == 0)? 0:
+        (size >= 0x80000000)? 32: 32 - __builtin_clz((unsigned int) size);
 }
 
+#define flt_publish_load(flt, size) \
+    do { \
+        uint8_t  __bucket = flt_load_bucket((size)); \
+        if (CORK_UNLIKELY(__bucket != (flt)->published_load)) { \
+            (flt)->published_load = __bucket; \
+            (flt)->fleet->load_board[(flt)->public.index] = __bucket; \
+        } \
+    } while (0)
+
+/* `size` is only evaluated if it could possibly make a difference. */
+#define flt_publish_smaller_load(flt, size) \
+    do { \
+        if (CORK_UNLIKELY((flt)->published_load > 1)) { \
+            uint8_t  __bucket = flt_load_bucket((size)); \
+            if (__bucket + 1 < (flt)->published_load) { \
+                (flt)->published_load = __bucket; \
+                (flt)->fleet->load_board[(flt)->public.index] = __bucket; \
+            } \
+        } \
+    } while (0)
+
+
+/*-----------------------------------------------------------------------
+ * Idle contexts
+ */
+
+/* How many times an idle context tries to steal before it falls back on the
+ * fleet's idle policy.  This covers all of the spinning and yielding steps of
+ * flt_pause. */
+#define FLT_IDLE_SPIN_COUNT  22
+
+/* We only wake up a sleeping context if the deque we just pushed onto has at
+ * least this many tasks in it.  The owner will pop the bottom task itself, so
+ * it's only worth waking a thief if there's something else for it to take. */
+#define FLT_WAKE_DEPTH  2
+
 static void
-flt_task_group_free(struct flt_priv *flt, struct flt_task_group *group)
+flt_fleet_wake(struct flt_fleet *fleet, int count)
 {
-    flt_local_free(&flt->public, group->ctxs);
-    free(group);
+    /* This barrier pairs with the atomic increment in flt_park; either we see
+     * the sleeper, or it sees whatever we've just made available. */
+    flt_full_barrier();
+    if (CORK_UNLIKELY(flt_counter_get(&fleet->sleeper_count) > 0)) {
+        cork_uint_atomic_add(&fleet->wake_seq.value, 1);
+        flt_futex_wake(&fleet->wake_seq.value, count);
+    }
 }
 
-void
-flt_task_group_start(struct flt *pflt, struct flt_task_group *group)
-{
-    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
-    unsigned int  i;
-    struct flt_task_group_ctx  *ctx;
+#define flt_fleet_wake_one(fleet)  flt_fleet_wake((fleet), 1)
+#define flt_fleet_wake_all(fleet)  flt_fleet_wake((fleet), FLT_FUTEX_WAKE_ALL)
 
-    DEBUG(flt, "Start task group %p", group);
+/* Call this after pushing tasks onto our deque.  Publishes our new load, and
+ * wakes up a sleeping context if we have enough ready tasks for it to steal. */
+#define flt_announce_tasks(flt) \
+    do { \
+        size_t  __size = flt_deque_size(&(flt)->ready); \
+        flt_publish_load((flt), __size); \
+        if (__size >= FLT_WAKE_DEPTH) { \
+            flt_fleet_wake_one((flt)->fleet); \
+        } \
+    } while (0)
 
-    /* If this execution context didn't already have any tasks in its queue,
-     * then the context just became active.  Bump the fleet's active context
-     * count. */
-    if (!flt->active) {
-        DEBUG(flt, "Context is now active");
-        flt_counter_inc(&flt->fleet->active_count);
-        flt->active = true;
+static bool
+flt_fleet_has_ready_tasks(struct flt_fleet *fleet)
+{
+    unsigned int  i;
+    if (fleet->io_completed != NULL || fleet->injected != NULL) {
+        return true;
+    }
+    for (i = 0; i < fleet->count; i++) {
+        if (!flt_deque_is_empty(&fleet->contexts[i]->ready)) {
+            return true;
+        }
     }
+    return false;
+}
 
-    /* Move all of the group's pending tasks into the current execution
-     * context's ready queue (regardless of which context they used to belong
-     * to). */
-    flt_local_foreach(pflt, group->ctxs, i, struct flt_task_group_ctx, ctx) {
-        DEBUG(flt, "Start %zu/%zu tasks from group %p, context %u",
-              ctx->task_count, ctx->execution_count, group, i);
-        flt->execution_count += ctx->execution_count;
-        cork_dllist_add_list_to_head(&flt->ready, &ctx->tasks);
+static void
+flt_park(struct flt_priv *flt)
+{
+    struct flt_fleet  *fleet = flt->fleet;
+    unsigned int  seq;
+
+    /* Announce that we're going to sleep before we check one last time whether
+     * there's anything to do, so that we can't miss a wakeup. */
+    flt_counter_inc(&fleet->sleeper_count);
+    seq = fleet->wake_seq.value;
+    if (!flt_snzi_is_zero(&fleet->active) &&
+        flt->reattach_waiting == 0 && flt->resumed == NULL &&
+        !flt_fleet_has_ready_tasks(fleet)) {
+        DEBUG(flt, "Parking");
+        flt_measure_time(flt, choosing_to_steal);
+        if (CORK_UNLIKELY(flt->timers.count > 0)) {
+            /* Don't sleep past the next timer that we have to deal with. */
+            uint64_t  delay =
+                flt_timer_wheel_delay(&flt->timers, flt_timer_now());
+            if (delay > 0) {
+                flt_futex_wait_timeout(&fleet->wake_seq.value, seq, delay);
+            }
+        } else {
+            flt_futex_wait(&fleet->wake_seq.value, seq);
+        }
+        flt_measure_time(flt, parked);
+        DEBUG(flt, "Woke up");
     }
-    group->state = FLT_TASK_GROUP_STARTED;
+    (void) flt_counter_dec(&fleet->sleeper_count);
 }
 
+/* Called when an idle context wasn't able to steal anything. */
 static void
-flt_task_group_increment(struct flt_priv *flt, struct flt_task_group *group)
+flt_idle(struct flt_priv *flt, unsigned int *spin_count)
 {
-    struct flt_task_group_ctx  *ctx =
-        flt_local_get(&flt->public, group->ctxs, struct flt_task_group_ctx);
-    if (ctx->task_count++ == 0) {
-        /* This is the first pending task that we've added to this per-context
-         * object.  That means that the context has just become "active" for
-         * this group, and we need to bump the group's active context count. */
-        DEBUG(flt, "Group %p is now active for context %u",
-              group, flt->public.index);
-        flt_counter_inc(&group->active_ctx_count);
+    switch (flt->fleet->idle_policy) {
+        case FLT_IDLE_SPIN:
+            cork_pause();
+            break;
+
+        case FLT_IDLE_YIELD:
+            if (*spin_count < FLT_IDLE_SPIN_COUNT) {
+                flt_pause(*spin_count);
+            } else {
+                FLT_THREAD_YIELD();
+            }
+            break;
+
+        default:
+            if (*spin_count < FLT_IDLE_SPIN_COUNT) {
+                flt_pause(*spin_count);
+            } else {
+                flt_park(flt);
+                *spin_count = 0;
+            }
+            break;
     }
 }
 
+
+/*-----------------------------------------------------------------------
+ * Jobs
+ */
+
+/* Hands a job to the fleet's execution contexts.  The job must already hold an
+ * arrival at the fleet's active indicator. */
 static void
-flt_task_group_fire_afters(struct flt_priv *flt, struct flt_task_group *group)
+flt_fleet_inject(struct flt_fleet *fleet, struct flt_job *job)
 {
-    size_t  i;
-    struct flt_task_group_ctx  *ctx;
-    flt_local_foreach(&flt->public, group->ctxs, i,
-                      struct flt_task_group_ctx, ctx) {
-        struct flt_task_group  *after;
-        for (after = ctx->after; after != NULL; after = after->next_after) {
-            flt_task_group_start(&flt->public, after);
+    struct flt_job  *head;
+    do {
+        head = fleet->injected;
+        job->next = head;
+    } while (!__sync_bool_compare_and_swap(&fleet->injected, head, job));
+    flt_fleet_wake_one(fleet);
+}
+
+enum flt_admission {
+    FLT_JOB_ADMITTED,
+    FLT_JOB_SPILLED,
+    FLT_JOB_REJECTED
+};
+
+/* Decides whether a new job can be admitted right away.  Only admitted jobs
+ * should be injected; a spilled job will be injected later by
+ * flt_fleet_release_job. */
+static enum flt_admission
+flt_fleet_admit_job(struct flt_fleet *fleet, struct flt_job *job)
+{
+    if (fleet->job_limit == 0) {
+        (void) cork_size_atomic_add(&fleet->job_count, 1);
+        return FLT_JOB_ADMITTED;
+    }
+
+    pthread_mutex_lock(&fleet->job_lock);
+    if (fleet->job_count >= fleet->job_limit) {
+        switch (fleet->submit_policy) {
+            case FLT_SUBMIT_FAIL:
+                pthread_mutex_unlock(&fleet->job_lock);
+                return FLT_JOB_REJECTED;
+
+            case FLT_SUBMIT_SPILL:
+                /* The job waits in the spill list until some other job
+                 * finishes and hands over its slot.  We don't create any tasks
+                 * for it until then. */
+                job->next = NULL;
+                if (fleet->spill_head == NULL) {
+                    fleet->spill_head = job;
+                } else {
+                    fleet->spill_tail->next = job;
+                }
+                fleet->spill_tail = job;
+                pthread_mutex_unlock(&fleet->job_lock);
+                return FLT_JOB_SPILLED;
+
+            case FLT_SUBMIT_BLOCK:
+            default:
+                while (fleet->job_count >= fleet->job_limit) {
+                    pthread_cond_wait(&fleet->job_cond, &fleet->job_lock);
+                }
+                break;
         }
     }
+    fleet->job_count++;
+    pthread_mutex_unlock(&fleet->job_lock);
+    return FLT_JOB_ADMITTED;
 }
 
+/* Called when an admitted job finishes.  If there are any spilled jobs, the
+ * oldest one takes over this job's slot. */
 static void
-flt_task_group_decrement(struct flt_priv *flt, struct flt_task_group *group)
+flt_fleet_release_job(struct flt_fleet *fleet)
 {
-    struct flt_task_group_ctx  *ctx =
-        flt_local_get(&flt->public, group->ctxs, struct flt_task_group_ctx);
-    if (--ctx->task_count == 0) {
-        DEBUG(flt, "Group %p has finished in context %u",
-              group, flt->public.index);
-        /* This task group has no more tasks in this context, so the context is
-         * no longer active.  Decrement the active context count, and if *none*
-         * of the contexts are active anymore, then start any task groups that
-         * are supposed to execute after this group is done. */
-        if (flt_counter_dec(&group->active_ctx_count)) {
-            DEBUG(flt, "Group %p has finished", group);
-            flt_task_group_fire_afters(flt, group);
-        }
+    struct flt_job  *spilled;
+
+    if (fleet->job_limit == 0) {
+        (void) cork_size_atomic_sub(&fleet->job_count, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&fleet->job_lock);
+    spilled = fleet->spill_head;
+    if (spilled != NULL) {
+        fleet->spill_head = spilled->next;
+    } else {
+        fleet->job_count--;
+        pthread_cond_signal(&fleet->job_cond);
+    }
+    pthread_mutex_unlock(&fleet->job_lock);
+
+    if (spilled != NULL) {
+        flt_fleet_inject(fleet, spilled);
     }
 }
 
-void
-flt_task_group_add(struct flt *pflt, struct flt_task_group *group,
-                   struct flt_task *task)
+/* Moves all of a finished job's groups onto the fleet's `retired_groups`
+ * stack at once.  Nothing else can add a group to the job at this point. */
+static void
+flt_job_retire_groups(struct flt_job *job)
 {
-    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
-    struct flt_task_group_ctx  *ctx =
-        flt_local_get(pflt, group->ctxs, struct flt_task_group_ctx);
-    size_t  count = task->max - task->min;
-    task->group = group;
-    cork_dllist_add_to_head(&ctx->tasks, &task->item);
-    DEBUG(flt, "Add %s [%zu,%zu) to group %p",
-          task->name, task->min, task->max, group);
-    ctx->execution_count += count;
-    flt_task_group_increment(flt, group);
+    struct flt_fleet  *fleet = job->fleet;
+    struct cork_dllist_item  *head = job->groups;
+    struct cork_dllist_item  *tail;
+    struct cork_dllist_item  *old_head;
+    if (head == NULL) {
+        return;
+    }
+    for (tail = head; tail->next != NULL; tail = tail->next) {
+    }
+    do {
+        old_head = fleet->retired_groups;
+        tail->next = old_head;
+    } while (!__sync_bool_compare_and_swap
+             (&fleet->retired_groups, old_head, head));
 }
 
-void
-flt_task_group_run_after(struct flt *pflt, struct flt_task_group *group,
-                         struct flt_task_group *after)
+static void
+flt_job_group_finished(struct flt_job *job)
 {
-    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
-    struct flt_task_group_ctx  *ctx =
-        flt_local_get(pflt, group->ctxs, struct flt_task_group_ctx);
-    DEBUG(flt, "Group %p will run after group %p", after, group);
-    after->next_after = ctx->after;
-    ctx->after = after;
+    if (cork_uint_atomic_sub(&job->group_count, 1) == 0) {
+        /* Whoever's waiting for the job can free it as soon as we signal it, so
+         * retire its groups and release its slot first. */
+        flt_job_retire_groups(job);
+        flt_fleet_release_job(job->fleet);
+        pthread_mutex_lock(&job->lock);
+        job->finished = true;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->lock);
+    }
 }
 
-void
-flt_task_group_run_after_current(struct flt *pflt, struct flt_task_group *after)
+int
+flt_job_is_finished(struct flt_job *job)
 {
-    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
-    struct flt_task_group  *current_group = flt_current_group(flt);
-    struct flt_task_group_ctx  *ctx =
-        flt_local_get(pflt, current_group->ctxs, struct flt_task_group_ctx);
-    DEBUG(flt, "Group %p will run after group %p", after, current_group);
-    after->next_after = ctx->after;
-    ctx->after = after;
+    bool  result;
+    pthread_mutex_lock(&job->lock);
+    result = job->finished;
+    pthread_mutex_unlock(&job->lock);
+    return result;
 }
 
-static void
-flt_task_group_move(struct flt_priv *flt, struct flt_task_group *group,
-                    struct flt_priv *from)
+void
+flt_job_wait(struct flt_job *job)
 {
-    flt_task_group_decrement(from, group);
-    flt_task_group_increment(flt, group);
+    pthread_mutex_lock(&job->lock);
+    while (!job->finished) {
+        pthread_cond_wait(&job->cond, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+    pthread_cond_destroy(&job->cond);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
 }
 
 
 /*-----------------------------------------------------------------------
- * Execution contexts
+ * Task groups
  */
 
-static int
-flt__thread_run(struct cork_thread_body *body);
+#define flt_edge_new(flt) \
+    ((struct flt_task_group_edge *) flt_slab_alloc \
+     ((flt), &(flt)->edges, sizeof(struct flt_task_group_edge)))
 
-static void
-flt__thread_free(struct cork_thread_body *body)
-{
-    /* Nothing to do */
-}
+#define flt_edge_free(flt, edge)  flt_slab_free(&(flt)->edges, (edge))
 
-struct flt_priv *
-flt_new(struct flt_fleet *fleet, size_t index, size_t count)
+struct flt_task_group_ctx *
+flt_task_group_ctx_new(struct flt_priv *flt, struct flt_task_group *group)
 {
-    struct flt_priv  *flt = cork_new(struct flt_priv);
-    flt_spinlock_init(&flt->lock);
-    flt->public.index = index;
-    flt->public.count = count;
-    flt->fleet = fleet;
-    flt->public.new_task = flt_create_task;
-    flt->execution_count = 0;
-    cork_dllist_init(&flt->ready);
-    cork_dllist_init(&flt->unused);
-    cork_dllist_init(&flt->batches);
-    cork_dllist_init(&flt->groups);
-    flt->body.run = flt__thread_run;
-    flt->body.free = flt__thread_free;
-    flt->next_to_steal_from = (index + 1) % count;
-    flt->waiting_to_steal = NULL;
-    flt->active = false;
-#if FLT_MEASURE_TIMING
-    memset(&flt->timing, 0, sizeof(flt->timing));
-#endif
-    return flt;
+    struct flt_task_group_ctx  *ctx = flt_slab_alloc
+        (flt, &flt->group_ctxs, sizeof(struct flt_task_group_ctx));
+    ctx->group = group;
+    ctx->after = NULL;
+    cork_dllist_init(&ctx->tasks);
+    ctx->task_count = 0;
+    /* Make sure the ctx is initialized before anyone else can see it. */
+    flt_write_barrier();
+    group->ctxs[flt->public.index] = ctx;
+    return ctx;
 }
 
 static void
-flt_task_batch_list_done(struct flt_priv *flt, struct cork_dllist *list)
+flt_task_group_ctx_free(struct flt_priv *flt, struct flt_task_group_ctx *ctx)
 {
     struct cork_dllist_item  *curr;
     struct cork_dllist_item  *next;
     struct flt_task  *task;
-    cork_dllist_foreach(list, curr, next, struct flt_task, task, item) {
-        flt_task_batch_free(flt, task);
+    struct flt_task_group_edge  *edge;
+
+    /* If there any pending tasks that were never scheduled, free them now. */
+    cork_dllist_foreach(&ctx->tasks, curr, next, struct flt_task, task, item) {
+        flt_task_free(flt, task);
+    }
+
+    /* Likewise for the edges of a group that never finished. */
+    edge = ctx->after;
+    while (edge != NULL) {
+        struct flt_task_group_edge  *next_edge = edge->next;
+        flt_edge_free(flt, edge);
+        edge = next_edge;
     }
+
+    flt_slab_free(&flt->group_ctxs, ctx);
 }
 
+#define flt_task_group_size(flt) \
+    (sizeof(struct flt_task_group) + \
+     (flt)->public.count * sizeof(struct flt_task_group_ctx *))
+
+/* The most finished groups that each context will hold on to for reuse */
+#define FLT_GROUP_POOL_SIZE  256
+
 static void
-flt_task_group_list_done(struct flt_priv *flt, struct cork_dllist *list)
+flt_task_group_free_ctxs(struct flt_priv *flt, struct flt_task_group *group)
 {
-    struct cork_dllist_item  *curr;
-    struct cork_dllist_item  *next;
-    struct flt_task_group  *group;
-    cork_dllist_foreach(list, curr, next, struct flt_task_group, group, item) {
-        flt_task_group_free(flt, group);
+    unsigned int  i;
+    for (i = 0; i < flt->public.count; i++) {
+        if (group->ctxs[i] != NULL) {
+            flt_task_group_ctx_free(flt, group->ctxs[i]);
+            group->ctxs[i] = NULL;
+        }
     }
 }
 
-void
-flt_free(struct flt_priv *flt)
+static void
+flt_task_group_free(struct flt_priv *flt, struct flt_task_group *group)
 {
-    flt_task_group_list_done(flt, &flt->groups);
-    flt_task_batch_list_done(flt, &flt->batches);
-    free(flt);
+    flt_task_group_free_ctxs(flt, group);
+    free(group);
 }
 
-struct flt_task *
-flt_current_task(struct flt_priv *flt)
+/* Puts a group into our pool for reuse.  A recycled group looks like a brand
+ * new, stopped group to anyone who still has a pointer to it, so we must only
+ * recycle a group once nothing can refer to it anymore. */
+static void
+flt_task_group_recycle(struct flt_priv *flt, struct flt_task_group *group)
 {
-    struct cork_dllist_item  *head = cork_dllist_start(&flt->ready);
-    return cork_container_of(head, struct flt_task, item);
+    if (flt->unused_group_count < FLT_GROUP_POOL_SIZE) {
+        flt_task_group_free_ctxs(flt, group);
+        group->item.next = flt->unused_groups;
+        flt->unused_groups = &group->item;
+        flt->unused_group_count++;
+    } else {
+        flt_task_group_free(flt, group);
+    }
 }
 
-struct flt_task_group *
-flt_current_group(struct flt_priv *flt)
+static void
+flt_task_group_pool_done(struct flt_priv *flt)
+{
+    struct cork_dllist_item  *curr = flt->unused_groups;
+    while (curr != NULL) {
+        struct cork_dllist_item  *next = curr->next;
+        free(cork_container_of(curr, struct flt_task_group, item));
+        curr = next;
+    }
+    flt->unused_groups = NULL;
+    flt->unused_group_count = 0;
+}
+
+/* Recycles the groups of every job that has finished; see flt_job.  Groups
+ * that don't belong to a job are recycled at the end of each run instead. */
+static void
+flt_recycle_retired_groups(struct flt_priv *flt)
+{
+    struct cork_dllist_item  *curr;
+    if (CORK_LIKELY(flt->fleet->retired_groups == NULL)) {
+        return;
+    }
+    curr = __sync_lock_test_and_set(&flt->fleet->retired_groups, NULL);
+    while (curr != NULL) {
+        struct cork_dllist_item  *next = curr->next;
+        struct flt_task_group  *group =
+            cork_container_of(curr, struct flt_task_group, item);
+        DEBUG(flt, "Recycle task group %p", group);
+        flt_task_group_recycle(flt, group);
+        curr = next;
+    }
+}
+
+static struct flt_task_group *
+flt_task_group_new_in_job(struct flt_priv *flt, struct flt_job *job)
+{
+    struct flt_task_group  *group;
+    if (flt->unused_groups == NULL) {
+        flt_recycle_retired_groups(flt);
+    }
+    if (flt->unused_groups != NULL) {
+        group = cork_container_of
+            (flt->unused_groups, struct flt_task_group, item);
+        flt->unused_groups = group->item.next;
+        flt->unused_group_count--;
+    } else {
+        group = cork_calloc(1, flt_task_group_size(flt));
+    }
+    DEBUG(flt, "New task group %p", group);
+    group->active_ctx_count = 0;
+    group->join_count = 0;
+    group->waiters = NULL;
+    group->job = job;
+    group->state = FLT_TASK_GROUP_STOPPED;
+    group->cancelled = false;
+    if (job == NULL) {
+        cork_dllist_add_to_head(&flt->groups, &group->item);
+    } else {
+        struct cork_dllist_item  *head;
+        do {
+            head = job->groups;
+            group->item.next = head;
+        } while (!__sync_bool_compare_and_swap
+                 (&job->groups, head, &group->item));
+    }
+    return group;
+}
+
+struct flt_task_group *
+flt_task_group_new(struct flt *pflt)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    return flt_task_group_new_in_job(flt, flt_current_group(flt)->job);
+}
+
+/* Adds `count` tasks to one context's share of a group. */
+static void
+flt_task_group_ctx_add(struct flt_task_group *group,
+                       struct flt_task_group_ctx *ctx, size_t count)
+{
+    if (cork_size_atomic_add(&ctx->task_count, count) == count) {
+        /* These are the first tasks that we've added to this per-context
+         * object.  That means that the context has just become "active" for
+         * this group, and we need to bump the group's active context count. */
+        (void) cork_uint_atomic_add(&group->active_ctx_count, 1);
+    }
+}
+
+/* Removes `count` tasks from one context's share of a group.  Returns true if
+ * that finishes the whole group. */
+static bool
+flt_task_group_ctx_sub(struct flt_task_group *group,
+                       struct flt_task_group_ctx *ctx, size_t count)
+{
+    if (cork_size_atomic_sub(&ctx->task_count, count) == 0) {
+        /* This task group has no more tasks in this context, so the context is
+         * no longer active.  Decrement the active context count, and let the
+         * caller know if *none* of the contexts are active anymore. */
+        return cork_uint_atomic_sub(&group->active_ctx_count, 1) == 0;
+    } else {
+        return false;
+    }
+}
+
+static void
+flt_task_group_finish(struct flt_priv *flt, struct flt_task_group *group);
+
+void
+flt_task_group_start(struct flt *pflt, struct flt_task_group *group)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    unsigned int  i;
+    struct flt_task_group_ctx  *ctx;
+    struct flt_task_group_ctx  *own_ctx = flt_task_group_get_ctx(flt, group);
+    size_t  moved_count = 0;
+    size_t  total_count;
+
+    DEBUG(flt, "Start task group %p", group);
+    if (group->job != NULL) {
+        (void) cork_uint_atomic_add(&group->job->group_count, 1);
+    }
+
+    /* If this execution context didn't already have any tasks in its queue,
+     * then the context just became active.  Bump the fleet's active context
+     * count. */
+    if (!flt->active) {
+        DEBUG(flt, "Context is now active");
+        flt_snzi_arrive(flt->active_leaf);
+        flt->active = true;
+    }
+
+    /* All of the group's pending tasks are about to move into the current
+     * execution context's ready deque (regardless of which context they used
+     * to belong to), so this context now has to account for all of them.  We
+     * have to do this before pushing any of the tasks, since they can be stolen
+     * as soon as they're in our deque. */
+    for (i = 0; i < pflt->count; i++) {
+        ctx = group->ctxs[i];
+        if (ctx != NULL && ctx != own_ctx) {
+            moved_count += ctx->task_count;
+        }
+    }
+    if (moved_count > 0) {
+        flt_task_group_ctx_add(group, own_ctx, moved_count);
+    }
+    total_count = own_ctx->task_count;
+
+    for (i = 0; i < pflt->count; i++) {
+        struct cork_dllist_item  *curr;
+        struct cork_dllist_item  *next;
+        struct flt_task  *task;
+        ctx = group->ctxs[i];
+        if (ctx == NULL) {
+            continue;
+        }
+        DEBUG(flt, "Start %zu tasks from group %p, context %u",
+              ctx->task_count, group, i);
+        if (ctx != own_ctx && ctx->task_count > 0) {
+            (void) flt_task_group_ctx_sub(group, ctx, ctx->task_count);
+        }
+        cork_dllist_foreach(&ctx->tasks, curr, next,
+                            struct flt_task, task, item) {
+            flt_deque_push_bottom(&flt->ready, task);
+        }
+        cork_dllist_init(&ctx->tasks);
+    }
+    group->state = FLT_TASK_GROUP_STARTED;
+
+    /* An empty group doesn't have any tasks that could finish it, so it
+     * finishes as soon as it starts. */
+    if (total_count == 0) {
+        DEBUG(flt, "Group %p is empty", group);
+        flt_task_group_finish(flt, group);
+        return;
+    }
+    flt_announce_tasks(flt);
+}
+
+static void
+flt_task_group_increment(struct flt_priv *flt, struct flt_task_group *group)
+{
+    struct flt_task_group_ctx  *ctx = flt_task_group_get_ctx(flt, group);
+    DEBUG(flt, "Add task to group %p in context %u", group, flt->public.index);
+    flt_task_group_ctx_add(group, ctx, 1);
+}
+
+static void
+flt_task_group_fire_afters(struct flt_priv *flt, struct flt_task_group *group)
+{
+    size_t  i;
+    struct flt_task_group_ctx  *ctx;
+    bool  propagate =
+        group->cancelled && group->cancel_policy == FLT_CANCEL_PROPAGATE;
+    for (i = 0; i < flt->public.count; i++) {
+        struct flt_task_group_edge  *edge;
+        ctx = group->ctxs[i];
+        if (ctx == NULL) {
+            continue;
+        }
+        edge = ctx->after;
+        ctx->after = NULL;
+        while (edge != NULL) {
+            struct flt_task_group_edge  *next = edge->next;
+            struct flt_task_group  *after = edge->after;
+            flt_edge_free(flt, edge);
+            if (propagate) {
+                after->cancel_policy = FLT_CANCEL_PROPAGATE;
+                after->cancelled = true;
+            }
+            /* Once it's started, `after` might finish (and be freed) before
+             * start returns. */
+            if (cork_uint_atomic_sub(&after->join_count, 1) == 0) {
+                flt_task_group_start(&flt->public, after);
+            }
+            edge = next;
+        }
+    }
+}
+
+/* Hands each fiber that's waiting for `group` back to its own context.  Each
+ * one holds an arrival at its context's active leaf until that context picks it
+ * up; we're active, so that arrival can't be the first. */
+static void
+flt_task_group_resume_waiters(struct flt_priv *flt,
+                              struct flt_task_group *group)
+{
+    struct flt_fiber  *fiber =
+        __sync_lock_test_and_set(&group->waiters, FLT_TASK_GROUP_NO_WAITERS);
+    if (CORK_LIKELY(fiber == NULL)) {
+        return;
+    }
+    while (fiber != NULL) {
+        struct flt_fiber  *next = fiber->next;
+        struct flt_priv  *owner = fiber->flt;
+        struct flt_fiber  *head;
+        DEBUG(flt, "Resume fiber %p in context %u after group %p",
+              fiber, owner->public.index, group);
+        flt_snzi_arrive(owner->active_leaf);
+        do {
+            head = owner->resumed;
+            fiber->next = head;
+        } while (!__sync_bool_compare_and_swap(&owner->resumed, head, fiber));
+        fiber = next;
+    }
+    flt_fleet_wake_all(flt->fleet);
+}
+
+/* Starts any task groups that are supposed to execute after this group, and
+ * wakes up anything that's waiting for it. */
+static void
+flt_task_group_finish(struct flt_priv *flt, struct flt_task_group *group)
+{
+    DEBUG(flt, "Group %p has finished", group);
+    flt_task_group_fire_afters(flt, group);
+    flt_task_group_resume_waiters(flt, group);
+    flt_full_barrier();
+    group->state = FLT_TASK_GROUP_FINISHED;
+    /* Once the job finishes, its groups can be recycled, so this must be the
+     * last time we touch the group. */
+    if (group->job != NULL) {
+        flt_job_group_finished(group->job);
+    }
+}
+
+static void
+flt_task_group_decrement(struct flt_priv *flt, struct flt_task_group *group)
+{
+    struct flt_task_group_ctx  *ctx = flt_task_group_get_ctx(flt, group);
+    /* The group finishes once *none* of the contexts are active for it
+     * anymore. */
+    if (flt_task_group_ctx_sub(group, ctx, 1)) {
+        flt_task_group_finish(flt, group);
+    }
+}
+
+void
+flt_task_group_add(struct flt *pflt, struct flt_task_group *group,
+                   struct flt_task *task)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_task_group_ctx  *ctx = flt_task_group_get_ctx(flt, group);
+    task->group = group;
+    cork_dllist_add_to_head(&ctx->tasks, &task->item);
+    DEBUG(flt, "Add %s [%zu,%zu) to group %p",
+          task->name, task->min, task->max, group);
+    flt_task_group_increment(flt, group);
+}
+
+void
+flt_task_group_run_after(struct flt *pflt, struct flt_task_group *group,
+                         struct flt_task_group *after)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_task_group_ctx  *ctx = flt_task_group_get_ctx(flt, group);
+    struct flt_task_group_edge  *edge = flt_edge_new(flt);
+    DEBUG(flt, "Group %p will run after group %p", after, group);
+    (void) cork_uint_atomic_add(&after->join_count, 1);
+    edge->after = after;
+    edge->next = ctx->after;
+    ctx->after = edge;
+}
+
+void
+flt_task_group_run_after_current(struct flt *pflt, struct flt_task_group *after)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    flt_task_group_run_after(pflt, flt_current_group(flt), after);
+}
+
+void
+flt_task_group_run_after_all(struct flt *flt, struct flt_task_group **groups,
+                             size_t group_count, struct flt_task_group *after)
+{
+    size_t  i;
+    for (i = 0; i < group_count; i++) {
+        flt_task_group_run_after(flt, groups[i], after);
+    }
+}
+
+void
+flt_task_group_cancel(struct flt *pflt, struct flt_task_group *group,
+                      enum flt_cancel_policy policy)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    DEBUG(flt, "Cancel task group %p", group);
+    group->cancel_policy = policy;
+    flt_write_barrier();
+    group->cancelled = true;
+}
+
+void
+flt_task_group_cancel_current(struct flt *pflt, enum flt_cancel_policy policy)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    flt_task_group_cancel(pflt, flt_current_group(flt), policy);
+}
+
+int
+flt_task_group_is_cancelled(struct flt *pflt, struct flt_task_group *group)
+{
+    return group->cancelled;
+}
+
+int
+flt_is_cancelled(struct flt *pflt)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    return flt->current->group->cancelled;
+}
+
+/* Move one of `group`'s tasks from `from`'s share of the group to ours.  We
+ * must bump our own count first, so that the group's active context count
+ * never drops to zero in between; that also means that the decrement can never
+ * finish the group. */
+static void
+flt_task_group_move(struct flt_priv *flt, struct flt_task_group *group,
+                    struct flt_priv *from)
+{
+    struct flt_task_group_ctx  *from_ctx = group->ctxs[from->public.index];
+    flt_task_group_increment(flt, group);
+    (void) flt_task_group_ctx_sub(group, from_ctx, 1);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Execution contexts
+ */
+
+static int
+flt__thread_run(struct cork_thread_body *body);
+
+static void
+flt__thread_free(struct cork_thread_body *body)
+{
+    /* Nothing to do */
+}
+
+struct flt_priv *
+flt_new(struct flt_fleet *fleet, size_t index, size_t count,
+        const struct flt_cpu *cpu)
+{
+    struct flt_priv  *flt =
+        flt_node_alloc(&fleet->topology, cpu->node, sizeof(struct flt_priv));
+    flt_deque_init(&flt->ready, &fleet->topology, cpu->node);
+    flt->public.index = index;
+    flt->public.count = count;
+    flt->fleet = fleet;
+    flt->public.new_task = flt_create_task;
+    flt->current = NULL;
+    cork_dllist_init(&flt->unused);
+    cork_dllist_init(&flt->batches);
+    flt->unused_count = 0;
+    flt->foreign = NULL;
+    flt->foreign_count = 0;
+    flt->returned_tasks = NULL;
+    cork_dllist_init(&flt->groups);
+    flt->unused_groups = NULL;
+    flt->unused_group_count = 0;
+    flt->group_ctxs.unused = NULL;
+    flt->group_ctxs.batches = NULL;
+    flt->edges.unused = NULL;
+    flt->edges.batches = NULL;
+    flt->futures.unused = NULL;
+    flt->futures.batches = NULL;
+    flt->channel_batches.unused = NULL;
+    flt->channel_batches.batches = NULL;
+    flt->pending_channels = NULL;
+    flt->fiber = NULL;
+    flt->native = NULL;
+    flt->spare = false;
+    flt->unused_fibers = NULL;
+    flt->fibers = NULL;
+    flt->resumed = NULL;
+    flt->ready_fibers = NULL;
+    flt->waiting_fibers = 0;
+    cork_dllist_init(&flt->detached);
+    flt->held = true;
+    flt->next_ticket = 0;
+    flt->now_serving = 0;
+    flt->reattach_waiting = 0;
+    flt->body.run = flt__thread_run;
+    flt->body.free = flt__thread_free;
+    flt->active = false;
+    flt->published_load = 0;
+    flt_timer_wheel_init(&flt->timers);
+    flt->timer_countdown = 1;
+    flt->cpu = cpu;
+    flt->victims = NULL;
+    flt->rng = index + 1;
+#if FLT_MEASURE_TIMING
+    memset(&flt->timing, 0, sizeof(flt->timing));
+#endif
+    return flt;
+}
+
+static void
+flt_task_batch_list_done(struct flt_priv *flt, struct cork_dllist *list)
+{
+    struct cork_dllist_item  *curr;
+    struct cork_dllist_item  *next;
+    struct flt_task_batch  *batch;
+    cork_dllist_foreach(list, curr, next, struct flt_task_batch, batch, item) {
+        flt_task_batch_free(flt, batch);
+    }
+}
+
+static void
+flt_task_group_list_done(struct flt_priv *flt, struct cork_dllist *list)
+{
+    struct cork_dllist_item  *curr;
+    struct cork_dllist_item  *next;
+    struct flt_task_group  *group;
+    cork_dllist_foreach(list, curr, next, struct flt_task_group, group, item) {
+        flt_task_group_recycle(flt, group);
+    }
+}
+
+static void
+flt_fiber_list_done(struct flt_priv *flt)
+{
+    struct flt_fiber  *fiber = flt->fibers;
+    while (fiber != NULL) {
+        struct flt_fiber  *sibling = fiber->sibling;
+        flt_fiber_free(fiber);
+        fiber = sibling;
+    }
+}
+
+void
+flt_free(struct flt_priv *flt)
+{
+    flt_fiber_list_done(flt);
+    flt_task_batch_list_done(flt, &flt->batches);
+    flt_task_group_pool_done(flt);
+    flt_slab_done(flt, &flt->group_ctxs);
+    flt_slab_done(flt, &flt->edges);
+    flt_slab_done(flt, &flt->futures);
+    flt_slab_done(flt, &flt->channel_batches);
+    flt_deque_done(&flt->ready);
+    free(flt->victims);
+    flt_node_free(&flt->fleet->topology, flt, sizeof(struct flt_priv));
+}
+
+struct flt_task *
+flt_current_task(struct flt_priv *flt)
+{
+    return flt->current;
+}
+
+struct flt_task_group *
+flt_current_group(struct flt_priv *flt)
 {
     struct flt_task  *task = flt_current_task(flt);
     return task->group;
 }
 
 
-/*-----------------------------------------------------------------------
- * Fleet scheduler
- */
+/*-----------------------------------------------------------------------
+ * Timers
+ */
+
+/* A task that's waiting in a context's timer wheel is counted in its group's
+ * `task_count` for that context, just like a ready task, so the group (and
+ * anything that runs after it) can't finish until the task has fired and run.
+ * Only the context itself touches its wheel.  It moves expired tasks into its
+ * ready deque every FLT_TIMER_CHECK_INTERVAL tasks while it's busy, and on
+ * every attempt to steal while it's idle; a parked context only sleeps until
+ * the wheel's next event.  Reading the clock isn't free, so a busy context
+ * doesn't check after every task. */
+
+#define FLT_TIMER_CHECK_INTERVAL  64
+
+/* Adds a task to our timer wheel.  We must be active, and the task must
+ * already be counted in our share of its group. */
+static void
+flt_timer_add(struct flt_priv *flt, struct flt_task *task, uint64_t now)
+{
+    if (flt_timer_wheel_add(&flt->timers, task, now)) {
+        DEBUG(flt, "Schedule %s [%zu,%zu) for %" PRIu64,
+              task->name, task->min, task->max, task->deadline);
+        if (flt->timers.count == 1) {
+            /* We're active, so this can't be the first arrival. */
+            flt_snzi_arrive(flt->active_leaf);
+        }
+    } else {
+        flt_deque_push_bottom(&flt->ready, task);
+        flt_announce_tasks(flt);
+    }
+}
+
+static void
+flt_run_timer(struct flt *pflt, struct flt_task *task,
+              uint64_t deadline, uint64_t period, uint64_t now)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_task_group  *current_group = flt_current_group(flt);
+    struct flt_task_group_ctx  *ctx =
+        flt_task_group_get_ctx(flt, current_group);
+    task->group = current_group;
+    task->deadline = deadline;
+    task->period = period;
+    /* See flt_run for why we don't need to check active_ctx_count. */
+    cork_size_atomic_add(&ctx->task_count, 1);
+    flt_timer_add(flt, task, now);
+}
+
+void
+flt_run_at(struct flt *flt, uint64_t when, struct flt_task *task)
+{
+    flt_run_timer(flt, task, when, 0, flt_timer_now());
+}
+
+void
+flt_run_after_delay(struct flt *flt, uint64_t delay, struct flt_task *task)
+{
+    uint64_t  now = flt_timer_now();
+    flt_run_timer(flt, task, now + delay, 0, now);
+}
+
+void
+flt_run_periodic_at(struct flt *flt, uint64_t when, uint64_t period,
+                    struct flt_task *task)
+{
+    flt_run_timer(flt, task, when, period, flt_timer_now());
+}
+
+void
+flt_run_periodic_after_delay(struct flt *flt, uint64_t delay, uint64_t period,
+                             struct flt_task *task)
+{
+    uint64_t  now = flt_timer_now();
+    flt_run_timer(flt, task, now + delay, period, now);
+}
+
+void
+flt_stop_periodic(struct flt *pflt)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    flt->current->period = 0;
+}
+
+/* Moves any expired timers into our ready deque.  Returns true if there were
+ * any. */
+static bool
+flt_expire_timers(struct flt_priv *flt)
+{
+    struct cork_dllist  expired;
+    struct cork_dllist_item  *curr;
+    struct cork_dllist_item  *next;
+    struct flt_task  *task;
+
+    if (CORK_LIKELY(flt->timers.count == 0)) {
+        return false;
+    }
+    cork_dllist_init(&expired);
+    flt_timer_wheel_advance(&flt->timers, flt_timer_now(), &expired);
+    if (cork_dllist_is_empty(&expired)) {
+        return false;
+    }
+
+    /* Become active before releasing the arrival that the timers were holding,
+     * so that the fleet can't look finished in between. */
+    if (!flt->active) {
+        flt_snzi_arrive(flt->active_leaf);
+        flt->active = true;
+    }
+    cork_dllist_foreach(&expired, curr, next, struct flt_task, task, item) {
+        DEBUG(flt, "Timer for %s [%zu,%zu) expired",
+              task->name, task->min, task->max);
+        flt_deque_push_bottom(&flt->ready, task);
+    }
+    if (flt->timers.count == 0) {
+        (void) flt_snzi_depart(flt->active_leaf);
+    }
+    flt_announce_tasks(flt);
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Futures
+ */
+
+/* A continuation that's waiting for a future is counted in its group's
+ * `task_count` for the context that registered it, just like a timer, so the
+ * group can't finish before the continuation has run.  Whichever context
+ * completes the future takes over the count when it moves the continuation
+ * into its own ready deque.  No thread ever blocks waiting for a future. */
+
+struct flt_future *
+flt_future_new(struct flt *pflt)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_future  *future =
+        flt_slab_alloc(flt, &flt->futures, sizeof(struct flt_future));
+    future->waiting = NULL;
+    future->value = NULL;
+    future->pending = 0;
+    future->ref_count = 1;
+    return future;
+}
+
+void
+flt_future_free(struct flt *pflt, struct flt_future *future)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    if (cork_uint_atomic_sub(&future->ref_count, 1) == 0) {
+        flt_slab_free(&flt->futures, future);
+    }
+}
+
+void
+flt_future_set(struct flt *pflt, struct flt_future *future, void *value)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct cork_dllist_item  *head;
+
+    future->value = value;
+    do {
+        head = future->waiting;
+        if (CORK_UNLIKELY(head == FLT_FUTURE_SET)) {
+            fprintf(stderr, "fleet: Future %p was already completed\n",
+                    future);
+            abort();
+        }
+    } while (!__sync_bool_compare_and_swap
+             (&future->waiting, head, FLT_FUTURE_SET));
+
+    /* Nothing else can be pushed onto the stack now, and we mustn't touch
+     * `future` again, since one of its continuations might free it as soon as
+     * it's been stolen. */
+    if (head == NULL) {
+        return;
+    }
+    while (head != NULL) {
+        struct flt_task  *task = cork_container_of(head, struct flt_task, item);
+        head = head->next;
+        DEBUG(flt, "Future %p completed; run %s [%zu,%zu)",
+              future, task->name, task->min, task->max);
+        task->value = value;
+        flt_task_group_move(flt, task->group, task->waiting_in);
+        flt_deque_push_bottom(&flt->ready, task);
+    }
+    flt_announce_tasks(flt);
+}
+
+int
+flt_future_is_set(struct flt *flt, struct flt_future *future)
+{
+    bool  result = (future->waiting == FLT_FUTURE_SET);
+    flt_read_barrier();
+    return result;
+}
+
+void *
+flt_future_get(struct flt *flt, struct flt_future *future)
+{
+    return future->value;
+}
+
+void *
+flt_future_value(struct flt *pflt)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    return flt->current->value;
+}
+
+void
+flt_then(struct flt *pflt, struct flt_future *future, struct flt_task *task)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_task_group  *current_group = flt_current_group(flt);
+    struct flt_task_group_ctx  *ctx =
+        flt_task_group_get_ctx(flt, current_group);
+    struct cork_dllist_item  *head;
+
+    task->group = current_group;
+    task->waiting_in = flt;
+    /* See flt_run for why we don't need to check active_ctx_count. */
+    cork_size_atomic_add(&ctx->task_count, 1);
+    do {
+        head = future->waiting;
+        if (head == FLT_FUTURE_SET) {
+            /* The count that we just added now belongs to a ready task. */
+            flt_read_barrier();
+            task->value = future->value;
+            flt_deque_push_bottom(&flt->ready, task);
+            flt_announce_tasks(flt);
+            return;
+        }
+        task->item.next = head;
+    } while (!__sync_bool_compare_and_swap(&future->waiting, head, &task->item));
+    DEBUG(flt, "%s [%zu,%zu) waits for future %p",
+          task->name, task->min, task->max, future);
+}
+
+/* Each input of a combinator gets a continuation that holds a reference to the
+ * combinator's result. */
+static void
+flt_when_all__step(struct flt *flt, void *ud, size_t i)
+{
+    struct flt_future  *result = ud;
+    if (cork_size_atomic_sub(&result->pending, 1) == 0) {
+        flt_future_set(flt, result, NULL);
+    }
+    flt_future_free(flt, result);
+}
+
+static void
+flt_when_any__step(struct flt *flt, void *ud, size_t i)
+{
+    struct flt_future  *result = ud;
+    if (__sync_bool_compare_and_swap(&result->pending, 1, 0)) {
+        flt_future_set(flt, result, flt_future_value(flt));
+    }
+    flt_future_free(flt, result);
+}
+
+static struct flt_future *
+flt_future_combine(struct flt *flt, struct flt_future **futures,
+                   size_t future_count, size_t pending, flt_task *step)
+{
+    size_t  i;
+    struct flt_future  *result = flt_future_new(flt);
+    if (future_count == 0) {
+        flt_future_set(flt, result, NULL);
+        return result;
+    }
+    result->pending = pending;
+    result->ref_count += future_count;
+    for (i = 0; i < future_count; i++) {
+        struct flt_task  *task =
+            flt->new_task(flt, "flt_future_combine", step, result, i, i + 1);
+        flt_then(flt, futures[i], task);
+    }
+    return result;
+}
+
+struct flt_future *
+flt_when_all(struct flt *flt, struct flt_future **futures, size_t future_count)
+{
+    return flt_future_combine
+        (flt, futures, future_count, future_count, flt_when_all__step);
+}
+
+struct flt_future *
+flt_when_any(struct flt *flt, struct flt_future **futures, size_t future_count)
+{
+    return flt_future_combine
+        (flt, futures, future_count, 1, flt_when_any__step);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Channels
+ */
+
+static void
+flt_channel_slot_init(struct flt *flt, void *ud, void *vslot)
+{
+    struct flt_channel_slot  *slot = vslot;
+    slot->channel = ud;
+    slot->batches[0] = NULL;
+    slot->batches[1] = NULL;
+    slot->next = NULL;
+    slot->pending = false;
+}
+
+static void
+flt_channel_slot_done(struct flt *flt, void *ud, void *vslot)
+{
+    /* nothing to do */
+}
+
+struct flt_channel *
+flt_channel_new(struct flt *flt, flt_task *receiver, void *ud)
+{
+    struct flt_channel  *channel = cork_new(struct flt_channel);
+    channel->receiver = receiver;
+    channel->ud = ud;
+    channel->flt = flt;
+    channel->slots = flt_local_new
+        (flt, struct flt_channel_slot, channel,
+         flt_channel_slot_init, flt_channel_slot_done);
+    return channel;
+}
+
+void
+flt_channel_free(struct flt_channel *channel)
+{
+    flt_local_free(channel->flt, channel->slots);
+    free(channel);
+}
+
+static void
+flt_channel_deliver(struct flt *pflt, void *ud, size_t min, size_t max)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_channel_batch  *batch = ud;
+    struct flt_channel  *channel = batch->channel;
+    struct flt_channel_data  data;
+    size_t  i;
+
+    data.ud = channel->ud;
+    for (i = min; i < max; i++) {
+        data.data = batch->data[i];
+        channel->receiver(pflt, &data, 0);
+    }
+    if (__sync_sub_and_fetch(&batch->remaining, max - min) == 0) {
+        flt_slab_free(&flt->channel_batches, batch);
+    }
+}
+
+static void
+flt_channel_schedule(struct flt_priv *flt, struct flt_channel_slot *slot,
+                     bool later)
+{
+    struct flt_channel_batch  *batch = slot->batches[later];
+    struct flt_task  *task = flt_range_task_new
+        (&flt->public, flt_channel_deliver, batch, 0, batch->count);
+    DEBUG(flt, "Deliver %zu messages to channel %p",
+          batch->count, slot->channel);
+    slot->batches[later] = NULL;
+    batch->remaining = batch->count;
+    if (batch->later) {
+        flt_run_later(&flt->public, task);
+    } else {
+        flt_run(&flt->public, task);
+    }
+}
+
+/* Schedules any batches that the current task has sent.  We have to do this
+ * before the task finishes (or lets some other task run in this context),
+ * since the batches belong to the task's group. */
+static void
+flt_channel_flush_(struct flt_priv *flt)
+{
+    struct flt_channel_slot  *slot = flt->pending_channels;
+    flt->pending_channels = NULL;
+    while (slot != NULL) {
+        struct flt_channel_slot  *next = slot->next;
+        if (slot->batches[false] != NULL) {
+            flt_channel_schedule(flt, slot, false);
+        }
+        if (slot->batches[true] != NULL) {
+            flt_channel_schedule(flt, slot, true);
+        }
+        slot->pending = false;
+        slot = next;
+    }
+}
+
+#define flt_channel_flush(flt) \
+    do { \
+        if (CORK_UNLIKELY((flt)->pending_channels != NULL)) { \
+            flt_channel_flush_((flt)); \
+        } \
+    } while (0)
+
+static void
+flt_channel_add(struct flt_channel *channel, struct flt *pflt, void *data,
+                bool later)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_channel_slot  *slot =
+        flt_local_get(pflt, channel->slots, struct flt_channel_slot);
+    struct flt_channel_batch  *batch = slot->batches[later];
+
+    if (CORK_UNLIKELY(batch == NULL)) {
+        batch = flt_slab_alloc
+            (flt, &flt->channel_batches, FLT_CHANNEL_BATCH_SIZE);
+        batch->channel = channel;
+        batch->count = 0;
+        batch->later = later;
+        slot->batches[later] = batch;
+        if (!slot->pending) {
+            slot->pending = true;
+            slot->next = flt->pending_channels;
+            flt->pending_channels = slot;
+        }
+    }
+
+    batch->data[batch->count++] = data;
+    if (CORK_UNLIKELY(batch->count == FLT_CHANNEL_BATCH_CAPACITY)) {
+        flt_channel_schedule(flt, slot, later);
+    }
+}
+
+void
+flt_channel_send(struct flt_channel *channel, struct flt *flt, void *data)
+{
+    flt_channel_add(channel, flt, data, false);
+}
+
+void
+flt_channel_send_later(struct flt_channel *channel, struct flt *flt,
+                       void *data)
+{
+    flt_channel_add(channel, flt, data, true);
+}
+
+void
+flt_channel_return_to(struct flt_channel *channel, struct flt *flt,
+                      void *data)
+{
+    struct flt_channel_data  cdata;
+    cdata.ud = channel->ud;
+    cdata.data = data;
+    channel->receiver(flt, &cdata, 0);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Fibers
+ */
+
+/* When the fleet runs tasks in fibers, a context's scheduler loop always runs
+ * in one of the context's fibers, never on a thread's original stack.  When a
+ * task waits for a group, we leave its fiber where it is, and continue the
+ * scheduler loop in a fresh fiber from the context's pool.  Once the group
+ * finishes, whichever context finished it hands the waiting fiber back to us,
+ * and the next time our scheduler loop is in between tasks, it switches over to
+ * the waiting fiber.  At that point, there's nothing on the loop's own stack
+ * that we need to come back to, so we return its fiber to the pool right away;
+ * the resumed fiber finishes its task and continues the loop from there.
+ *
+ * A fiber only ever runs in the context that allocated it, so the `flt` that a
+ * waiting task was given is still the right one once it resumes, and no
+ * context ever allocates or frees another context's stacks.  A fiber can
+ * resume in a different thread than the one that it started in, though, if
+ * the context was handed over to some other thread in the meantime. */
+
+/* 256Kb */
+#define FLT_FIBER_STACK_SIZE  (256 * 1024)
+
+static void
+flt_run_loop(struct flt_priv *flt);
+
+/* The scheduler loop returns once the fleet has run out of tasks, or once the
+ * current thread has to give up the context.  Either way, the thread has to get
+ * back to its own stack. */
+static void
+flt_fiber__loop(void *ud)
+{
+    struct flt_priv  *flt = ud;
+    struct flt_fiber  *fiber;
+    flt_run_loop(flt);
+    fiber = flt->fiber;
+    flt->fiber = NULL;
+    fiber->next = flt->unused_fibers;
+    flt->unused_fibers = fiber;
+    flt_fiber_switch(fiber, flt->native);
+}
+
+/* Returns a fiber that will run our scheduler loop from the top. */
+static struct flt_fiber *
+flt_fiber_take(struct flt_priv *flt)
+{
+    struct flt_fiber  *fiber = flt->unused_fibers;
+    if (fiber == NULL) {
+        struct flt_fleet  *fleet = flt->fleet;
+        fiber = flt_fiber_new
+            (&fleet->topology, flt->cpu->node, fleet->fiber_stack_size);
+        DEBUG(flt, "New fiber %p", fiber);
+        fiber->flt = flt;
+        fiber->sibling = flt->fibers;
+        flt->fibers = fiber;
+    } else {
+        flt->unused_fibers = fiber->next;
+    }
+    flt_fiber_prepare(fiber, flt_fiber__loop, flt);
+    return fiber;
+}
+
+/* Moves any fibers that other contexts have resumed into our ready list.
+ * Returns true if there are any fibers that we can switch to. */
+static bool
+flt_reap_fibers(struct flt_priv *flt)
+{
+    struct flt_fiber  *fiber;
+
+    if (CORK_LIKELY(flt->resumed == NULL)) {
+        return flt->ready_fibers != NULL;
+    }
+    fiber = __sync_lock_test_and_set(&flt->resumed, NULL);
+
+    /* Become active before releasing the arrivals that the fibers were
+     * holding, so that the fleet can't look finished in between. */
+    if (!flt->active) {
+        flt_snzi_arrive(flt->active_leaf);
+        flt->active = true;
+    }
+    while (fiber != NULL) {
+        struct flt_fiber  *next = fiber->next;
+        fiber->next = flt->ready_fibers;
+        flt->ready_fibers = fiber;
+        flt->waiting_fibers--;
+        (void) flt_snzi_depart(flt->active_leaf);
+        fiber = next;
+    }
+    return true;
+}
+
+/* Switches to the next fiber in our ready list.  Must be called from the top
+ * of the scheduler loop, with the context active; the current fiber goes back
+ * into the pool, and we never switch back into it. */
+static void
+flt_resume_fiber(struct flt_priv *flt)
+{
+    struct flt_fiber  *current = flt->fiber;
+    struct flt_fiber  *fiber = flt->ready_fibers;
+    flt->ready_fibers = fiber->next;
+    current->next = flt->unused_fibers;
+    flt->unused_fibers = current;
+    DEBUG(flt, "Switch to fiber %p", fiber);
+    flt->fiber = fiber;
+    flt_fiber_switch(current, fiber);
+}
+
+void
+flt_task_group_wait(struct flt *pflt, struct flt_task_group *group)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_task  *task = flt->current;
+    struct flt_fiber  *fiber = flt->fiber;
+    struct flt_fiber  *head;
+
+    if (CORK_UNLIKELY(fiber == NULL)) {
+        fprintf(stderr, "fleet: Can only wait for task groups in fibers\n");
+        abort();
+    }
+    if (CORK_UNLIKELY(group == task->group)) {
+        fprintf(stderr, "fleet: Task cannot wait for its own group\n");
+        abort();
+    }
+
+    /* Other tasks will run in this context while we're waiting */
+    flt_channel_flush(flt);
+
+    do {
+        head = group->waiters;
+        if (head == FLT_TASK_GROUP_NO_WAITERS) {
+            DEBUG(flt, "Group %p has already finished", group);
+            flt_read_barrier();
+            return;
+        }
+        fiber->next = head;
+    } while (!__sync_bool_compare_and_swap(&group->waiters, head, fiber));
+
+    /* Only this context can switch back into our fiber, and it can't do that
+     * until it's back in its scheduler loop, so there's no race between the
+     * group finishing and us switching away. */
+    DEBUG(flt, "Fiber %p waits for group %p", fiber, group);
+    flt->waiting_fibers++;
+    flt->fiber = flt_fiber_take(flt);
+    flt_fiber_switch(fiber, flt->fiber);
+    flt->current = task;
+    DEBUG(flt, "Fiber %p resumes after group %p", fiber, group);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Fleet scheduler
+ */
+
+void
+flt_run(struct flt *pflt, struct flt_task *task)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_task_group  *current_group = flt_current_group(flt);
+    struct flt_task_group_ctx  *ctx =
+        flt_task_group_get_ctx(flt, current_group);
+
+    DEBUG(flt, "Add %s [%zu,%zu) to current group %p",
+          task->name, task->min, task->max, current_group);
+    task->group = current_group;
+
+    /* The current execution context must already be active for the current task
+     * group (again, because there's already a task that was ready in this group
+     * in this context).  So we never need to bump the groups active_ctx_count
+     * field.  We do have to bump our count before the task can be stolen,
+     * though. */
+    cork_size_atomic_add(&ctx->task_count, 1);
+
+    /* The current task's group must already be running (otherwise how would we
+     * have started the current task?), so we can add the task directly to the
+     * context's ready deque, instead of adding it to the group. */
+    flt_deque_push_bottom(&flt->ready, task);
+    flt_announce_tasks(flt);
+}
+
+void
+flt_run_later(struct flt *pflt, struct flt_task *task)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_task_group  *current_group = flt_current_group(flt);
+    struct flt_task_group_ctx  *ctx =
+        flt_task_group_get_ctx(flt, current_group);
+
+    DEBUG(flt, "Add %s [%zu,%zu) to end of current group %p",
+          task->name, task->min, task->max, current_group);
+    task->group = current_group;
+
+    /* See flt_run for why we don't need to check active_ctx_count. */
+    cork_size_atomic_add(&ctx->task_count, 1);
+
+    /* Tasks at the top of the deque are the last ones that we'll execute
+     * ourselves (and the first ones that thieves will steal). */
+    flt_deque_push_top(&flt->ready, task);
+    flt_announce_tasks(flt);
+}
+
+
+/* The maximum number of iterations of a bulk task that we'll execute before
+ * giving thieves another chance to steal the rest of it. */
+#define FLT_ROUND_SIZE  256
+
+/* Splits off the upper half of `task`'s remaining iterations (starting at
+ * `min`) into a new task, and pushes it onto our deque, where other contexts
+ * can steal it. */
+static void
+flt_task_split(struct flt_priv *flt, struct flt_task *task, size_t min)
+{
+    size_t  max = task->max;
+    size_t  mid = min + (max - min) / 2;
+    struct flt_task  *new_task = flt->public.new_task
+        (&flt->public, task->name, task->func, task->ud, mid, max);
+    DEBUG(flt, "Split %s [%zu,%zu) from [%zu,%zu)",
+          task->name, mid, max, min, max);
+    if (task->ud == task->data) {
+        /* Each half gets its own copy of any inline arguments. */
+        memcpy(new_task->data, task->data, FLT_TASK_DATA_SIZE);
+        new_task->ud = new_task->data;
+    }
+    new_task->range_func = task->range_func;
+    /* This also copies `io_result`, which shares storage with `value`. */
+    new_task->value = task->value;
+    new_task->group = task->group;
+    flt_task_group_increment(flt, task->group);
+    flt_deque_push_bottom(&flt->ready, new_task);
+    task->max = mid;
+}
+
+/* Periodic tasks are never split, since we need the whole task to put back
+ * into our timer wheel once it's done.  We reschedule it relative to its
+ * previous deadline, so that it doesn't drift; if we've fallen behind, we skip
+ * any runs that we've missed. */
+static void
+flt_run_periodic(struct flt_priv *flt, struct flt_task *task)
+{
+    uint64_t  now;
+
+    flt->current = task;
+    DEBUG(flt, "Run periodic task %s [%zu,%zu)",
+          task->name, task->min, task->max);
+    flt_task_run_range(&flt->public, task, task->min, task->max);
+    flt_channel_flush(flt);
+    if (task->period == 0 || task->group->cancelled) {
+        flt_task_group_decrement(flt, task->group);
+        flt_task_free(flt, task);
+        return;
+    }
+
+    now = flt_timer_now();
+    task->deadline += task->period;
+    if (task->deadline < now) {
+        task->deadline +=
+            (now - task->deadline + task->period - 1) / task->period *
+            task->period;
+    }
+    flt_timer_add(flt, task, now);
+}
+
+/* Runs a task that we just popped off of our ready deque. */
+static void
+flt_run_one(struct flt_priv *flt, struct flt_task *task)
+{
+    size_t  i;
+    size_t  min = task->min;
+
+    if (CORK_UNLIKELY(task->group->cancelled)) {
+        DEBUG(flt, "Discard task %s [%zu,%zu) from cancelled group %p",
+              task->name, min, task->max, task->group);
+        flt_task_group_decrement(flt, task->group);
+        flt_task_free(flt, task);
+        return;
+    }
+    if (CORK_UNLIKELY(task->period != 0)) {
+        flt_run_periodic(flt, task);
+        return;
+    }
+
+    flt->current = task;
+    if (flt->fleet->split_policy == FLT_SPLIT_LAZY) {
+        /* Only split when no one could steal anything else from us: run the
+         * task in rounds, and at the start of each round, if our deque is
+         * empty, expose the upper half of whatever's left.  If no one steals
+         * it, we'll pop it back off and keep going, having created far fewer
+         * tasks than the eager strategy.  If someone does steal it, they get a
+         * large contiguous range, and we find out on the next round that we
+         * should split again. */
+        i = min;
+        DEBUG(flt, "Run task %s [%zu,%zu)", task->name, min, task->max);
+        while (i < task->max && !task->group->cancelled) {
+            size_t  round_end;
+            if (task->max - i > FLT_ROUND_SIZE && flt->public.count > 1 &&
+                flt_deque_is_empty(&flt->ready)) {
+                flt_task_split(flt, task, i);
+                flt_announce_tasks(flt);
+            }
+            round_end = (task->max - i > FLT_ROUND_SIZE)?
+                i + FLT_ROUND_SIZE: task->max;
+            flt_task_run_range(&flt->public, task, i, round_end);
+            i = round_end;
+        }
+    } else {
+        /* If this is a bulk task with more iterations than we want to execute
+         * in one go, split off the upper half into a new task and push it back
+         * onto our deque, where other contexts can steal it.  Keep splitting
+         * until the lower half is small enough to execute; that leaves a series
+         * of ranges in the deque that get larger as you get closer to the top,
+         * so thieves will steal the largest ones. */
+        size_t  max = task->max;
+        while (task->max - min > FLT_ROUND_SIZE) {
+            flt_task_split(flt, task, min);
+        }
+        if (max != task->max) {
+            flt_announce_tasks(flt);
+        }
+        DEBUG(flt, "Run task %s [%zu,%zu)", task->name, min, task->max);
+        flt_task_run_range(&flt->public, task, min, task->max);
+    }
+    flt_channel_flush(flt);
+    flt_task_group_decrement(flt, task->group);
+    flt_task_free(flt, task);
+}
+
+/* Tries to steal a task from a particular context.  If we succeed, the stolen
+ * task will be in our ready deque, and this context will be active again. */
+static bool
+flt_steal_from(struct flt_priv *flt, unsigned int steal_index)
+{
+    struct flt_priv  *steal_from = flt->fleet->contexts[steal_index];
+    struct flt_task  *task;
+
+    /* Is there anything to steal?  If not, give up. */
+    if (flt_deque_is_empty(&steal_from->ready)) {
+        DEBUG(flt, "Not going to steal from empty context %u", steal_index);
+        return false;
+    }
+
+    /* We have to become active before the steal succeeds; see the comment for
+     * struct flt_priv for details. */
+    DEBUG(flt, "Steal from context %u", steal_index);
+    flt_measure_time(flt, choosing_to_steal);
+    flt_snzi_arrive(flt->active_leaf);
+    task = flt_deque_steal(&steal_from->ready);
+    if (task == NULL) {
+        /* Someone beat us to it.  If that makes the active count drop to zero,
+         * the main loop will notice. */
+        DEBUG(flt, "Lost race to steal from context %u", steal_index);
+        if (flt_snzi_depart(flt->active_leaf)) {
+            flt_fleet_wake_all(flt->fleet);
+        }
+        flt_measure_time(flt, stealing);
+        return false;
+    }
+
+    DEBUG(flt, "Steal %s [%zu,%zu) from context %u",
+          task->name, task->min, task->max, steal_index);
+    flt_task_group_move(flt, task->group, steal_from);
+    flt_deque_push_bottom(&flt->ready, task);
+    flt_publish_load(flt, 1);
+    flt->active = true;
+    flt_measure_time(flt, stealing);
+    return true;
+}
+
+/* A xorshift generator; we only need it to be fast and to differ between
+ * contexts. */
+static uint32_t
+flt_random(struct flt_priv *flt)
+{
+    uint32_t  x = flt->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    flt->rng = x;
+    return x;
+}
+
+/* Tries to steal a task from some other context, starting with the contexts
+ * that are closest to us in the machine's memory hierarchy, and working
+ * outwards.  Within each tier, we use the load board to pick the more loaded
+ * of two random victims; if neither of them has anything, we scan the rest of
+ * the tier's board for any victim that does.  We only probe the deques of
+ * victims whose board entry says they have something to steal. */
+static bool
+flt_steal(struct flt_priv *flt)
+{
+    const volatile uint8_t  *load = flt->fleet->load_board;
+    unsigned int  tier;
+    unsigned int  tier_start = 0;
+    for (tier = 0; tier < FLT_TIER_COUNT; tier++) {
+        unsigned int  tier_end = flt->victim_tier_end[tier];
+        unsigned int  tier_size = tier_end - tier_start;
+        if (tier_size > 0) {
+            const unsigned int  *victims = flt->victims + tier_start;
+            unsigned int  offset = flt_random(flt) % tier_size;
+            unsigned int  first = victims[offset];
+            unsigned int  second = victims[flt_random(flt) % tier_size];
+            unsigned int  best = (load[second] > load[first])? second: first;
+            unsigned int  i;
+
+            if (load[best] > 0 && flt_steal_from(flt, best)) {
+                return true;
+            }
+            for (i = 0; i < tier_size; i++) {
+                unsigned int  victim = victims[(offset + i) % tier_size];
+                if (victim != best && load[victim] > 0 &&
+                    flt_steal_from(flt, victim)) {
+                    return true;
+                }
+            }
+        }
+        tier_start = tier_end;
+    }
+    return false;
+}
+
+/* The I/O backend's completion thread can't touch any context's deque, so it
+ * pushes each finished operation onto the fleet's `io_completed` stack instead,
+ * and wakes up a context to deal with it.  Idle contexts check the stack before
+ * trying to steal, and take the whole thing at once. */
+void
+flt_fleet_io_complete(struct flt_fleet *fleet, struct flt_io_request *req)
+{
+    struct flt_io_request  *head;
+    do {
+        head = fleet->io_completed;
+        req->next = head;
+    } while (!__sync_bool_compare_and_swap(&fleet->io_completed, head, req));
+    flt_fleet_wake_one(fleet);
+}
+
+/* Moves the continuations of any finished I/O operations into our ready deque.
+ * Returns true if there were any. */
+static bool
+flt_reap_io(struct flt_priv *flt)
+{
+    struct flt_fleet  *fleet = flt->fleet;
+    struct flt_io_request  *req;
+
+    if (CORK_LIKELY(fleet->io_completed == NULL)) {
+        return false;
+    }
+    req = __sync_lock_test_and_set(&fleet->io_completed, NULL);
+    if (req == NULL) {
+        return false;
+    }
+
+    /* Become active before releasing the arrivals that the operations were
+     * holding, so that the fleet can't look finished in between. */
+    if (!flt->active) {
+        flt_snzi_arrive(flt->active_leaf);
+        flt->active = true;
+    }
+    while (req != NULL) {
+        struct flt_io_request  *next = req->next;
+        struct flt_task  *task = req->task;
+        DEBUG(flt, "I/O for %s finished with %zd", task->name, req->result);
+        task->io_result = req->result;
+        flt_task_group_move(flt, task->group, req->flt);
+        flt_deque_push_bottom(&flt->ready, task);
+        (void) flt_snzi_depart(req->flt->active_leaf);
+        free(req);
+        req = next;
+    }
+    flt_announce_tasks(flt);
+    return true;
+}
+
+/* Jobs that are submitted from outside of the fleet go through the same kind of
+ * stack.  Each job holds an arrival at the root of the fleet's active indicator
+ * until a context has started its root group. */
+static bool
+flt_reap_jobs(struct flt_priv *flt)
+{
+    struct flt_fleet  *fleet = flt->fleet;
+    struct flt_job  *job;
+
+    flt_recycle_retired_groups(flt);
+    if (CORK_LIKELY(fleet->injected == NULL)) {
+        return false;
+    }
+    job = __sync_lock_test_and_set(&fleet->injected, NULL);
+    if (job == NULL) {
+        return false;
+    }
+
+    /* The stack has the newest job first.  Each job's root task ends up at the
+     * bottom of our deque, so the oldest job is the one that we run first. */
+    while (job != NULL) {
+        struct flt_job  *next = job->next;
+        struct flt_task_group  *group = flt_task_group_new_in_job(flt, job);
+        struct flt_task  *task = flt->public.new_task
+            (&flt->public, job->name, job->func, job->ud, job->i, job->i + 1);
+        DEBUG(flt, "Start job %p", job);
+        (void) cork_size_atomic_sub(&fleet->queue_depth, 1);
+        flt_task_group_add(&flt->public, group, task);
+        flt_task_group_start(&flt->public, group);
+        /* We're active now, so this can't be the last departure. */
+        (void) flt_snzi_depart(&fleet->active);
+        job = next;
+    }
+    return true;
+}
+
+static void
+flt_context_acquire(struct flt_priv *flt);
+
+static void
+flt_context_release(struct flt_priv *flt);
+
+/* Executes tasks in a single context until the entire fleet runs out of
+ * tasks.  If some other thread wants to reattach to this context, we hand the
+ * context over to it in between tasks.  A spare thread (see flt_detach) then
+ * returns; any other thread waits for its turn to take the context back. */
+static void
+flt_run_loop(struct flt_priv *flt)
+{
+    struct flt_task  *task;
+    unsigned int  spin_count;
+
+    flt_start_stopwatch(flt);
+dispatch:
+    if (flt->active) {
+        goto run_tasks;
+    } else {
+        goto start_steal;
+    }
+
+    /* Precondition: context active */
+run_tasks:
+    /* Pop tasks off of the bottom of our deque until there aren't any left.
+     * Thieves can steal from the top of the deque at the same time, without
+     * having to wait for us. */
+    while (true) {
+        if (CORK_UNLIKELY(flt->reattach_waiting > 0)) {
+            goto yield;
+        }
+        if (CORK_UNLIKELY(flt_reap_fibers(flt))) {
+            flt_resume_fiber(flt);
+        }
+        if (CORK_UNLIKELY(flt->timers.count > 0) &&
+            --flt->timer_countdown == 0) {
+            flt->timer_countdown = FLT_TIMER_CHECK_INTERVAL;
+            (void) flt_expire_timers(flt);
+        }
+        if ((task = flt_deque_pop_bottom(&flt->ready)) == NULL) {
+            break;
+        }
+        flt_publish_smaller_load(flt, flt_deque_size(&flt->ready));
+        flt_run_one(flt, task);
+    }
+    flt_publish_load(flt, 0);
+
+    /* We just drained the deque, so this context is no longer "active".
+     * Depart from the fleet's active indicator to see if we were the last
+     * active context.  If so, then the whole fleet is done. */
+    flt_measure_time(flt, executing);
+    DEBUG(flt, "Ran out of tasks");
+    flt_task_reclaim(flt);
+    flt->active = false;
+    if (CORK_UNLIKELY(flt_snzi_depart(flt->active_leaf))) {
+        /* Make sure that any parked contexts notice. */
+        DEBUG(flt, "Last context has run out of tasks");
+        flt_fleet_wake_all(flt->fleet);
+        return;
+    }
+
+    /* Precondition: deque empty, context inactive */
+start_steal:
+    spin_count = 0;
+
+    /* Precondition: deque empty, context inactive */
+steal:
+    if (CORK_UNLIKELY(flt->reattach_waiting > 0)) {
+        goto yield;
+    }
+    if (CORK_UNLIKELY(flt_reap_fibers(flt))) {
+        flt_resume_fiber(flt);
+    }
+    if (CORK_UNLIKELY(flt_reap_io(flt))) {
+        goto run_tasks;
+    }
+    if (CORK_UNLIKELY(flt_reap_jobs(flt))) {
+        goto run_tasks;
+    }
+    if (CORK_UNLIKELY(flt_expire_timers(flt))) {
+        goto run_tasks;
+    }
+
+    /* We don't have anything to execute.  First make sure that we haven't
+     * completely run out of tasks. */
+    if (CORK_UNLIKELY(flt_snzi_is_zero(&flt->fleet->active))) {
+        flt_measure_time(flt, choosing_to_steal);
+        DEBUG(flt, "All other contexts have run out of tasks");
+        return;
+    }
+
+    /* Some thread out there still has some tasks to run; try to steal some for
+     * ourselves. */
+    if (flt_steal(flt)) {
+        /* We got something!  Go execute it. */
+        goto run_tasks;
+    } else {
+        /* If we weren't able to steal anything, wait a bit and try again. */
+        flt_idle(flt, &spin_count);
+        goto steal;
+    }
+
+yield:
+    DEBUG(flt, "Hand context over to reattaching thread");
+    if (flt->spare) {
+        return;
+    } else {
+        /* Whoever holds the context in the meantime will overwrite these. */
+        struct flt_fiber  *fiber = flt->fiber;
+        struct flt_fiber  *native = flt->native;
+        flt_context_release(flt);
+        flt_context_acquire(flt);
+        flt->fiber = fiber;
+        flt->native = native;
+        flt->spare = false;
+        goto dispatch;
+    }
+}
+
+static void
+flt_run_context(struct flt_priv *flt, bool spare)
+{
+    flt->spare = spare;
+    if (flt->fleet->task_mode == FLT_TASK_FIBERS) {
+        struct flt_fiber  native;
+        flt_fiber_init_native(&native);
+        flt->native = &native;
+        flt->fiber = flt_fiber_take(flt);
+        flt_fiber_switch(&native, flt->fiber);
+        flt->native = NULL;
+    } else {
+        flt_run_loop(flt);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Worker threads
+ */
+
+/* Each context other than context 0 has its own worker thread, which is
+ * created the first time that the fleet runs, and which sticks around until
+ * the fleet's contexts are freed.  In between runs, the workers park on the
+ * fleet's `run_cond` condition variable.  Starting a new run bumps the fleet's
+ * `generation`, which wakes up all of the workers.  Context 0 is executed by
+ * whichever thread calls flt_fleet_run; once it has run out of tasks, it waits
+ * on `done_cond` for all of the workers to finish the run, too. */
+
+/* Waits for the fleet to start a new run.  Returns false if the worker should
+ * exit instead. */
+static bool
+flt_fleet_wait_for_run(struct flt_fleet *fleet, unsigned int *generation)
+{
+    bool  result;
+    pthread_mutex_lock(&fleet->lock);
+    while (!fleet->stopping && fleet->generation == *generation) {
+        pthread_cond_wait(&fleet->run_cond, &fleet->lock);
+    }
+    *generation = fleet->generation;
+    result = !fleet->stopping;
+    pthread_mutex_unlock(&fleet->lock);
+    return result;
+}
+
+static void
+flt_fleet_worker_finished(struct flt_fleet *fleet)
+{
+    pthread_mutex_lock(&fleet->lock);
+    if (--fleet->running_count == 0) {
+        pthread_cond_signal(&fleet->done_cond);
+    }
+    pthread_mutex_unlock(&fleet->lock);
+}
+
+static int
+flt__thread_run(struct cork_thread_body *body)
+{
+    struct flt_priv  *flt = cork_container_of(body, struct flt_priv, body);
+    struct flt_fleet  *fleet = flt->fleet;
+    unsigned int  generation = 0;
+    if (fleet->affinity_policy != FLT_AFFINITY_NONE) {
+        DEBUG(flt, "Pin to CPU %u", flt->cpu->id);
+        flt_cpu_pin_current_thread(flt->cpu);
+    }
+    while (flt_fleet_wait_for_run(fleet, &generation)) {
+        DEBUG(flt, "Start run %u", generation);
+        flt_run_context(flt, false);
+        flt_fleet_worker_finished(fleet);
+    }
+    DEBUG(flt, "Worker exiting");
+    return 0;
+}
+
+static void
+flt_fleet_start_run(struct flt_fleet *fleet)
+{
+    pthread_mutex_lock(&fleet->lock);
+    fleet->running_count = fleet->count - 1;
+    fleet->generation++;
+    pthread_cond_broadcast(&fleet->run_cond);
+    pthread_mutex_unlock(&fleet->lock);
+}
 
-void
-flt_run(struct flt *pflt, struct flt_task *task)
+/* A task that waits for a group that never finishes (usually because nothing
+ * ever starts it) holds no arrival in the fleet's active indicator, so the run
+ * can end without it.  Don't let that go unnoticed. */
+static void
+flt_fleet_check_waiting_fibers(struct flt_fleet *fleet)
 {
-    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
-    struct flt_task_group  *current_group = flt_current_group(flt);
-    struct flt_task_group_ctx  *ctx =
-        flt_local_get(pflt, current_group->ctxs, struct flt_task_group_ctx);
+    unsigned int  i;
+    size_t  waiting_count = 0;
+    for (i = 0; i < fleet->count; i++) {
+        waiting_count += fleet->contexts[i]->waiting_fibers;
+    }
+    if (CORK_UNLIKELY(waiting_count > 0)) {
+        fprintf(stderr, "fleet: %zu task(s) still waiting for task groups "
+                "that never finished\n", waiting_count);
+        abort();
+    }
+}
 
-    DEBUG(flt, "Add %s [%zu,%zu) to current group %p",
-          task->name, task->min, task->max, current_group);
-    task->group = current_group;
+static void
+flt_fleet_wait_for_workers(struct flt_fleet *fleet)
+{
+    pthread_mutex_lock(&fleet->lock);
+    while (fleet->running_count > 0) {
+        pthread_cond_wait(&fleet->done_cond, &fleet->lock);
+    }
+    pthread_mutex_unlock(&fleet->lock);
+    flt_fleet_check_waiting_fibers(fleet);
+}
 
-    /* The current task's group must already be running (otherwise how would we
-     * have started the current task?), so we can add the task directly to the
-     * context's ready queue, instead of adding it to the group. */
-    cork_dllist_add_to_head(&flt->ready, &task->item);
 
-    /* The current execution context must already be active for the current task
-     * group (again, because there's already a task that was ready in this group
-     * in this context).  So we never need to bump the groups active_ctx_count
-     * field. */
-    ctx->task_count++;
-    flt->execution_count += (task->max - task->min);
-}
+/*-----------------------------------------------------------------------
+ * Detaching
+ */
 
-void
-flt_run_later(struct flt *pflt, struct flt_task *task)
+/* When a task detaches from its context, we hand the context over to a spare
+ * thread, so that the context's ready tasks keep running while the task is
+ * blocked.  Spare threads are created as needed, and park on the fleet's
+ * `spare_cond` condition variable when they're not assigned to a context.
+ *
+ * The detached task is still in flight, so its thread keeps the arrival in the
+ * fleet's active indicator that the context was holding on its behalf; that
+ * keeps the run from finishing while the task is blocked.  If the context has
+ * anything else in its deque, it arrives again for the spare to use.  When the
+ * thread reattaches, it waits for the context's current holder to finish
+ * whatever task it's running, and then takes the context back. */
+
+struct flt_spare {
+    struct cork_dllist_item  item;
+    struct flt_fleet  *fleet;
+    struct cork_thread  *thread;
+    struct cork_thread_body  body;
+    /* The context that this thread is running, or NULL if it's idle */
+    struct flt_priv  *flt;
+};
+
+struct flt_detached {
+    struct cork_dllist_item  item;
+    pthread_t  thread;
+    struct flt_task  *current;
+    struct flt_fiber  *fiber;
+    struct flt_fiber  *native;
+    bool  spare;
+};
+
+/* Takes a ticket and waits for our turn to execute tasks in `flt`. */
+static void
+flt_context_acquire(struct flt_priv *flt)
 {
-    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
-    struct flt_task_group  *current_group = flt_current_group(flt);
-    struct flt_task_group_ctx  *ctx =
-        flt_local_get(pflt, current_group->ctxs, struct flt_task_group_ctx);
+    struct flt_fleet  *fleet = flt->fleet;
+    unsigned int  ticket;
 
-    DEBUG(flt, "Add %s [%zu,%zu) to end of current group %p",
-          task->name, task->min, task->max, current_group);
-    task->group = current_group;
+    pthread_mutex_lock(&fleet->lock);
+    ticket = flt->next_ticket++;
+    flt->reattach_waiting++;
+    pthread_mutex_unlock(&fleet->lock);
 
-    /* The current task's group must already be running (otherwise how would we
-     * have started the current task?), so we can add the task directly to the
-     * context's ready queue, instead of adding it to the group. */
-    cork_dllist_add_to_tail(&flt->ready, &task->item);
+    /* The current holder might be parked; this pairs with the check in
+     * flt_park. */
+    flt_fleet_wake_all(fleet);
 
-    /* The current execution context must already be active for the current task
-     * group (again, because there's already a task that was ready in this group
-     * in this context).  So we never need to bump the groups active_ctx_count
-     * field. */
-    ctx->task_count++;
-    flt->execution_count += (task->max - task->min);
+    pthread_mutex_lock(&fleet->lock);
+    while (flt->held || flt->now_serving != ticket) {
+        pthread_cond_wait(&fleet->detach_cond, &fleet->lock);
+    }
+    flt->held = true;
+    flt->now_serving++;
+    flt->reattach_waiting--;
+    pthread_mutex_unlock(&fleet->lock);
 }
 
+static void
+flt_context_release(struct flt_priv *flt)
+{
+    struct flt_fleet  *fleet = flt->fleet;
+    pthread_mutex_lock(&fleet->lock);
+    flt->held = false;
+    pthread_cond_broadcast(&fleet->detach_cond);
+    pthread_mutex_unlock(&fleet->lock);
+}
 
-#if FLT_MEASURE_TIMING
-#define flt_start_stopwatch(flt)  flt_stopwatch_start(&(flt)->stopwatch)
-#define flt_measure_time(flt, which) \
-    (flt)->timing.which += flt_stopwatch_get_delta(&(flt)->stopwatch)
-#else
-#define flt_start_stopwatch(flt)      /* do nothing */
-#define flt_measure_time(flt, which)  /* do nothing */
-#endif
-
-#define FLT_ROUND_SIZE  256
-
-/* Returns the number of task iterations that were executed. */
-static size_t
-flt_pop_and_run_one(struct flt_priv *flt, size_t max_count)
+static int
+flt__spare_run(struct cork_thread_body *body)
 {
-    struct flt_task  *task = flt_current_task(flt);
-    size_t  min = task->min;
-    size_t  count = task->max - task->min;
+    struct flt_spare  *spare = cork_container_of(body, struct flt_spare, body);
+    struct flt_fleet  *fleet = spare->fleet;
+
+    pthread_mutex_lock(&fleet->lock);
+    while (true) {
+        struct flt_priv  *flt;
+        while (spare->flt == NULL && !fleet->stopping) {
+            pthread_cond_wait(&fleet->spare_cond, &fleet->lock);
+        }
+        if (spare->flt == NULL) {
+            break;
+        }
+        flt = spare->flt;
+        pthread_mutex_unlock(&fleet->lock);
 
-    if (max_count < count) {
-        /* There are more iterations in this bulk task than we can execute
-         * during this lock acquisition.  So only execute the first max_count
-         * iterations. */
-        size_t  i;
-        size_t  max = min + max_count;
-        DEBUG(flt, "Run task %s [%zu,%zu)", task->name, min, max);
-        for (i = min; i < max; i++) {
-            flt_task_run(&flt->public, task, i);
-        }
-        task->min = max;
-        flt->execution_count -= max_count;
-        return max_count;
-    } else {
-        /* We can execute all of the iterations in this bulk task without
-         * exceeding our allotment for this lock acquisition.  So execute them
-         * all and retire the task. */
-        size_t  i;
-        size_t  max = task->max;
-        DEBUG(flt, "Run task %s [%zu,%zu)", task->name, min, max);
-        for (i = min; i < max; i++) {
-            flt_task_run(&flt->public, task, i);
+        DEBUG(flt, "Spare thread takes over context");
+        if (fleet->affinity_policy != FLT_AFFINITY_NONE) {
+            flt_cpu_pin_current_thread(flt->cpu);
         }
-        cork_dllist_remove(&task->item);
-        flt_task_group_decrement(flt, task->group);
-        flt_task_free(flt, task);
-        flt->execution_count -= count;
-        return count;
+        flt_run_context(flt, true);
+        DEBUG(flt, "Spare thread releases context");
+        flt_context_release(flt);
+
+        pthread_mutex_lock(&fleet->lock);
+        spare->flt = NULL;
     }
+    pthread_mutex_unlock(&fleet->lock);
+    return 0;
 }
 
-static unsigned int
-flt_find_task_to_steal_from(struct flt_priv *flt)
+/* Must hold the fleet's lock */
+static void
+flt_fleet_start_spare(struct flt_fleet *fleet, struct flt_priv *flt)
 {
-    unsigned int  result;
-    do {
-        result = flt->next_to_steal_from;
-        flt->next_to_steal_from += 1;
-        flt->next_to_steal_from %= flt->public.count;
-    } while (result == flt->public.index);
-    return result;
+    struct cork_dllist_item  *curr;
+    struct flt_spare  *spare;
+
+    for (curr = cork_dllist_start(&fleet->spares);
+         !cork_dllist_is_end(&fleet->spares, curr); curr = curr->next) {
+        spare = cork_container_of(curr, struct flt_spare, item);
+        if (spare->flt == NULL) {
+            spare->flt = flt;
+            pthread_cond_broadcast(&fleet->spare_cond);
+            return;
+        }
+    }
+
+    spare = cork_new(struct flt_spare);
+    spare->fleet = fleet;
+    spare->flt = flt;
+    spare->body.run = flt__spare_run;
+    spare->body.free = flt__thread_free;
+    cork_dllist_add_to_tail(&fleet->spares, &spare->item);
+    cork_buffer_printf(&fleet->buf, "spare.%zu", cork_dllist_size(&fleet->spares));
+    spare->thread = cork_thread_new(fleet->buf.buf, &spare->body);
+    cork_thread_start(spare->thread);
 }
 
-/* Returns the number of tasks that we were able to steal. */
-static size_t
-flt_steal(struct flt_priv *flt)
+static void
+flt_fleet_free_spares(struct flt_fleet *fleet)
 {
-    size_t  to_steal;
-    size_t  left_to_steal;
-    unsigned int  steal_index = flt_find_task_to_steal_from(flt);
-    struct flt_priv  *steal_from = flt->fleet->contexts[steal_index];
     struct cork_dllist_item  *curr;
-    struct cork_dllist_item  *prev;
-
-    /* Is there anything to steal?  If not, give up. */
-    if (steal_from->execution_count == 0) {
-        DEBUG(flt, "Not going to steal from empty context %u", steal_index);
-        return 0;
+    struct cork_dllist_item  *next;
+    struct flt_spare  *spare;
+    cork_dllist_foreach(&fleet->spares, curr, next,
+                        struct flt_spare, spare, item) {
+        cork_thread_join(spare->thread);
+        free(spare);
     }
+    cork_dllist_init(&fleet->spares);
+}
 
-    /* Is someone else already trying to steal from this context?  If so we have
-     * to give up.  If not stake our claim. */
-    if (cork_ptr_cas(&steal_from->waiting_to_steal, NULL, flt) != NULL) {
-        return 0;
+void
+flt_detach(struct flt *pflt)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_fleet  *fleet = flt->fleet;
+    struct flt_detached  *detached = cork_new(struct flt_detached);
+
+    DEBUG(flt, "Detach from context");
+    flt_channel_flush(flt);
+    detached->thread = pthread_self();
+    detached->current = flt->current;
+    detached->fiber = flt->fiber;
+    detached->native = flt->native;
+    detached->spare = flt->spare;
+    flt->current = NULL;
+    if (flt_deque_is_empty(&flt->ready)) {
+        flt->active = false;
+    } else {
+        flt_snzi_arrive(flt->active_leaf);
     }
 
-    /* Grab the lock on the queue of the context we're going to steal from. */
-    DEBUG(flt, "Steal from context %u", steal_index);
-    flt_measure_time(flt, choosing_to_steal);
-    flt_spinlock_lock(&flt->lock);
-    flt_spinlock_lock(&steal_from->lock);
-    flt_measure_time(flt, waiting_to_steal);
-
-    /* And then steal! */
-    to_steal = steal_from->execution_count / 2;
-    left_to_steal = to_steal;
-    DEBUG(flt, "Steal %zu tasks from context %u", to_steal, steal_index);
-
-    /* We don't have to check for the beginning of the list, because we're
-     * only going to try to steal half of the list.  We'll never make it to the
-     * beginning. */
-    for (curr = cork_dllist_end(&steal_from->ready), prev = curr->prev;
-         left_to_steal > 0; curr = prev, prev = curr->prev) {
-        struct flt_task  *task = cork_container_of(curr, struct flt_task, item);
-        size_t  count = task->max - task->min;
-        if (count > left_to_steal) {
-            /* We only need to steal part of this bulk task to reach our theft
-             * goal.  Create a new task instance to hold the portion that we
-             * steal. */
-            size_t  new_min = task->max - left_to_steal;
-            struct flt_task  *new_task = flt->public.new_task
-                (&flt->public, task->name, task->func,
-                 task->ud, new_min, task->max);
-            DEBUG(flt, "Steal %s [%zu,%zu) from context %u",
-                  task->name, new_min, task->max, steal_index);
-            task->max = new_min;
-            new_task->group = task->group;
-            flt_task_group_increment(flt, new_task->group);
-            DEBUG(flt, "Leave %s [%zu,%zu) with context %u",
-                  task->name, task->min, new_min, steal_index);
-            cork_dllist_add_to_head(&flt->ready, &new_task->item);
-            break;
-        } else {
-            /* We need to steal this entire task, and we'll need to steal more
-             * to reach our goal. */
-            DEBUG(flt, "Steal %s [%zu,%zu) from context %u",
-                  task->name, task->min, task->max, steal_index);
-            flt_task_group_move(flt, task->group, steal_from);
-            cork_dllist_remove(&task->item);
-            cork_dllist_add_to_head(&flt->ready, &task->item);
-            left_to_steal -= count;
-        }
-    }
-
-    /* Release the lock and return. */
-    steal_from->execution_count -= to_steal;
-    flt->execution_count += to_steal;
-    DEBUG(flt, "Context %u now has %zu tasks",
-          steal_index, steal_from->execution_count);
-    DEBUG(flt, "Context %u now has %zu tasks",
-          flt->public.index, flt->execution_count);
-    steal_from->waiting_to_steal = NULL;
-    flt_spinlock_unlock(&steal_from->lock);
-    flt_spinlock_unlock(&flt->lock);
-    flt_measure_time(flt, stealing);
-    return to_steal;
+    pthread_mutex_lock(&fleet->lock);
+    cork_dllist_add_to_tail(&flt->detached, &detached->item);
+    flt_fleet_start_spare(fleet, flt);
+    pthread_mutex_unlock(&fleet->lock);
 }
 
-static int
-flt__thread_run(struct cork_thread_body *body)
+void
+flt_reattach(struct flt *pflt)
 {
-    struct flt_priv  *flt = cork_container_of(body, struct flt_priv, body);
-    unsigned int  spin_count;
-    size_t  max_count;
-    size_t  executed_count;
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_fleet  *fleet = flt->fleet;
+    pthread_t  self = pthread_self();
+    struct cork_dllist_item  *curr;
+    struct flt_detached  *detached = NULL;
 
-    flt_start_stopwatch(flt);
-    if (cork_dllist_is_empty(&flt->ready)) {
-        goto start_steal;
-    } else {
-        goto start_round;
-    }
-
-    /* Precondition: task queue unlocked, not empty */
-start_round:
-    /* If there is some other context waiting to steal from us, let them do
-     * that before we execute anything else. */
-    if (flt->waiting_to_steal != NULL) {
-        DEBUG(flt, "Waiting to let someone steal from us");
-        spin_count = 0;
-        while (flt->waiting_to_steal != NULL) {
-            flt_pause(spin_count);
-        }
-        flt_measure_time(flt, waiting_to_be_stolen_from);
-    }
-
-    /* Lock our task queue so that no one else can mess with it while we're
-     * popping off tasks to execute.  After executing a maximum number of tasks,
-     * we unlock the queue, even if we haven't fully drained the queue.  This
-     * ensures that we don't starve any other threads that want to steal from
-     * us. */
-
-    flt_spinlock_lock(&flt->lock);
-    flt_measure_time(flt, waiting_to_execute);
-    DEBUG(flt, "Starting round");
-    max_count = FLT_ROUND_SIZE;
-
-    /* Precondition: task queue locked, not empty */
-continue_round:
-    /* We have at least one task in our queue to run. */
-    executed_count = flt_pop_and_run_one(flt, max_count);
-    max_count -= executed_count;
-
-    if (CORK_UNLIKELY(cork_dllist_is_empty(&flt->ready))) {
-        /* If we just drained the queue after executing this task, then this
-         * context is no longer "active".  Decrement the fleet's active context
-         * counter to see if we were the last active context.  If so, then the
-         * whole fleet is done. */
-        flt_measure_time(flt, executing);
-        DEBUG(flt, "Executed %zu in round",
-              (size_t) FLT_ROUND_SIZE - executed_count);
-        flt->active = false;
-        if (CORK_UNLIKELY(flt_counter_dec(&flt->fleet->active_count))) {
-            DEBUG(flt, "Last context has run out of tasks");
-            flt_spinlock_unlock(&flt->lock);
-            return 0;
-        } else {
-            /* If we ran out of tasks, but there are other threads that still
-             * have tasks to execute, let's try to steal some of them. */
-            flt_spinlock_unlock(&flt->lock);
-            goto start_steal;
-        }
-    } else if (max_count == 0) {
-        /* We've executed the maximum number of tasks for this round, but there
-         * are other tasks in the queue.  Unlock to see if anyone else wants to
-         * steal from us, then start a new round. */
-        flt_measure_time(flt, executing);
-        DEBUG(flt, "Executed %zu in round", (size_t) FLT_ROUND_SIZE);
-        flt_spinlock_unlock(&flt->lock);
-        goto start_round;
+    flt_context_acquire(flt);
+    DEBUG(flt, "Reattach to context");
+
+    pthread_mutex_lock(&fleet->lock);
+    for (curr = cork_dllist_start(&flt->detached);
+         !cork_dllist_is_end(&flt->detached, curr); curr = curr->next) {
+        detached = cork_container_of(curr, struct flt_detached, item);
+        if (pthread_equal(detached->thread, self)) {
+            cork_dllist_remove(&detached->item);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fleet->lock);
+
+    flt->current = detached->current;
+    flt->fiber = detached->fiber;
+    flt->native = detached->native;
+    flt->spare = detached->spare;
+    free(detached);
+
+    /* If the context is already active, it doesn't need the arrival that we've
+     * been holding onto.  (And since the context is active, this can't be the
+     * last departure.) */
+    if (flt->active) {
+        (void) flt_snzi_depart(flt->active_leaf);
     } else {
-        /* We can keep executing tasks in this round. */
-        goto continue_round;
+        flt->active = true;
     }
+}
 
-    /* Precondition: task unlocked, empty */
-start_steal:
-    DEBUG(flt, "Ran out of tasks");
-    spin_count = 0;
 
-    /* Precondition: task unlocked, empty */
-steal:
-    /* We don't have anything to execute.  First make sure that we haven't
-     * completely run out of tasks. */
-    if (CORK_UNLIKELY(flt_counter_get(&flt->fleet->active_count) == 0)) {
-        flt_measure_time(flt, choosing_to_steal);
-        DEBUG(flt, "All other contexts have run out of tasks");
-        return 0;
-    }
+/*-----------------------------------------------------------------------
+ * Fleets
+ */
 
-    /* Some thread out there still has some tasks to run; try to steal some for
-     * ourselves. */
-    if (flt_steal(flt)) {
-        /* We got something!  Start a new round to execute these tasks. */
-        flt_counter_inc(&flt->fleet->active_count);
-        flt->active = true;
-        goto start_round;
-    } else {
-        /* If we weren't able to steal anything, wait a bit and try again. */
-        flt_pause(spin_count);
-        goto steal;
+/* Gives each context a leaf in the fleet's active indicator, shared with all of
+ * the other contexts on the same last-level cache. */
+static void
+flt_fleet_new_active_leaves(struct flt_fleet *fleet)
+{
+    unsigned int  i;
+    fleet->active_leaves =
+        cork_calloc(fleet->count, sizeof(struct flt_snzi_node *));
+    fleet->active_leaf_count = 0;
+    for (i = 0; i < fleet->count; i++) {
+        struct flt_priv  *flt = fleet->contexts[i];
+        unsigned int  j;
+        flt->active_leaf = NULL;
+        for (j = 0; j < i; j++) {
+            struct flt_priv  *other = fleet->contexts[j];
+            if (other->cpu->llc == flt->cpu->llc) {
+                flt->active_leaf = other->active_leaf;
+                break;
+            }
+        }
+        if (flt->active_leaf == NULL) {
+            flt->active_leaf = flt_node_alloc
+                (&fleet->topology, flt->cpu->node, sizeof(struct flt_snzi_node));
+            flt_snzi_init(flt->active_leaf, &fleet->active);
+            fleet->active_leaves[fleet->active_leaf_count++] = flt->active_leaf;
+        }
     }
 }
 
+static void
+flt_fleet_free_active_leaves(struct flt_fleet *fleet)
+{
+    unsigned int  i;
+    for (i = 0; i < fleet->active_leaf_count; i++) {
+        flt_node_free(&fleet->topology, fleet->active_leaves[i],
+                      sizeof(struct flt_snzi_node));
+    }
+    free(fleet->active_leaves);
+}
 
 static void
 flt_fleet_new_contexts(struct flt_fleet *fleet)
 {
     unsigned int  i;
     unsigned int  count = fleet->count;
+    const struct flt_cpu  **cpus = cork_calloc(count, sizeof(struct flt_cpu *));
+    flt_topology_place
+        (&fleet->topology, fleet->affinity_policy,
+         fleet->cpu_ids, fleet->cpu_id_count, count, cpus);
     fleet->contexts = cork_calloc(count, sizeof(struct flt_priv *));
     for (i = 0; i < count; i++) {
-        fleet->contexts[i] = flt_new(fleet, i, count);
+        fleet->contexts[i] = flt_new(fleet, i, count, cpus[i]);
+    }
+    /* Each context sorts the other contexts by how far away they are from its
+     * CPU. */
+    for (i = 0; i < count; i++) {
+        struct flt_priv  *flt = fleet->contexts[i];
+        flt->victims = cork_calloc(count, sizeof(unsigned int));
+        flt_topology_order_victims
+            (cpus, count, i, flt->victims, flt->victim_tier_end);
+    }
+    free(cpus);
+    flt_fleet_new_active_leaves(fleet);
+    fleet->load_board =
+        cork_calloc(flt_round_to_cache_line(count), sizeof(uint8_t));
+
+    fleet->generation = 0;
+    fleet->running_count = 0;
+    fleet->stopping = false;
+    for (i = 1; i < count; i++) {
+        struct flt_priv  *flt = fleet->contexts[i];
+        cork_buffer_printf(&fleet->buf, "context.%u", i);
+        flt->thread = cork_thread_new(fleet->buf.buf, &flt->body);
+        DEBUG(flt, "Start thread");
+        cork_thread_start(flt->thread);
     }
 }
 
@@ -714,10 +2747,35 @@ flt_fleet_free_contexts(struct flt_fleet *fleet)
 {
     unsigned int  i;
     unsigned int  count = fleet->count;
+
+    pthread_mutex_lock(&fleet->lock);
+    fleet->stopping = true;
+    pthread_cond_broadcast(&fleet->run_cond);
+    pthread_cond_broadcast(&fleet->spare_cond);
+    pthread_mutex_unlock(&fleet->lock);
+    flt_fleet_free_spares(fleet);
+    for (i = 1; i < count; i++) {
+        struct flt_priv  *flt = fleet->contexts[i];
+        DEBUG(flt, "Wait for thread to finish");
+        cork_thread_join(flt->thread);
+        DEBUG(flt, "Thread finished");
+        flt->thread = NULL;
+    }
+
+    /* Freeing a group can free tasks and edges that some other context
+     * allocated, so we have to free every context's groups before we free any
+     * of their batches. */
+    flt_recycle_retired_groups(fleet->contexts[0]);
+    for (i = 0; i < count; i++) {
+        flt_task_group_list_done(fleet->contexts[i],
+                                 &fleet->contexts[i]->groups);
+    }
     for (i = 0; i < count; i++) {
         flt_free(fleet->contexts[i]);
     }
     free(fleet->contexts);
+    flt_fleet_free_active_leaves(fleet);
+    free((void *) fleet->load_board);
 }
 
 struct flt_fleet *
@@ -726,17 +2784,62 @@ flt_fleet_new(void)
     struct flt_fleet  *fleet = cork_new(struct flt_fleet);
     fleet->count = flt_processor_count();
     fleet->contexts = NULL;
-    flt_counter_init(&fleet->active_count);
+    flt_topology_init(&fleet->topology, "/sys/devices/system/cpu");
+    flt_snzi_init(&fleet->active, NULL);
     cork_buffer_init(&fleet->buf);
+    fleet->affinity_policy = FLT_AFFINITY_NONE;
+    fleet->cpu_ids = NULL;
+    fleet->cpu_id_count = 0;
+    fleet->idle_policy = FLT_IDLE_PARK;
+    fleet->split_policy = FLT_SPLIT_EAGER;
+    fleet->task_mode = FLT_TASK_PLAIN;
+    fleet->fiber_stack_size = FLT_FIBER_STACK_SIZE;
+    flt_counter_init(&fleet->sleeper_count);
+    flt_padded_uint_set_fast(&fleet->wake_seq, 0);
+    pthread_mutex_init(&fleet->lock, NULL);
+    pthread_cond_init(&fleet->run_cond, NULL);
+    pthread_cond_init(&fleet->done_cond, NULL);
+    pthread_cond_init(&fleet->detach_cond, NULL);
+    pthread_cond_init(&fleet->spare_cond, NULL);
+    cork_dllist_init(&fleet->spares);
+    fleet->io = NULL;
+    fleet->io_completed = NULL;
+    fleet->serving = false;
+    fleet->service_thread = NULL;
+    fleet->injected = NULL;
+    fleet->retired_groups = NULL;
+    fleet->job_limit = 0;
+    fleet->submit_policy = FLT_SUBMIT_BLOCK;
+    pthread_mutex_init(&fleet->job_lock, NULL);
+    pthread_cond_init(&fleet->job_cond, NULL);
+    fleet->job_count = 0;
+    fleet->queue_depth = 0;
+    fleet->spill_head = NULL;
+    fleet->spill_tail = NULL;
     return fleet;
 }
 
 void
 flt_fleet_free(struct flt_fleet *fleet)
 {
+    if (fleet->serving) {
+        flt_fleet_stop(fleet);
+    }
+    if (fleet->io != NULL) {
+        flt_io_free(fleet->io);
+    }
     if (fleet->contexts != NULL) {
         flt_fleet_free_contexts(fleet);
     }
+    pthread_cond_destroy(&fleet->job_cond);
+    pthread_mutex_destroy(&fleet->job_lock);
+    pthread_cond_destroy(&fleet->spare_cond);
+    pthread_cond_destroy(&fleet->detach_cond);
+    pthread_cond_destroy(&fleet->done_cond);
+    pthread_cond_destroy(&fleet->run_cond);
+    pthread_mutex_destroy(&fleet->lock);
+    flt_topology_done(&fleet->topology);
+    free(fleet->cpu_ids);
     cork_buffer_done(&fleet->buf);
     free(fleet);
 }
@@ -751,6 +2854,54 @@ flt_fleet_set_context_count(struct flt_fleet *fleet, unsigned int context_count)
     fleet->count = context_count;
 }
 
+void
+flt_fleet_set_split_policy(struct flt_fleet *fleet,
+                           enum flt_split_policy policy)
+{
+    fleet->split_policy = policy;
+}
+
+void
+flt_fleet_set_task_mode(struct flt_fleet *fleet, enum flt_task_mode mode)
+{
+    fleet->task_mode = mode;
+}
+
+void
+flt_fleet_set_fiber_stack_size(struct flt_fleet *fleet, size_t stack_size)
+{
+    fleet->fiber_stack_size = stack_size;
+}
+
+void
+flt_fleet_set_affinity(struct flt_fleet *fleet, enum flt_affinity_policy policy)
+{
+    /* The worker threads pin themselves when they start, so we have to
+     * recreate them. */
+    if (fleet->contexts != NULL) {
+        flt_fleet_free_contexts(fleet);
+        fleet->contexts = NULL;
+    }
+    fleet->affinity_policy = policy;
+}
+
+void
+flt_fleet_set_affinity_cpus(struct flt_fleet *fleet,
+                            const unsigned int *cpus, unsigned int cpu_count)
+{
+    flt_fleet_set_affinity(fleet, FLT_AFFINITY_EXPLICIT);
+    free(fleet->cpu_ids);
+    fleet->cpu_ids = cork_calloc(cpu_count, sizeof(unsigned int));
+    memcpy(fleet->cpu_ids, cpus, cpu_count * sizeof(unsigned int));
+    fleet->cpu_id_count = cpu_count;
+}
+
+void
+flt_fleet_set_idle_policy(struct flt_fleet *fleet, enum flt_idle_policy policy)
+{
+    fleet->idle_policy = policy;
+}
+
 void
 flt_fleet_run_(struct flt_fleet *fleet, const char *name,
                flt_task *func, void *ud, size_t index)
@@ -758,6 +2909,7 @@ flt_fleet_run_(struct flt_fleet *fleet, const char *name,
     struct flt_priv  *flt;
     struct flt_task_group  *group;
     struct flt_task  *task;
+    struct flt_saved_affinity  *saved_affinity = NULL;
     unsigned int  i;
 
     if (CORK_UNLIKELY(fleet->contexts == NULL)) {
@@ -765,25 +2917,31 @@ flt_fleet_run_(struct flt_fleet *fleet, const char *name,
     }
 
     flt = fleet->contexts[0];
-    group = flt_task_group_new(&flt->public);
+    group = flt_task_group_new_in_job(flt, NULL);
     task = flt->public.new_task(&flt->public, name, func, ud, index, index + 1);
     flt_task_group_add(&flt->public, group, task);
     flt_task_group_start(&flt->public, group);
 
-    for (i = 0; i < fleet->count; i++) {
-        cork_buffer_printf(&fleet->buf, "context.%u", i);
-        flt = fleet->contexts[i];
-        flt->thread = cork_thread_new(fleet->buf.buf, &flt->body);
-        DEBUG(flt, "Start thread");
-        cork_thread_start(flt->thread);
+    /* Wake up the workers, and then execute context 0 ourselves.  We can't
+     * return until all of the workers have noticed that the run is over, since
+     * until then they might still be looking at our deques. */
+    flt_fleet_start_run(fleet);
+    if (fleet->affinity_policy != FLT_AFFINITY_NONE) {
+        /* Context 0 runs in the caller's thread, so only pin it for as long as
+         * the run lasts. */
+        saved_affinity = flt_affinity_save();
+        flt_cpu_pin_current_thread(flt->cpu);
     }
+    flt_run_context(flt, false);
+    flt_fleet_wait_for_workers(fleet);
+    flt_affinity_restore(saved_affinity);
 
+    /* Every task group that was created during this run has finished by now,
+     * so we can free them all. */
     for (i = 0; i < fleet->count; i++) {
         flt = fleet->contexts[i];
-        DEBUG(flt, "Wait for thread to finish");
-        cork_thread_join(flt->thread);
-        DEBUG(flt, "Thread finished");
-        flt->thread = NULL;
+        flt_task_group_list_done(flt, &flt->groups);
+        cork_dllist_init(&flt->groups);
     }
 
 #if FLT_MEASURE_TIMING
@@ -800,9 +2958,132 @@ flt_fleet_run_(struct flt_fleet *fleet, const char *name,
         print_time(choosing_to_steal);
         print_time(executing);
         print_time(stealing);
-        print_time(waiting_to_execute);
-        print_time(waiting_to_steal);
-        print_time(waiting_to_be_stolen_from);
+        print_time(parked);
     }
 #endif
 }
+
+
+/*-----------------------------------------------------------------------
+ * Service mode
+ */
+
+/* While the fleet is serving, we hold an extra arrival at the root of its
+ * active indicator, so that the contexts keep waiting for more work, even when
+ * they've run out of tasks. */
+
+static int
+flt__service_run(struct cork_thread_body *body)
+{
+    struct flt_fleet  *fleet =
+        cork_container_of(body, struct flt_fleet, service_body);
+    struct flt_priv  *flt = fleet->contexts[0];
+    if (fleet->affinity_policy != FLT_AFFINITY_NONE) {
+        flt_cpu_pin_current_thread(flt->cpu);
+    }
+    flt_run_context(flt, false);
+    return 0;
+}
+
+void
+flt_fleet_start(struct flt_fleet *fleet)
+{
+    if (CORK_UNLIKELY(fleet->contexts == NULL)) {
+        flt_fleet_new_contexts(fleet);
+    }
+    fleet->serving = true;
+    flt_snzi_arrive(&fleet->active);
+    flt_fleet_start_run(fleet);
+    fleet->service_body.run = flt__service_run;
+    fleet->service_body.free = flt__thread_free;
+    fleet->service_thread = cork_thread_new("service", &fleet->service_body);
+    cork_thread_start(fleet->service_thread);
+}
+
+struct flt_job *
+flt_fleet_submit_(struct flt_fleet *fleet, const char *name,
+                  flt_task *func, void *ud, size_t i)
+{
+    struct flt_job  *job = cork_new(struct flt_job);
+    job->fleet = fleet;
+    job->name = name;
+    job->func = func;
+    job->ud = ud;
+    job->i = i;
+    job->group_count = 0;
+    job->groups = NULL;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->cond, NULL);
+    job->finished = false;
+
+    /* A spilled job can be injected by some other thread as soon as it's in
+     * the spill list, so we have to account for it before we try to admit
+     * it. */
+    (void) cork_size_atomic_add(&fleet->queue_depth, 1);
+    flt_snzi_arrive(&fleet->active);
+    switch (flt_fleet_admit_job(fleet, job)) {
+        case FLT_JOB_ADMITTED:
+            flt_fleet_inject(fleet, job);
+            break;
+
+        case FLT_JOB_SPILLED:
+            break;
+
+        case FLT_JOB_REJECTED:
+        default:
+            (void) cork_size_atomic_sub(&fleet->queue_depth, 1);
+            if (flt_snzi_depart(&fleet->active)) {
+                flt_fleet_wake_all(fleet);
+            }
+            pthread_cond_destroy(&job->cond);
+            pthread_mutex_destroy(&job->lock);
+            free(job);
+            return NULL;
+    }
+    return job;
+}
+
+void
+flt_fleet_stop(struct flt_fleet *fleet)
+{
+    unsigned int  i;
+
+    /* Once every submitted job has finished, this lets the contexts notice that
+     * the fleet has run out of work. */
+    if (flt_snzi_depart(&fleet->active)) {
+        flt_fleet_wake_all(fleet);
+    }
+    cork_thread_join(fleet->service_thread);
+    fleet->service_thread = NULL;
+    flt_fleet_wait_for_workers(fleet);
+    fleet->serving = false;
+
+    flt_recycle_retired_groups(fleet->contexts[0]);
+    for (i = 0; i < fleet->count; i++) {
+        struct flt_priv  *flt = fleet->contexts[i];
+        flt_task_group_list_done(flt, &flt->groups);
+        cork_dllist_init(&flt->groups);
+    }
+}
+
+void
+flt_fleet_set_job_limit(struct flt_fleet *fleet, size_t limit,
+                        enum flt_submit_policy policy)
+{
+    /* Submitters read the limit without holding `job_lock`, and lifting the
+     * limit would strand any jobs in the spill list, so it can only change
+     * while nothing can be submitting. */
+    if (CORK_UNLIKELY(fleet->serving)) {
+        fprintf(stderr, "fleet: Cannot change the job limit while the fleet "
+                "is running\n");
+        abort();
+    }
+    fleet->job_limit = limit;
+    fleet->submit_policy = policy;
+}
+
+size_t
+flt_fleet_queue_depth(struct flt_fleet *fleet)
+{
+    return fleet->queue_depth;
+}
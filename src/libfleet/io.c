@@ -0,0 +1,441 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#endif
+
+#include "libcork/core.h"
+#include "libcork/threads.h"
+
+#include "fleet.h"
+#include "fleet/io.h"
+#include "fleet/task.h"
+#include "fleet/threads.h"
+
+/* We need IORING_OP_READ and IORING_OP_WRITE, which appeared in the same kernel
+ * release as IORING_FEAT_RW_CUR_POS. */
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define FLT_HAVE_IO_URING  1
+#else
+#define FLT_HAVE_IO_URING  0
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * I/O backends
+ */
+
+#define FLT_IO_RING_SIZE  256
+
+struct flt_io {
+    struct flt_fleet  *fleet;
+    struct cork_thread  *thread;
+    struct cork_thread_body  body;
+    /* Protects the submission side of the backend */
+    pthread_mutex_t  lock;
+    bool  stopping;
+
+    /* The blocking backend: a queue of requests for the completion thread to
+     * perform */
+    pthread_cond_t  cond;
+    struct flt_io_request  *head;
+    struct flt_io_request  *tail;
+
+#if FLT_HAVE_IO_URING
+    /* The io_uring backend, if the kernel supports it; see
+     * flt_io_uses_uring */
+    int  ring_fd;
+    void  *sq_ring;
+    size_t  sq_ring_size;
+    void  *cq_ring;
+    size_t  cq_ring_size;
+    struct io_uring_sqe  *sqes;
+    size_t  sqes_size;
+    volatile unsigned int  *sq_tail;
+    unsigned int  sq_mask;
+    unsigned int  *sq_array;
+    volatile unsigned int  *cq_head;
+    volatile unsigned int  *cq_tail;
+    unsigned int  cq_mask;
+    struct io_uring_cqe  *cqes;
+#endif
+};
+
+static void
+flt__io_thread_free(struct cork_thread_body *body)
+{
+    /* Nothing to do */
+}
+
+static ssize_t
+flt_io_perform(struct flt_io_request *req)
+{
+    ssize_t  result;
+    if (req->op == FLT_IO_READ) {
+        result = pread(req->fd, req->buf, req->len, req->offset);
+    } else {
+        result = pwrite(req->fd, req->buf, req->len, req->offset);
+    }
+    return (result < 0)? -errno: result;
+}
+
+
+#if FLT_HAVE_IO_URING
+
+#define flt_io_uring_setup(entries, params) \
+    ((int) syscall(__NR_io_uring_setup, (entries), (params)))
+#define flt_io_uring_enter(fd, to_submit, min_complete, flags) \
+    ((int) syscall(__NR_io_uring_enter, (fd), (to_submit), (min_complete), \
+                   (flags), NULL, 0))
+
+static bool
+flt_io_uring_init(struct flt_io *io)
+{
+    struct io_uring_params  params;
+    int  fd;
+
+    memset(&params, 0, sizeof(params));
+    fd = flt_io_uring_setup(FLT_IO_RING_SIZE, &params);
+    if (fd < 0) {
+        return false;
+    }
+    /* Without NODROP, the kernel will throw away completions if we have more
+     * operations in flight than fit in the completion ring. */
+    if (!(params.features & IORING_FEAT_NODROP) ||
+        !(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(fd);
+        return false;
+    }
+
+    io->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    io->cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    io->sq_ring = mmap
+        (NULL, io->sq_ring_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    io->cq_ring = mmap
+        (NULL, io->cq_ring_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    io->sqes = mmap
+        (NULL, io->sqes_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (io->sq_ring == MAP_FAILED || io->cq_ring == MAP_FAILED ||
+        io->sqes == MAP_FAILED) {
+        if (io->sq_ring != MAP_FAILED) {
+            munmap(io->sq_ring, io->sq_ring_size);
+        }
+        if (io->cq_ring != MAP_FAILED) {
+            munmap(io->cq_ring, io->cq_ring_size);
+        }
+        if (io->sqes != MAP_FAILED) {
+            munmap(io->sqes, io->sqes_size);
+        }
+        close(fd);
+        return false;
+    }
+
+    io->ring_fd = fd;
+    io->sq_tail = (unsigned int *) ((char *) io->sq_ring + params.sq_off.tail);
+    io->sq_mask =
+        *(unsigned int *) ((char *) io->sq_ring + params.sq_off.ring_mask);
+    io->sq_array =
+        (unsigned int *) ((char *) io->sq_ring + params.sq_off.array);
+    io->cq_head = (unsigned int *) ((char *) io->cq_ring + params.cq_off.head);
+    io->cq_tail = (unsigned int *) ((char *) io->cq_ring + params.cq_off.tail);
+    io->cq_mask =
+        *(unsigned int *) ((char *) io->cq_ring + params.cq_off.ring_mask);
+    io->cqes =
+        (struct io_uring_cqe *) ((char *) io->cq_ring + params.cq_off.cqes);
+    return true;
+}
+
+static void
+flt_io_uring_done(struct flt_io *io)
+{
+    munmap(io->sqes, io->sqes_size);
+    munmap(io->cq_ring, io->cq_ring_size);
+    munmap(io->sq_ring, io->sq_ring_size);
+    close(io->ring_fd);
+}
+
+/* Must hold `io->lock`.  A NULL `req` tells the completion thread to stop.
+ * Returns 0, or a negative errno value if the kernel wouldn't take the
+ * operation. */
+static int
+flt_io_uring_submit(struct flt_io *io, struct flt_io_request *req)
+{
+    /* We're the only submitter, and we submit every entry right away, so the
+     * submission ring always has room. */
+    unsigned int  tail = *io->sq_tail;
+    unsigned int  index = tail & io->sq_mask;
+    struct io_uring_sqe  *sqe = &io->sqes[index];
+    int  rc;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    if (req == NULL) {
+        sqe->opcode = IORING_OP_NOP;
+    } else {
+        sqe->opcode =
+            (req->op == FLT_IO_READ)? IORING_OP_READ: IORING_OP_WRITE;
+        sqe->fd = req->fd;
+        sqe->addr = (uintptr_t) req->buf;
+        sqe->len = req->len;
+        sqe->off = req->offset;
+    }
+    sqe->user_data = (uintptr_t) req;
+    io->sq_array[index] = index;
+    flt_write_barrier();
+    *io->sq_tail = tail + 1;
+
+    while ((rc = flt_io_uring_enter(io->ring_fd, 1, 0, 0)) < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            /* The completion ring has overflowed; wait for the completion
+             * thread to drain it. */
+            FLT_THREAD_YIELD();
+            continue;
+        }
+        /* The kernel didn't consume the entry, so take it back. */
+        rc = -errno;
+        *io->sq_tail = tail;
+        return rc;
+    }
+    return 0;
+}
+
+static int
+flt__io_uring_run(struct cork_thread_body *body)
+{
+    struct flt_io  *io = cork_container_of(body, struct flt_io, body);
+    bool  stopping = false;
+
+    while (!stopping) {
+        unsigned int  head;
+        unsigned int  tail;
+
+        /* If this is interrupted, we'll just go around again. */
+        (void) flt_io_uring_enter(io->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+
+        head = *io->cq_head;
+        tail = *io->cq_tail;
+        flt_read_barrier();
+        for (; head != tail; head++) {
+            struct io_uring_cqe  *cqe = &io->cqes[head & io->cq_mask];
+            struct flt_io_request  *req =
+                (struct flt_io_request *) (uintptr_t) cqe->user_data;
+            if (req == NULL) {
+                stopping = true;
+            } else {
+                req->result = cqe->res;
+                flt_fleet_io_complete(io->fleet, req);
+            }
+        }
+        flt_full_barrier();
+        *io->cq_head = head;
+    }
+    return 0;
+}
+
+#endif /* FLT_HAVE_IO_URING */
+
+
+static int
+flt__io_blocking_run(struct cork_thread_body *body)
+{
+    struct flt_io  *io = cork_container_of(body, struct flt_io, body);
+    pthread_mutex_lock(&io->lock);
+    while (true) {
+        struct flt_io_request  *req;
+        while (io->head == NULL && !io->stopping) {
+            pthread_cond_wait(&io->cond, &io->lock);
+        }
+        if (io->head == NULL) {
+            break;
+        }
+        req = io->head;
+        io->head = req->next;
+        pthread_mutex_unlock(&io->lock);
+
+        req->result = flt_io_perform(req);
+        flt_fleet_io_complete(io->fleet, req);
+
+        pthread_mutex_lock(&io->lock);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return 0;
+}
+
+#define flt_io_uses_uring(io) \
+    (FLT_HAVE_IO_URING && (io)->body.run != flt__io_blocking_run)
+
+struct flt_io *
+flt_io_new(struct flt_fleet *fleet)
+{
+    struct flt_io  *io = cork_new(struct flt_io);
+    io->fleet = fleet;
+    io->stopping = false;
+    io->head = NULL;
+    io->tail = NULL;
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->cond, NULL);
+    io->body.run = flt__io_blocking_run;
+    io->body.free = flt__io_thread_free;
+#if FLT_HAVE_IO_URING
+    if (flt_io_uring_init(io)) {
+        io->body.run = flt__io_uring_run;
+    }
+#endif
+    io->thread = cork_thread_new("io", &io->body);
+    cork_thread_start(io->thread);
+    return io;
+}
+
+void
+flt_io_free(struct flt_io *io)
+{
+    pthread_mutex_lock(&io->lock);
+    io->stopping = true;
+#if FLT_HAVE_IO_URING
+    if (flt_io_uses_uring(io)) {
+        /* A NOP with no request wakes up the completion thread and tells it to
+         * stop.  If the kernel won't take it, there's nothing else we can use
+         * to wake it up. */
+        int  rc = flt_io_uring_submit(io, NULL);
+        if (CORK_UNLIKELY(rc != 0)) {
+            fprintf(stderr, "fleet: Cannot stop I/O thread: %s\n",
+                    strerror(-rc));
+            abort();
+        }
+    }
+#endif
+    pthread_cond_signal(&io->cond);
+    pthread_mutex_unlock(&io->lock);
+    cork_thread_join(io->thread);
+#if FLT_HAVE_IO_URING
+    if (flt_io_uses_uring(io)) {
+        flt_io_uring_done(io);
+    }
+#endif
+    pthread_cond_destroy(&io->cond);
+    pthread_mutex_destroy(&io->lock);
+    free(io);
+}
+
+void
+flt_io_submit(struct flt_io *io, struct flt_io_request *req)
+{
+    pthread_mutex_lock(&io->lock);
+#if FLT_HAVE_IO_URING
+    if (flt_io_uses_uring(io)) {
+        int  rc = flt_io_uring_submit(io, req);
+        pthread_mutex_unlock(&io->lock);
+        if (CORK_UNLIKELY(rc < 0)) {
+            req->result = rc;
+            flt_fleet_io_complete(io->fleet, req);
+        }
+        return;
+    }
+#endif
+    req->next = NULL;
+    if (io->head == NULL) {
+        io->head = req;
+    } else {
+        io->tail->next = req;
+    }
+    io->tail = req;
+    pthread_cond_signal(&io->cond);
+    pthread_mutex_unlock(&io->lock);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Submitting operations
+ */
+
+static struct flt_io *
+flt_fleet_io(struct flt_fleet *fleet)
+{
+    struct flt_io  *io = fleet->io;
+    if (CORK_UNLIKELY(io == NULL)) {
+        pthread_mutex_lock(&fleet->lock);
+        if (fleet->io == NULL) {
+            io = flt_io_new(fleet);
+            flt_write_barrier();
+            fleet->io = io;
+        }
+        io = fleet->io;
+        pthread_mutex_unlock(&fleet->lock);
+    }
+    return io;
+}
+
+static void
+flt_io_start(struct flt *pflt, enum flt_io_op op, int fd, void *buf,
+             size_t len, off_t offset, struct flt_task *task)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_task_group  *current_group = flt_current_group(flt);
+    struct flt_task_group_ctx  *ctx =
+        flt_task_group_get_ctx(flt, current_group);
+    struct flt_io_request  *req = cork_new(struct flt_io_request);
+
+    /* The continuation belongs to the current group, and is counted in our
+     * context's share of it until the operation finishes; see flt_run_later for
+     * why we don't need to check active_ctx_count.  Our arrival at the fleet's
+     * active indicator is released by whichever context schedules the
+     * continuation. */
+    task->group = current_group;
+    cork_size_atomic_add(&ctx->task_count, 1);
+    flt_snzi_arrive(flt->active_leaf);
+
+    req->task = task;
+    req->flt = flt;
+    req->op = op;
+    req->fd = fd;
+    req->buf = buf;
+    req->len = len;
+    req->offset = offset;
+    flt_io_submit(flt_fleet_io(flt->fleet), req);
+}
+
+void
+flt_read_async(struct flt *pflt, int fd, void *buf, size_t len, off_t offset,
+               struct flt_task *task)
+{
+    flt_io_start(pflt, FLT_IO_READ, fd, buf, len, offset, task);
+}
+
+void
+flt_write_async(struct flt *pflt, int fd, const void *buf, size_t len,
+                off_t offset, struct flt_task *task)
+{
+    flt_io_start(pflt, FLT_IO_WRITE, fd, (void *) buf, len, offset, task);
+}
+
+ssize_t
+flt_io_result(struct flt *pflt)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    return flt_current_task(flt)->io_result;
+}
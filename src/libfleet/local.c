@@ -18,28 +18,31 @@
  * Context-local data
  */
 
-/* To eliminate false sharing we want to make sure that each element of the
- * instances array is in a separate cache line.  This involves two steps: first,
- * we have to round up the size of each element so that it's a multiple of the
- * cache line size.  This is handled in the fleet.h public header file with all
- * of the calls to flt_round_to_cache_line.  Second, we have to make sure that
- * the start of the array is also rounded to a cache line.  malloc() doesn't
- * guarantee this, and if we get an unaligned array, then each element will span
- * a cache line boundary, and we'll definitely get some false sharing.
+/* To eliminate false sharing we want to make sure that each instance is in a
+ * separate cache line.  This involves two steps: first, we have to round up the
+ * size of each instance so that it's a multiple of the cache line size.
+ * Second, we have to make sure that each instance also starts on a cache line
+ * boundary.
  *
- * To support this second step, we have two pointers for the array of elements.
- * unaligned_instances is the raw pointer that we get back from malloc().
- * public.instances is guaranteed to be aligned to a cache line.  This aligned
- * pointer is visible via the public API, and is how user code gets pointers to
- * the individual elements of the array.  We have to keep the unaligned pointer
- * around, as well, since we'll have to pass the same pointer to free() that we
- * got from malloc().
+ * On a machine with a single NUMA node, we allocate all of the instances in one
+ * array.  malloc() doesn't guarantee that the array is aligned to a cache line,
+ * so we allocate an extra cache line of space, and bump the start of the array
+ * up to the next boundary.  unaligned_instances is the raw pointer that we have
+ * to give back to free().
+ *
+ * On NUMA machines, we also want each instance to live on the same node as the
+ * context that owns it.  Memory is placed onto nodes a page at a time, so
+ * instead of sharing one array, each instance gets its own allocation from its
+ * context's node.  flt_node_alloc carves small regions out of per-node arenas,
+ * aligned to at least a cache line, so this doesn't waste a page per instance.
+ * In both cases, the public `instances` array points at each context's
+ * instance.
  */
 
 struct flt_local_priv {
     struct flt_local  public;
     void  *unaligned_instances;
-    size_t  padded_size;
+    size_t  stride;
     void  *ud;
     flt_local_done_f  *done_instance;
 };
@@ -63,29 +66,34 @@ flt_local_new_size(struct flt *pflt, size_t instance_size, void *ud,
 {
     unsigned int  i;
     struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_fleet  *fleet = flt->fleet;
     struct flt_local_priv  *local = cork_new(struct flt_local_priv);
-    size_t  padded_size = flt_round_to_cache_line(instance_size);
-    size_t  full_size;
-    char  *instance;
+    size_t  stride = flt_round_to_cache_line(instance_size);
+    size_t  count = flt->public.count;
 
     local->ud = ud;
     local->done_instance = done_instance;
-    local->padded_size = padded_size;
+    local->stride = stride;
+    local->public.instances = cork_calloc(count, sizeof(void *));
 
-    /* Normally the array is simply `count` copies of padded size.  But since we
-     * might need to align the pointer after it's been allocated, we allocate an
-     * extra cache line of space.  This gives us the wiggle room that we need to
-     * bump the pointer up to the next cache line boundary without running out
-     * of space at the end of the array. */
-    full_size = flt->public.count * padded_size;
-    local->unaligned_instances =
-        cork_calloc(1, full_size + FLT_CACHE_LINE_SIZE);
-    instance = align_to_cache_line(local->unaligned_instances);
-    local->public.instances = instance;
+    if (flt_node_page_size(&fleet->topology) == 1) {
+        char  *instance;
+        local->unaligned_instances =
+            cork_calloc(1, count * stride + FLT_CACHE_LINE_SIZE);
+        instance = align_to_cache_line(local->unaligned_instances);
+        for (i = 0; i < count; i++, instance += stride) {
+            local->public.instances[i] = instance;
+        }
+    } else {
+        local->unaligned_instances = NULL;
+        for (i = 0; i < count; i++) {
+            local->public.instances[i] = flt_node_alloc
+                (&fleet->topology, fleet->contexts[i]->cpu->node, stride);
+        }
+    }
 
-    /* Now that we have an aligned array of elements, initialize each one. */
-    for (i = 0; i < flt->public.count; i++, instance += padded_size) {
-        init_instance(pflt, ud, instance);
+    for (i = 0; i < count; i++) {
+        init_instance(pflt, ud, local->public.instances[i]);
     }
     return &local->public;
 }
@@ -97,11 +105,17 @@ flt_local_free(struct flt *pflt, struct flt_local *plocal)
     struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
     struct flt_local_priv  *local =
         cork_container_of(plocal, struct flt_local_priv, public);
-    char  *instance;
-    for (i = 0, instance = local->public.instances; i < flt->public.count;
-         i++, instance += local->padded_size) {
-        local->done_instance(pflt, local->ud, instance);
+    for (i = 0; i < flt->public.count; i++) {
+        local->done_instance(pflt, local->ud, local->public.instances[i]);
+    }
+    if (local->unaligned_instances != NULL) {
+        free(local->unaligned_instances);
+    } else {
+        for (i = 0; i < flt->public.count; i++) {
+            flt_node_free(&flt->fleet->topology, local->public.instances[i],
+                          local->stride);
+        }
     }
-    free(local->unaligned_instances);
+    free(local->public.instances);
     free(local);
 }
@@ -0,0 +1,248 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "libcork/core.h"
+
+#include "fleet.h"
+#include "fleet/task.h"
+#include "fleet/topology.h"
+
+
+/*-----------------------------------------------------------------------
+ * Memory pools
+ */
+
+/* Each context has its own share of the pool (stored in an flt_local), which
+ * acts as a magazine of unused instances that the context can allocate from
+ * without any synchronization.  Whenever the magazine is empty, we carve new
+ * instances out of the context's current slab, allocating a new slab (on the
+ * context's NUMA node) once that's used up.
+ *
+ * Every instance remembers which context's share it was carved out of.  A
+ * context that frees one of its own instances pushes it back onto its
+ * magazine.  A context that frees some other context's instance pushes it
+ * onto the owner's `remote` stack with a CAS instead; the owner takes
+ * everything on that stack in one swap, once its magazine runs dry.  That
+ * means that no context ever hoards another context's memory, even if
+ * instances always flow from one context to another, and the only contended
+ * cache line is the owner's `remote` pointer, which we keep away from the
+ * fields that the owner touches on every allocation.
+ *
+ * Each instance is preceded by a small header, which holds the owner and the
+ * free list link, so that a freed instance's contents are left intact for the
+ * `reuse` callback. */
+
+struct flt_pool_ctx;
+
+struct flt_pool_instance {
+    struct flt_pool_ctx  *owner;
+    struct flt_pool_instance  *next;
+};
+
+#define FLT_POOL_HEADER_SIZE  sizeof(struct flt_pool_instance)
+
+#define flt_pool_instance_data(inst) \
+    ((void *) (((char *) (inst)) + FLT_POOL_HEADER_SIZE))
+
+#define flt_pool_data_instance(data) \
+    ((struct flt_pool_instance *) (((char *) (data)) - FLT_POOL_HEADER_SIZE))
+
+/* The first instance in each slab starts on a cache line boundary.  `raw` and
+ * `size` are what we got from (and have to give back to) flt_node_alloc. */
+struct flt_pool_slab {
+    struct flt_pool_slab  *next;
+    void  *raw;
+    size_t  size;
+    /* The instances that we haven't carved out of the slab yet */
+    char  *unused;
+    char  *end;
+};
+
+struct flt_pool_ctx {
+    struct flt_pool_instance  *magazine;
+    struct flt_pool_slab  *slabs;
+    uint8_t  remote_padding[FLT_CACHE_LINE_SIZE];
+    /* Instances that other contexts have freed */
+    struct flt_pool_instance * volatile  remote;
+};
+
+struct flt_pool {
+    struct flt_local  *ctxs;
+    /* The distance between consecutive instances in a slab */
+    size_t  stride;
+    size_t  instance_size;
+    size_t  slab_size;
+    void  *ud;
+    flt_pool_init_f  *init;
+    flt_pool_reuse_f  *reuse;
+    flt_pool_done_f  *done;
+    const struct flt_topology  *topology;
+    /* The context that created the pool, which we need to free `ctxs` */
+    struct flt  *flt;
+};
+
+/* 16Kb slabs, unless the instances are large enough that we couldn't fit a
+ * reasonable number of them in that */
+#define FLT_POOL_SLAB_SIZE  (16 * 1024)
+#define FLT_POOL_MIN_SLAB_COUNT  8
+
+/* Every instance is aligned as well as malloc would align it */
+#define FLT_POOL_ALIGNMENT  16
+
+#define flt_pool_round_up(sz, unit)  (((sz) + (unit) - 1) / (unit) * (unit))
+
+static void
+flt_pool_ctx_init(struct flt *flt, void *ud, void *vctx)
+{
+    struct flt_pool_ctx  *ctx = vctx;
+    ctx->magazine = NULL;
+    ctx->slabs = NULL;
+    ctx->remote = NULL;
+}
+
+static void
+flt_pool_ctx_done(struct flt *flt, void *ud, void *vctx)
+{
+    struct flt_pool  *pool = ud;
+    struct flt_pool_ctx  *ctx = vctx;
+    struct flt_pool_slab  *slab = ctx->slabs;
+    while (slab != NULL) {
+        struct flt_pool_slab  *next = slab->next;
+        if (pool->done != NULL) {
+            char  *inst = (char *) slab + flt_round_to_cache_line
+                (sizeof(struct flt_pool_slab));
+            for (; inst < slab->unused; inst += pool->stride) {
+                pool->done(pool->ud, flt_pool_instance_data(inst));
+            }
+        }
+        flt_node_free(pool->topology, slab->raw, slab->size);
+        slab = next;
+    }
+}
+
+struct flt_pool *
+flt_pool_new_size(struct flt *pflt, size_t instance_size, void *ud,
+                  flt_pool_init_f *init, flt_pool_reuse_f *reuse,
+                  flt_pool_done_f *done)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_pool  *pool = cork_new(struct flt_pool);
+    size_t  slab_header_size =
+        flt_round_to_cache_line(sizeof(struct flt_pool_slab));
+    size_t  min_slab_size;
+
+    pool->stride = flt_pool_round_up
+        (FLT_POOL_HEADER_SIZE + instance_size, FLT_POOL_ALIGNMENT);
+    pool->instance_size = instance_size;
+    min_slab_size =
+        slab_header_size + FLT_POOL_MIN_SLAB_COUNT * pool->stride;
+    pool->slab_size = (min_slab_size > FLT_POOL_SLAB_SIZE)?
+        min_slab_size: FLT_POOL_SLAB_SIZE;
+    pool->ud = ud;
+    pool->init = init;
+    pool->reuse = reuse;
+    pool->done = done;
+    pool->topology = &flt->fleet->topology;
+    pool->flt = pflt;
+    pool->ctxs = flt_local_new_size
+        (pflt, sizeof(struct flt_pool_ctx), pool,
+         flt_pool_ctx_init, flt_pool_ctx_done);
+    return pool;
+}
+
+void
+flt_pool_free(struct flt_pool *pool)
+{
+    flt_local_free(pool->flt, pool->ctxs);
+    free(pool);
+}
+
+/* Only ever called by the context that owns `ctx` */
+static struct flt_pool_instance *
+flt_pool_carve(struct flt_priv *flt, struct flt_pool *pool,
+               struct flt_pool_ctx *ctx)
+{
+    struct flt_pool_slab  *slab = ctx->slabs;
+    struct flt_pool_instance  *inst;
+
+    if (CORK_UNLIKELY(slab == NULL || slab->unused == slab->end)) {
+        size_t  slab_header_size =
+            flt_round_to_cache_line(sizeof(struct flt_pool_slab));
+        size_t  count = (pool->slab_size - slab_header_size) / pool->stride;
+        /* flt_node_alloc only promises malloc's alignment, so allocate an
+         * extra cache line's worth, and make sure that the slab header (and
+         * therefore the first instance) starts on a cache line boundary. */
+        size_t  size = pool->slab_size + FLT_CACHE_LINE_SIZE;
+        void  *raw = flt_node_alloc(pool->topology, flt->cpu->node, size);
+        slab = (struct flt_pool_slab *)
+            flt_pool_round_up((uintptr_t) raw, FLT_CACHE_LINE_SIZE);
+        slab->raw = raw;
+        slab->size = size;
+        slab->unused = (char *) slab + slab_header_size;
+        slab->end = slab->unused + count * pool->stride;
+        slab->next = ctx->slabs;
+        ctx->slabs = slab;
+    }
+
+    inst = (struct flt_pool_instance *) slab->unused;
+    slab->unused += pool->stride;
+    inst->owner = ctx;
+    if (pool->init == NULL) {
+        memset(flt_pool_instance_data(inst), 0, pool->instance_size);
+    } else {
+        pool->init(pool->ud, flt_pool_instance_data(inst));
+    }
+    return inst;
+}
+
+void *
+flt_pool_new_instance(struct flt_pool *pool, struct flt *pflt)
+{
+    struct flt_priv  *flt = cork_container_of(pflt, struct flt_priv, public);
+    struct flt_pool_ctx  *ctx =
+        flt_local_get(pflt, pool->ctxs, struct flt_pool_ctx);
+    struct flt_pool_instance  *inst = ctx->magazine;
+
+    if (CORK_UNLIKELY(inst == NULL)) {
+        if (ctx->remote == NULL) {
+            return flt_pool_instance_data(flt_pool_carve(flt, pool, ctx));
+        }
+        inst = __sync_lock_test_and_set(&ctx->remote, NULL);
+    }
+
+    ctx->magazine = inst->next;
+    if (pool->reuse == NULL) {
+        memset(flt_pool_instance_data(inst), 0, pool->instance_size);
+    } else {
+        pool->reuse(pool->ud, flt_pool_instance_data(inst));
+    }
+    return flt_pool_instance_data(inst);
+}
+
+void
+flt_pool_free_instance(struct flt_pool *pool, struct flt *flt, void *instance)
+{
+    struct flt_pool_ctx  *ctx =
+        flt_local_get(flt, pool->ctxs, struct flt_pool_ctx);
+    struct flt_pool_instance  *inst = flt_pool_data_instance(instance);
+    struct flt_pool_ctx  *owner = inst->owner;
+
+    if (CORK_LIKELY(owner == ctx)) {
+        inst->next = ctx->magazine;
+        ctx->magazine = inst;
+    } else {
+        struct flt_pool_instance  *head;
+        do {
+            head = owner->remote;
+            inst->next = head;
+        } while (!__sync_bool_compare_and_swap(&owner->remote, head, inst));
+    }
+}
@@ -0,0 +1,237 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <time.h>
+
+#if defined(__MACH__)
+#include <mach/mach_time.h>
+#endif
+
+#include "libcork/core.h"
+#include "libcork/ds.h"
+
+#include "fleet.h"
+#include "fleet/task.h"
+#include "fleet/timer.h"
+
+
+/*-----------------------------------------------------------------------
+ * Clock
+ */
+
+uint64_t
+flt_timer_now(void)
+{
+#if defined(__MACH__)
+    static mach_timebase_info_data_t  timebase;
+    if (CORK_UNLIKELY(timebase.denom == 0)) {
+        (void) mach_timebase_info(&timebase);
+    }
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+uint64_t
+flt_now(void)
+{
+    return flt_timer_now();
+}
+
+
+/*-----------------------------------------------------------------------
+ * Timer wheels
+ */
+
+#define flt_level_shift(level)  ((level) * FLT_TIMER_LEVEL_BITS)
+#define flt_level_mask(level)   ((UINT64_C(1) << flt_level_shift(level)) - 1)
+#define FLT_SLOT_MASK  (FLT_TIMER_SLOT_COUNT - 1)
+
+/* The furthest away (in ticks) that the wheel can place a timer */
+#define FLT_TIMER_RANGE  (UINT64_C(1) << flt_level_shift(FLT_TIMER_LEVEL_COUNT))
+
+/* The first tick that starts at or after `deadline`.  Once we've processed
+ * that tick, the deadline has definitely passed. */
+static uint64_t
+flt_timer_deadline_tick(uint64_t deadline)
+{
+    return deadline / FLT_TIMER_TICK + (deadline % FLT_TIMER_TICK != 0);
+}
+
+void
+flt_timer_wheel_init(struct flt_timer_wheel *wheel)
+{
+    unsigned int  level;
+    unsigned int  slot;
+    wheel->next = 0;
+    wheel->count = 0;
+    for (level = 0; level < FLT_TIMER_LEVEL_COUNT; level++) {
+        wheel->occupied[level] = 0;
+        for (slot = 0; slot < FLT_TIMER_SLOT_COUNT; slot++) {
+            cork_dllist_init(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+/* `tick` must not be before `wheel->next`. */
+static void
+flt_timer_wheel_place(struct flt_timer_wheel *wheel, struct flt_task *task,
+                      uint64_t tick)
+{
+    uint64_t  delta = tick - wheel->next;
+    unsigned int  level = 0;
+    unsigned int  slot;
+    if (CORK_UNLIKELY(delta >= FLT_TIMER_RANGE)) {
+        delta = FLT_TIMER_RANGE - 1;
+        tick = wheel->next + delta;
+    }
+    while (delta >= (UINT64_C(1) << flt_level_shift(level + 1))) {
+        level++;
+    }
+    slot = (tick >> flt_level_shift(level)) & FLT_SLOT_MASK;
+    cork_dllist_add_to_tail(&wheel->slots[level][slot], &task->item);
+    wheel->occupied[level] |= UINT64_C(1) << slot;
+}
+
+bool
+flt_timer_wheel_add(struct flt_timer_wheel *wheel, struct flt_task *task,
+                    uint64_t now)
+{
+    uint64_t  tick = flt_timer_deadline_tick(task->deadline);
+    if (wheel->count == 0) {
+        /* There's nothing to catch up on, so skip ahead to the current time. */
+        uint64_t  now_tick = now / FLT_TIMER_TICK;
+        if (wheel->next < now_tick) {
+            wheel->next = now_tick;
+        }
+    }
+    if (tick < wheel->next) {
+        return false;
+    }
+    flt_timer_wheel_place(wheel, task, tick);
+    wheel->count++;
+    return true;
+}
+
+/* Returns the next tick at which some slot needs to be processed: either a
+ * level 0 slot that has expired timers in it, or a higher-level slot that needs
+ * to be cascaded. */
+static uint64_t
+flt_timer_wheel_next_event(struct flt_timer_wheel *wheel)
+{
+    uint64_t  result = UINT64_MAX;
+    unsigned int  level;
+    for (level = 0; level < FLT_TIMER_LEVEL_COUNT; level++) {
+        unsigned int  shift = flt_level_shift(level);
+        uint64_t  occupied = wheel->occupied[level];
+        uint64_t  group;
+        unsigned int  index;
+        uint64_t  tick;
+        if (occupied == 0) {
+            continue;
+        }
+        /* The first slot in this level that starts at or after `next` */
+        group = wheel->next >> shift;
+        if ((wheel->next & flt_level_mask(level)) != 0) {
+            group++;
+        }
+        index = group & FLT_SLOT_MASK;
+        occupied = (occupied >> index) |
+            (occupied << ((FLT_TIMER_SLOT_COUNT - index) & FLT_SLOT_MASK));
+        tick = (group + __builtin_ctzll(occupied)) << shift;
+        if (tick < result) {
+            result = tick;
+        }
+    }
+    return result;
+}
+
+static void
+flt_timer_wheel_cascade(struct flt_timer_wheel *wheel, unsigned int level,
+                        unsigned int slot)
+{
+    struct cork_dllist  *list = &wheel->slots[level][slot];
+    struct cork_dllist  pending;
+    struct cork_dllist_item  *curr;
+    struct cork_dllist_item  *next;
+    struct flt_task  *task;
+
+    if ((wheel->occupied[level] & (UINT64_C(1) << slot)) == 0) {
+        return;
+    }
+    wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+
+    /* A timer might land back in this same slot, so take them all out first. */
+    cork_dllist_init(&pending);
+    cork_dllist_foreach(list, curr, next, struct flt_task, task, item) {
+        cork_dllist_add_to_tail(&pending, &task->item);
+    }
+    cork_dllist_init(list);
+    cork_dllist_foreach(&pending, curr, next, struct flt_task, task, item) {
+        uint64_t  tick = flt_timer_deadline_tick(task->deadline);
+        flt_timer_wheel_place
+            (wheel, task, (tick < wheel->next)? wheel->next: tick);
+    }
+}
+
+void
+flt_timer_wheel_advance(struct flt_timer_wheel *wheel, uint64_t now,
+                        struct cork_dllist *expired)
+{
+    uint64_t  now_tick = now / FLT_TIMER_TICK;
+    while (wheel->count > 0) {
+        uint64_t  tick = flt_timer_wheel_next_event(wheel);
+        unsigned int  level;
+        unsigned int  slot;
+        if (tick > now_tick) {
+            break;
+        }
+
+        /* Cascade from the top down, so that anything that falls out of a
+         * higher level into a lower level's current slot gets cascaded (or
+         * expired) in turn. */
+        wheel->next = tick;
+        for (level = FLT_TIMER_LEVEL_COUNT - 1; level > 0; level--) {
+            if ((tick & flt_level_mask(level)) == 0) {
+                flt_timer_wheel_cascade
+                    (wheel, level,
+                     (tick >> flt_level_shift(level)) & FLT_SLOT_MASK);
+            }
+        }
+
+        slot = tick & FLT_SLOT_MASK;
+        if (wheel->occupied[0] & (UINT64_C(1) << slot)) {
+            struct cork_dllist  *list = &wheel->slots[0][slot];
+            struct cork_dllist_item  *curr;
+            struct cork_dllist_item  *next;
+            struct flt_task  *task;
+            cork_dllist_foreach(list, curr, next, struct flt_task, task, item) {
+                cork_dllist_add_to_tail(expired, &task->item);
+                wheel->count--;
+            }
+            cork_dllist_init(list);
+            wheel->occupied[0] &= ~(UINT64_C(1) << slot);
+        }
+        wheel->next = tick + 1;
+    }
+    if (wheel->next <= now_tick) {
+        wheel->next = now_tick + 1;
+    }
+}
+
+uint64_t
+flt_timer_wheel_delay(struct flt_timer_wheel *wheel, uint64_t now)
+{
+    uint64_t  tick = flt_timer_wheel_next_event(wheel);
+    uint64_t  when = tick * FLT_TIMER_TICK;
+    return (when > now)? when - now: 0;
+}
@@ -0,0 +1,862 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* Needed for the CPU affinity functions in sched.h */
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcork/core.h"
+#include "libcork/ds.h"
+
+#include "fleet.h"
+#include "fleet/threads.h"
+#include "fleet/topology.h"
+
+
+/*-----------------------------------------------------------------------
+ * CPU lists
+ */
+
+/* The kernel describes sets of CPUs using lists like "0-3,8,10-11".  Calls
+ * `visit` for each CPU in the list, in order.  Returns the number of CPUs in
+ * the list. */
+
+typedef void
+flt_cpu_list_visit_f(void *ud, unsigned int cpu);
+
+static unsigned int
+flt_cpu_list_parse(const char *str, void *ud, flt_cpu_list_visit_f *visit)
+{
+    unsigned int  count = 0;
+    while (*str != '\0' && *str != '\n') {
+        char  *endptr;
+        unsigned long  first = strtoul(str, &endptr, 10);
+        unsigned long  last = first;
+        unsigned long  cpu;
+        if (endptr == str) {
+            break;
+        }
+        str = endptr;
+        if (*str == '-') {
+            str++;
+            last = strtoul(str, &endptr, 10);
+            if (endptr == str) {
+                break;
+            }
+            str = endptr;
+        }
+        for (cpu = first; cpu <= last; cpu++, count++) {
+            if (visit != NULL) {
+                visit(ud, cpu);
+            }
+        }
+        if (*str == ',') {
+            str++;
+        }
+    }
+    return count;
+}
+
+static void
+flt_cpu_list_save_first(void *ud, unsigned int cpu)
+{
+    unsigned int  *first = ud;
+    if (cpu < *first) {
+        *first = cpu;
+    }
+}
+
+static void
+flt_cpu_list_save(void *ud, unsigned int cpu)
+{
+    unsigned int  **next = ud;
+    **next = cpu;
+    (*next)++;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Reading sysfs
+ */
+
+/* Reads the first line of a sysfs file into `dest`.  Returns false if the file
+ * can't be read. */
+static bool
+flt_sysfs_read(struct cork_buffer *dest, const char *path)
+{
+    char  line[4096];
+    FILE  *file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    if (fgets(line, sizeof(line), file) == NULL) {
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    cork_buffer_set_string(dest, line);
+    return true;
+}
+
+/* Returns the smallest CPU in the CPU list stored in a sysfs file, or
+ * `default_id` if the file can't be read. */
+static unsigned int
+flt_sysfs_read_first_cpu(struct cork_buffer *buf, const char *path,
+                         unsigned int default_id)
+{
+    unsigned int  first = (unsigned int) -1;
+    if (!flt_sysfs_read(buf, path)) {
+        return default_id;
+    }
+    flt_cpu_list_parse(buf->buf, &first, flt_cpu_list_save_first);
+    return (first == (unsigned int) -1)? default_id: first;
+}
+
+/* The last-level cache is the unified cache with the highest level. */
+static unsigned int
+flt_sysfs_read_llc(struct cork_buffer *buf, const char *sysfs_path,
+                   unsigned int cpu, unsigned int default_id)
+{
+    unsigned int  index;
+    unsigned long  best_level = 0;
+    unsigned int  result = default_id;
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+
+    for (index = 0; ; index++) {
+        unsigned long  level;
+        cork_buffer_printf(&path, "%s/cpu%u/cache/index%u/level",
+                           sysfs_path, cpu, index);
+        if (!flt_sysfs_read(buf, path.buf)) {
+            break;
+        }
+        level = strtoul(buf->buf, NULL, 10);
+
+        cork_buffer_printf(&path, "%s/cpu%u/cache/index%u/type",
+                           sysfs_path, cpu, index);
+        if (!flt_sysfs_read(buf, path.buf) ||
+            strncmp(buf->buf, "Instruction", 11) == 0) {
+            continue;
+        }
+
+        if (level > best_level) {
+            cork_buffer_printf(&path, "%s/cpu%u/cache/index%u/shared_cpu_list",
+                               sysfs_path, cpu, index);
+            best_level = level;
+            result = flt_sysfs_read_first_cpu(buf, path.buf, default_id);
+        }
+    }
+
+    cork_buffer_done(&path);
+    return result;
+}
+
+/* Each CPU directory contains a `nodeN` symlink for the NUMA node that the CPU
+ * belongs to. */
+static unsigned int
+flt_sysfs_read_node(const char *sysfs_path, unsigned int cpu,
+                    unsigned int default_id)
+{
+    unsigned int  result = default_id;
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    DIR  *dir;
+    struct dirent  *entry;
+
+    cork_buffer_printf(&path, "%s/cpu%u", sysfs_path, cpu);
+    dir = opendir(path.buf);
+    if (dir != NULL) {
+        while ((entry = readdir(dir)) != NULL) {
+            char  *endptr;
+            unsigned long  node;
+            if (strncmp(entry->d_name, "node", 4) != 0) {
+                continue;
+            }
+            node = strtoul(entry->d_name + 4, &endptr, 10);
+            if (endptr != entry->d_name + 4 && *endptr == '\0') {
+                result = node;
+                break;
+            }
+        }
+        closedir(dir);
+    }
+
+    cork_buffer_done(&path);
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Topology
+ */
+
+/* These are defined below, along with the rest of the node-local memory
+ * functions. */
+static void
+flt_node_arenas_init(struct flt_topology *topology);
+
+static void
+flt_node_arenas_done(struct flt_topology *topology);
+
+static void
+flt_topology_init_flat(struct flt_topology *topology)
+{
+    unsigned int  i;
+    topology->cpu_count = flt_processor_count();
+    if (topology->cpu_count == 0) {
+        topology->cpu_count = 1;
+    }
+    topology->cpus = cork_calloc(topology->cpu_count, sizeof(struct flt_cpu));
+    for (i = 0; i < topology->cpu_count; i++) {
+        topology->cpus[i].id = i;
+        topology->cpus[i].core = i;
+        topology->cpus[i].llc = 0;
+        topology->cpus[i].node = 0;
+        topology->cpus[i].smt_index = 0;
+    }
+    topology->node_count = 1;
+    flt_node_arenas_init(topology);
+}
+
+void
+flt_topology_init(struct flt_topology *topology, const char *sysfs_path)
+{
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    unsigned int  *ids;
+    unsigned int  *next_id;
+    unsigned int  i;
+
+    cork_buffer_printf(&path, "%s/online", sysfs_path);
+    if (!flt_sysfs_read(&buf, path.buf) ||
+        (topology->cpu_count = flt_cpu_list_parse(buf.buf, NULL, NULL)) == 0) {
+        cork_buffer_done(&path);
+        cork_buffer_done(&buf);
+        flt_topology_init_flat(topology);
+        return;
+    }
+
+    ids = cork_calloc(topology->cpu_count, sizeof(unsigned int));
+    next_id = ids;
+    flt_cpu_list_parse(buf.buf, &next_id, flt_cpu_list_save);
+
+    topology->cpus = cork_calloc(topology->cpu_count, sizeof(struct flt_cpu));
+    for (i = 0; i < topology->cpu_count; i++) {
+        struct flt_cpu  *cpu = &topology->cpus[i];
+        cpu->id = ids[i];
+
+        /* We identify each core and cache by the smallest CPU that shares
+         * it. */
+        cork_buffer_printf(&path, "%s/cpu%u/topology/thread_siblings_list",
+                           sysfs_path, cpu->id);
+        cpu->core = flt_sysfs_read_first_cpu(&buf, path.buf, cpu->id);
+        cpu->llc = flt_sysfs_read_llc(&buf, sysfs_path, cpu->id, 0);
+        cpu->node = flt_sysfs_read_node(sysfs_path, cpu->id, 0);
+    }
+
+    /* Number the hardware threads within each core, and count the nodes. */
+    topology->node_count = 0;
+    for (i = 0; i < topology->cpu_count; i++) {
+        unsigned int  j;
+        bool  new_node = true;
+        struct flt_cpu  *cpu = &topology->cpus[i];
+        cpu->smt_index = 0;
+        for (j = 0; j < i; j++) {
+            if (topology->cpus[j].core == cpu->core) {
+                cpu->smt_index++;
+            }
+            if (topology->cpus[j].node == cpu->node) {
+                new_node = false;
+            }
+        }
+        if (new_node) {
+            topology->node_count++;
+        }
+    }
+
+    flt_node_arenas_init(topology);
+    free(ids);
+    cork_buffer_done(&path);
+    cork_buffer_done(&buf);
+}
+
+void
+flt_topology_done(struct flt_topology *topology)
+{
+    flt_node_arenas_done(topology);
+    free(topology->cpus);
+}
+
+enum flt_topology_tier
+flt_topology_distance(const struct flt_cpu *a, const struct flt_cpu *b)
+{
+    if (a->core == b->core) {
+        return FLT_TIER_SAME_CORE;
+    } else if (a->llc == b->llc) {
+        return FLT_TIER_SAME_LLC;
+    } else if (a->node == b->node) {
+        return FLT_TIER_SAME_NODE;
+    } else {
+        return FLT_TIER_REMOTE;
+    }
+}
+
+void
+flt_topology_order_victims(const struct flt_cpu * const *cpus,
+                           unsigned int count, unsigned int self,
+                           unsigned int *victims, unsigned int *tier_end)
+{
+    unsigned int  i;
+    unsigned int  tier;
+    unsigned int  next[FLT_TIER_COUNT];
+    unsigned int  tier_count[FLT_TIER_COUNT];
+
+    memset(tier_count, 0, sizeof(tier_count));
+    for (i = 0; i < count; i++) {
+        if (i != self) {
+            tier_count[flt_topology_distance(cpus[self], cpus[i])]++;
+        }
+    }
+
+    for (tier = 0, i = 0; tier < FLT_TIER_COUNT; tier++) {
+        next[tier] = i;
+        i += tier_count[tier];
+        tier_end[tier] = i;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (i != self) {
+            tier = flt_topology_distance(cpus[self], cpus[i]);
+            victims[next[tier]++] = i;
+        }
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Placement
+ */
+
+#define flt_compare_field(a, b, field) \
+    do { \
+        if ((a)->field != (b)->field) { \
+            return ((a)->field < (b)->field)? -1: 1; \
+        } \
+    } while (0)
+
+/* Neighboring CPUs are next to each other: fill up each core, then each cache,
+ * then each node. */
+static int
+flt_cpu_compare_compact(const void *va, const void *vb)
+{
+    const struct flt_cpu  *a = *(const struct flt_cpu * const *) va;
+    const struct flt_cpu  *b = *(const struct flt_cpu * const *) vb;
+    flt_compare_field(a, b, node);
+    flt_compare_field(a, b, llc);
+    flt_compare_field(a, b, core);
+    flt_compare_field(a, b, id);
+    return 0;
+}
+
+/* Use one hardware thread from every core before using any of their SMT
+ * siblings. */
+static int
+flt_cpu_compare_avoid_smt(const void *va, const void *vb)
+{
+    const struct flt_cpu  *a = *(const struct flt_cpu * const *) va;
+    const struct flt_cpu  *b = *(const struct flt_cpu * const *) vb;
+    flt_compare_field(a, b, smt_index);
+    return flt_cpu_compare_compact(va, vb);
+}
+
+/* Like avoid-SMT, but alternate between NUMA nodes.  We've stashed each CPU's
+ * position within its node in the `core` field of a scratch copy. */
+static int
+flt_cpu_compare_scatter(const void *va, const void *vb)
+{
+    const struct flt_cpu  *a = *(const struct flt_cpu * const *) va;
+    const struct flt_cpu  *b = *(const struct flt_cpu * const *) vb;
+    flt_compare_field(a, b, smt_index);
+    flt_compare_field(a, b, core);
+    flt_compare_field(a, b, node);
+    flt_compare_field(a, b, id);
+    return 0;
+}
+
+static const struct flt_cpu *
+flt_topology_find(struct flt_topology *topology, unsigned int id)
+{
+    unsigned int  i;
+    for (i = 0; i < topology->cpu_count; i++) {
+        if (topology->cpus[i].id == id) {
+            return &topology->cpus[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+flt_topology_order_scatter(struct flt_topology *topology,
+                           const struct flt_cpu **order)
+{
+    unsigned int  i;
+    unsigned int  n = topology->cpu_count;
+    struct flt_cpu  *scratch = cork_calloc(n, sizeof(struct flt_cpu));
+    const struct flt_cpu  **scratch_order =
+        cork_calloc(n, sizeof(struct flt_cpu *));
+
+    /* Start with the avoid-SMT order, and then number the CPUs within each
+     * (hardware thread, node) pair. */
+    for (i = 0; i < n; i++) {
+        order[i] = &topology->cpus[i];
+    }
+    qsort(order, n, sizeof(struct flt_cpu *), flt_cpu_compare_avoid_smt);
+    for (i = 0; i < n; i++) {
+        unsigned int  j;
+        scratch[i] = *order[i];
+        scratch[i].core = 0;
+        for (j = 0; j < i; j++) {
+            if (scratch[j].smt_index == scratch[i].smt_index &&
+                scratch[j].node == scratch[i].node) {
+                scratch[i].core++;
+            }
+        }
+        scratch_order[i] = &scratch[i];
+    }
+
+    qsort(scratch_order, n, sizeof(struct flt_cpu *), flt_cpu_compare_scatter);
+    for (i = 0; i < n; i++) {
+        order[i] = flt_topology_find(topology, scratch_order[i]->id);
+    }
+
+    free(scratch_order);
+    free(scratch);
+}
+
+void
+flt_topology_place(struct flt_topology *topology,
+                   enum flt_affinity_policy policy,
+                   const unsigned int *cpu_ids, unsigned int cpu_id_count,
+                   unsigned int count, const struct flt_cpu **dest)
+{
+    unsigned int  i;
+    unsigned int  n = topology->cpu_count;
+    const struct flt_cpu  **order;
+
+    if (policy == FLT_AFFINITY_EXPLICIT) {
+        /* Skip over any CPUs that aren't online. */
+        order = cork_calloc(cpu_id_count + 1, sizeof(struct flt_cpu *));
+        for (i = 0, n = 0; i < cpu_id_count; i++) {
+            const struct flt_cpu  *cpu = flt_topology_find(topology, cpu_ids[i]);
+            if (cpu != NULL) {
+                order[n++] = cpu;
+            }
+        }
+        if (n > 0) {
+            for (i = 0; i < count; i++) {
+                dest[i] = order[i % n];
+            }
+            free(order);
+            return;
+        }
+        free(order);
+        n = topology->cpu_count;
+    }
+
+    order = cork_calloc(n, sizeof(struct flt_cpu *));
+    for (i = 0; i < n; i++) {
+        order[i] = &topology->cpus[i];
+    }
+    switch (policy) {
+        case FLT_AFFINITY_COMPACT:
+            qsort(order, n, sizeof(struct flt_cpu *), flt_cpu_compare_compact);
+            break;
+        case FLT_AFFINITY_AVOID_SMT:
+            qsort(order, n, sizeof(struct flt_cpu *),
+                  flt_cpu_compare_avoid_smt);
+            break;
+        case FLT_AFFINITY_SCATTER:
+            flt_topology_order_scatter(topology, order);
+            break;
+        default:
+            break;
+    }
+
+    for (i = 0; i < count; i++) {
+        dest[i] = order[i % n];
+    }
+    free(order);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Pinning threads
+ */
+
+#if defined(__linux__)
+#include <sched.h>
+
+struct flt_saved_affinity {
+    cpu_set_t  set;
+};
+
+void
+flt_cpu_pin_current_thread(const struct flt_cpu *cpu)
+{
+    cpu_set_t  set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu->id, &set);
+    /* If this fails (because the CPU isn't in our cpuset, for instance), the
+     * thread just keeps running wherever it was allowed to before. */
+    (void) sched_setaffinity(0, sizeof(set), &set);
+}
+
+struct flt_saved_affinity *
+flt_affinity_save(void)
+{
+    struct flt_saved_affinity  *saved = cork_new(struct flt_saved_affinity);
+    if (sched_getaffinity(0, sizeof(saved->set), &saved->set) != 0) {
+        free(saved);
+        return NULL;
+    }
+    return saved;
+}
+
+void
+flt_affinity_restore(struct flt_saved_affinity *saved)
+{
+    if (saved != NULL) {
+        (void) sched_setaffinity(0, sizeof(saved->set), &saved->set);
+        free(saved);
+    }
+}
+
+#else
+/* We don't know how to pin threads on this platform; contexts run wherever
+ * the OS puts them. */
+
+void
+flt_cpu_pin_current_thread(const struct flt_cpu *cpu)
+{
+}
+
+struct flt_saved_affinity *
+flt_affinity_save(void)
+{
+    return NULL;
+}
+
+void
+flt_affinity_restore(struct flt_saved_affinity *saved)
+{
+}
+
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Node-local memory
+ */
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* From <numaif.h>; we call mbind directly so that we don't need libnuma. */
+#define FLT_MPOL_PREFERRED  1
+#define FLT_MPOL_MF_MOVE  (1 << 1)
+
+#define FLT_ULONG_BITS  (sizeof(unsigned long) * 8)
+
+size_t
+flt_node_page_size(const struct flt_topology *topology)
+{
+    return (topology->node_count > 1)? (size_t) sysconf(_SC_PAGESIZE): 1;
+}
+
+void
+flt_node_bind(const struct flt_topology *topology, unsigned int node,
+              void *ptr, size_t size)
+{
+    /* We prefer the node rather than binding to it, so that the kernel can
+     * still fall back on other nodes if this one runs out of memory.  And if
+     * mbind fails for any reason, the memory is still perfectly usable. */
+    size_t  page_size = flt_node_page_size(topology);
+    uintptr_t  start = (uintptr_t) ptr;
+    uintptr_t  end = start + size;
+    unsigned long  mask[(node / FLT_ULONG_BITS) + 1];
+    if (topology->node_count <= 1) {
+        return;
+    }
+    start = (start + page_size - 1) & ~(page_size - 1);
+    end &= ~(page_size - 1);
+    if (start >= end) {
+        return;
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[node / FLT_ULONG_BITS] = 1UL << (node % FLT_ULONG_BITS);
+    (void) syscall(SYS_mbind, (void *) start, (unsigned long) (end - start),
+                   FLT_MPOL_PREFERRED, mask, (unsigned long) (node + 2),
+                   FLT_MPOL_MF_MOVE);
+}
+
+/* Small regions come from per-node arenas, so that we don't need a pair of
+ * system calls (and a new VMA) for every task batch, slab batch, and SNZI leaf.
+ * Each arena reserves memory from the OS in large chunks, setting the memory
+ * policy for the whole chunk at once, and carves those chunks up into
+ * power-of-two size classes.  Freed regions go onto a free list for their size
+ * class; we only unmap a chunk when the topology itself is freed.  Each chunk
+ * is aligned to its size, and starts with a header that tells us which arena it
+ * belongs to, so that flt_node_free can find the right free list from the
+ * pointer alone.  Anything larger than the biggest size class gets a mapping of
+ * its own. */
+
+#define FLT_NODE_CHUNK_SIZE  ((size_t) 2 * 1024 * 1024)
+#define FLT_NODE_MIN_SHIFT  6
+#define FLT_NODE_MAX_SHIFT  16
+#define FLT_NODE_MAX_SIZE  ((size_t) 1 << FLT_NODE_MAX_SHIFT)
+#define FLT_NODE_CLASS_COUNT  (FLT_NODE_MAX_SHIFT - FLT_NODE_MIN_SHIFT + 1)
+
+struct flt_node_chunk {
+    struct flt_node_arena  *arena;
+    struct flt_node_chunk  *next;
+};
+
+struct flt_node_arena {
+    pthread_mutex_t  lock;
+    unsigned int  node;
+    struct flt_node_chunk  *chunks;
+    /* The part of the newest chunk that we haven't handed out yet */
+    char  *next;
+    char  *end;
+    /* Freed regions of each size class, linked via their first word */
+    void  *unused[FLT_NODE_CLASS_COUNT];
+};
+
+static void
+flt_node_arenas_init(struct flt_topology *topology)
+{
+    unsigned int  i;
+    topology->arenas = NULL;
+    topology->arena_count = 0;
+    if (topology->node_count <= 1) {
+        return;
+    }
+
+    for (i = 0; i < topology->cpu_count; i++) {
+        if (topology->cpus[i].node >= topology->arena_count) {
+            topology->arena_count = topology->cpus[i].node + 1;
+        }
+    }
+    topology->arenas =
+        cork_calloc(topology->arena_count, sizeof(struct flt_node_arena));
+    for (i = 0; i < topology->arena_count; i++) {
+        struct flt_node_arena  *arena = &topology->arenas[i];
+        pthread_mutex_init(&arena->lock, NULL);
+        arena->node = i;
+    }
+}
+
+static void
+flt_node_arenas_done(struct flt_topology *topology)
+{
+    unsigned int  i;
+    for (i = 0; i < topology->arena_count; i++) {
+        struct flt_node_arena  *arena = &topology->arenas[i];
+        struct flt_node_chunk  *chunk = arena->chunks;
+        while (chunk != NULL) {
+            struct flt_node_chunk  *next = chunk->next;
+            munmap(chunk, FLT_NODE_CHUNK_SIZE);
+            chunk = next;
+        }
+        pthread_mutex_destroy(&arena->lock);
+    }
+    free(topology->arenas);
+}
+
+/* mmap hands us fresh pages that nothing has touched yet, so the memory policy
+ * that we set will decide where they end up. */
+static void *
+flt_node_map(unsigned int node, size_t size)
+{
+    void  *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (CORK_UNLIKELY(ptr == MAP_FAILED)) {
+        fprintf(stderr, "fleet: Cannot allocate %zu bytes on node %u\n",
+                size, node);
+        abort();
+    }
+    return ptr;
+}
+
+/* Reserves a new chunk for `arena`.  You must hold the arena's lock. */
+static void
+flt_node_chunk_new(const struct flt_topology *topology,
+                   struct flt_node_arena *arena)
+{
+    /* Map twice as much as we need, so that we can trim it down to a chunk
+     * that's aligned to its size. */
+    char  *raw = flt_node_map(arena->node, FLT_NODE_CHUNK_SIZE * 2);
+    char  *start = (char *)
+        (((uintptr_t) raw + FLT_NODE_CHUNK_SIZE - 1) &
+         ~(uintptr_t) (FLT_NODE_CHUNK_SIZE - 1));
+    char  *end = start + FLT_NODE_CHUNK_SIZE;
+    struct flt_node_chunk  *chunk = (struct flt_node_chunk *) start;
+    if (start > raw) {
+        munmap(raw, start - raw);
+    }
+    if (raw + FLT_NODE_CHUNK_SIZE * 2 > end) {
+        munmap(end, raw + FLT_NODE_CHUNK_SIZE * 2 - end);
+    }
+
+    /* Set the policy before we touch the header, so that the header's page
+     * ends up on the right node, too. */
+    flt_node_bind(topology, arena->node, start, FLT_NODE_CHUNK_SIZE);
+    chunk->arena = arena;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->next = start + sizeof(struct flt_node_chunk);
+    arena->end = end;
+}
+
+static unsigned int
+flt_node_size_class(size_t size)
+{
+    unsigned int  shift = FLT_NODE_MIN_SHIFT;
+    while (((size_t) 1 << shift) < size) {
+        shift++;
+    }
+    return shift - FLT_NODE_MIN_SHIFT;
+}
+
+void *
+flt_node_alloc(const struct flt_topology *topology, unsigned int node,
+               size_t size)
+{
+    struct flt_node_arena  *arena;
+    unsigned int  size_class;
+    size_t  class_size;
+    size_t  align;
+    uintptr_t  next;
+    void  *ptr;
+
+    if (topology->node_count <= 1) {
+        return cork_calloc(1, size);
+    }
+
+    if (size > FLT_NODE_MAX_SIZE) {
+        ptr = flt_node_map(node, size);
+        flt_node_bind(topology, node, ptr, size);
+        return ptr;
+    }
+
+    arena = &topology->arenas[node];
+    size_class = flt_node_size_class(size);
+    class_size = (size_t) 1 << (size_class + FLT_NODE_MIN_SHIFT);
+    pthread_mutex_lock(&arena->lock);
+    ptr = arena->unused[size_class];
+    if (ptr != NULL) {
+        arena->unused[size_class] = *(void **) ptr;
+        pthread_mutex_unlock(&arena->lock);
+        memset(ptr, 0, size);
+        return ptr;
+    }
+
+    /* Nothing to reuse, so carve a new region out of the newest chunk.  (Pages
+     * that we haven't handed out yet have never been touched, so they're still
+     * zeroed.) */
+    align = flt_node_page_size(topology);
+    if (class_size < align) {
+        align = class_size;
+    }
+    next = ((uintptr_t) arena->next + align - 1) & ~(uintptr_t) (align - 1);
+    if (arena->next == NULL || next + class_size > (uintptr_t) arena->end) {
+        flt_node_chunk_new(topology, arena);
+        next = ((uintptr_t) arena->next + align - 1) &
+            ~(uintptr_t) (align - 1);
+    }
+    arena->next = (char *) (next + class_size);
+    pthread_mutex_unlock(&arena->lock);
+    return (void *) next;
+}
+
+void
+flt_node_free(const struct flt_topology *topology, void *ptr, size_t size)
+{
+    struct flt_node_chunk  *chunk;
+    struct flt_node_arena  *arena;
+    unsigned int  size_class;
+
+    if (topology->node_count <= 1) {
+        free(ptr);
+        return;
+    }
+
+    if (size > FLT_NODE_MAX_SIZE) {
+        munmap(ptr, size);
+        return;
+    }
+
+    chunk = (struct flt_node_chunk *)
+        ((uintptr_t) ptr & ~(uintptr_t) (FLT_NODE_CHUNK_SIZE - 1));
+    arena = chunk->arena;
+    size_class = flt_node_size_class(size);
+    pthread_mutex_lock(&arena->lock);
+    *(void **) ptr = arena->unused[size_class];
+    arena->unused[size_class] = ptr;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+#else
+/* We don't know how to place memory on this platform, so just let malloc do
+ * whatever it wants. */
+
+static void
+flt_node_arenas_init(struct flt_topology *topology)
+{
+    topology->arenas = NULL;
+    topology->arena_count = 0;
+}
+
+static void
+flt_node_arenas_done(struct flt_topology *topology)
+{
+}
+
+size_t
+flt_node_page_size(const struct flt_topology *topology)
+{
+    return 1;
+}
+
+void
+flt_node_bind(const struct flt_topology *topology, unsigned int node,
+              void *ptr, size_t size)
+{
+}
+
+void *
+flt_node_alloc(const struct flt_topology *topology, unsigned int node,
+               size_t size)
+{
+    return cork_calloc(1, size);
+}
+
+void
+flt_node_free(const struct flt_topology *topology, void *ptr, size_t size)
+{
+    free(ptr);
+}
+
+#endif
@@ -71,6 +71,74 @@ START_TEST(test_4_threads) \
 } \
 END_TEST \
 \
+START_TEST(test_4_threads_lazy) \
+{ \
+    extern struct flt_example  example; \
+    static char  *argv[] = { __VA_ARGS__ }; \
+    static int  argc = sizeof(argv) / sizeof(argv[0]); \
+    struct flt_fleet  *fleet; \
+    DESCRIBE_TEST; \
+    example.configure(argc, argv); \
+    fleet = flt_fleet_new(); \
+    flt_fleet_set_context_count(fleet, 4); \
+    flt_fleet_set_split_policy(fleet, FLT_SPLIT_LAZY); \
+    example.run_in_fleet(fleet); \
+    flt_fleet_free(fleet); \
+    fail_if(example.verify() != 0); \
+} \
+END_TEST \
+\
+START_TEST(test_4_threads_pinned) \
+{ \
+    extern struct flt_example  example; \
+    static char  *argv[] = { __VA_ARGS__ }; \
+    static int  argc = sizeof(argv) / sizeof(argv[0]); \
+    struct flt_fleet  *fleet; \
+    DESCRIBE_TEST; \
+    example.configure(argc, argv); \
+    fleet = flt_fleet_new(); \
+    flt_fleet_set_context_count(fleet, 4); \
+    flt_fleet_set_affinity(fleet, FLT_AFFINITY_SCATTER); \
+    example.run_in_fleet(fleet); \
+    flt_fleet_free(fleet); \
+    fail_if(example.verify() != 0); \
+} \
+END_TEST \
+\
+START_TEST(test_4_threads_spin) \
+{ \
+    extern struct flt_example  example; \
+    static char  *argv[] = { __VA_ARGS__ }; \
+    static int  argc = sizeof(argv) / sizeof(argv[0]); \
+    struct flt_fleet  *fleet; \
+    DESCRIBE_TEST; \
+    example.configure(argc, argv); \
+    fleet = flt_fleet_new(); \
+    flt_fleet_set_context_count(fleet, 4); \
+    flt_fleet_set_idle_policy(fleet, FLT_IDLE_SPIN); \
+    example.run_in_fleet(fleet); \
+    flt_fleet_free(fleet); \
+    fail_if(example.verify() != 0); \
+} \
+END_TEST \
+\
+START_TEST(test_4_threads_yield) \
+{ \
+    extern struct flt_example  example; \
+    static char  *argv[] = { __VA_ARGS__ }; \
+    static int  argc = sizeof(argv) / sizeof(argv[0]); \
+    struct flt_fleet  *fleet; \
+    DESCRIBE_TEST; \
+    example.configure(argc, argv); \
+    fleet = flt_fleet_new(); \
+    flt_fleet_set_context_count(fleet, 4); \
+    flt_fleet_set_idle_policy(fleet, FLT_IDLE_YIELD); \
+    example.run_in_fleet(fleet); \
+    flt_fleet_free(fleet); \
+    fail_if(example.verify() != 0); \
+} \
+END_TEST \
+\
 Suite * \
 test_suite() \
 { \
@@ -80,6 +148,10 @@ test_suite() \
     tcase_add_test(tc_fleet, test_single_threaded); \
     tcase_add_test(tc_fleet, test_2_threads); \
     tcase_add_test(tc_fleet, test_4_threads); \
+    tcase_add_test(tc_fleet, test_4_threads_lazy); \
+    tcase_add_test(tc_fleet, test_4_threads_pinned); \
+    tcase_add_test(tc_fleet, test_4_threads_spin); \
+    tcase_add_test(tc_fleet, test_4_threads_yield); \
     suite_add_tcase(s, tc_fleet); \
     return s; \
 }
@@ -0,0 +1,183 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <check.h>
+
+#include "libcork/core.h"
+
+#include "fleet/snzi.h"
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Stress tests
+ */
+
+/* A root with three leaves.  The threads are spread unevenly across the leaves,
+ * so that some leaves are contended and one isn't. */
+
+#define LEAF_COUNT  3
+#define THREAD_COUNT  8
+#define ITERATION_COUNT  100000
+
+static struct flt_snzi_node  root;
+static struct flt_snzi_node  leaves[LEAF_COUNT];
+
+/* Set by any thread that sees the root at zero while it (or some other thread
+ * that must still be arrived) is counted in the tree. */
+static volatile unsigned int  saw_zero;
+/* How many departures claimed to bring the whole tree to zero */
+static volatile unsigned int  zero_departures;
+/* Set while the holder thread keeps its own arrival in the tree */
+static volatile bool  holding;
+
+static void
+init_tree(void)
+{
+    unsigned int  i;
+    flt_snzi_init(&root, NULL);
+    for (i = 0; i < LEAF_COUNT; i++) {
+        flt_snzi_init(&leaves[i], &root);
+    }
+    saw_zero = 0;
+    zero_departures = 0;
+}
+
+static void
+check_tree_is_empty(void)
+{
+    unsigned int  i;
+    fail_unless(flt_snzi_is_zero(&root), "Root should be zero");
+    fail_unless_equal("Root count", "%" PRIu32,
+                      (uint32_t) 0, flt_snzi_count(root.state));
+    for (i = 0; i < LEAF_COUNT; i++) {
+        fail_unless_equal("Leaf count", "%" PRIu32,
+                          (uint32_t) 0, flt_snzi_count(leaves[i].state));
+    }
+}
+
+static struct flt_snzi_node *
+leaf_for_thread(size_t index)
+{
+    /* Threads 0-4 share leaf 0, 5-6 share leaf 1, and 7 has leaf 2 to
+     * itself. */
+    return (index < 5)? &leaves[0]: (index < 7)? &leaves[1]: &leaves[2];
+}
+
+static void *
+churn(void *ud)
+{
+    struct flt_snzi_node  *leaf = leaf_for_thread((size_t) ud);
+    unsigned int  i;
+    for (i = 0; i < ITERATION_COUNT; i++) {
+        flt_snzi_arrive(leaf);
+        /* We're in the tree, so it can't be zero. */
+        if (flt_snzi_is_zero(&root)) {
+            saw_zero = 1;
+        }
+        if (i % 64 == 0) {
+            sched_yield();
+        }
+        if (flt_snzi_depart(leaf)) {
+            (void) __sync_add_and_fetch(&zero_departures, 1);
+            if (holding) {
+                saw_zero = 1;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void
+run_threads(void)
+{
+    pthread_t  threads[THREAD_COUNT];
+    size_t  i;
+    for (i = 0; i < THREAD_COUNT; i++) {
+        fail_if(pthread_create(&threads[i], NULL, churn, (void *) i) != 0);
+    }
+    for (i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+START_TEST(test_snzi_churn)
+{
+    DESCRIBE_TEST;
+    init_tree();
+    holding = false;
+    run_threads();
+    fail_if(saw_zero, "Saw a zero root while a thread was arrived");
+    /* The last departure must have noticed that the tree emptied out. */
+    fail_if(zero_departures == 0, "No departure brought the tree to zero");
+    check_tree_is_empty();
+}
+END_TEST
+
+START_TEST(test_snzi_churn_while_held)
+{
+    struct flt_snzi_node  *held = &leaves[2];
+    DESCRIBE_TEST;
+    init_tree();
+
+    /* While one arrival stays in the tree, no amount of churn on any leaf
+     * (including the holder's own) can bring the root to zero. */
+    flt_snzi_arrive(held);
+    holding = true;
+    run_threads();
+    holding = false;
+    fail_if(saw_zero, "Saw a zero root while an arrival was held");
+    fail_unless_equal("Zero departures", "%u", 0, zero_departures);
+    fail_if(flt_snzi_is_zero(&root), "Root should still be non-zero");
+
+    /* And once the holder leaves, the tree is empty again. */
+    fail_unless(flt_snzi_depart(held),
+                "Last departure should bring the tree to zero");
+    check_tree_is_empty();
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("snzi");
+
+    TCase  *tc_snzi = tcase_create("snzi");
+    tcase_add_test(tc_snzi, test_snzi_churn);
+    tcase_add_test(tc_snzi, test_snzi_churn_while_held);
+    suite_add_tcase(s, tc_snzi);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
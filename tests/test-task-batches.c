@@ -0,0 +1,136 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <check.h>
+
+#include "libcork/core.h"
+#include "libcork/ds.h"
+
+#include "fleet.h"
+#include "fleet/task.h"
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Foreign tasks
+ */
+
+/* One task produces a burst of tasks, many batches' worth, and then spins
+ * until they've all finished.  Its context can't run any of them while it
+ * spins, so every one of them is stolen and freed by the other context.  Unless
+ * the thief hands those tasks back, the producer has to allocate a new batch
+ * for every TASK_BATCH_COUNT tasks; unless the producer trims the batches that
+ * it gets back, they stick around until the fleet is freed. */
+
+#define BURST_SIZE  (64 * TASK_BATCH_COUNT)
+
+static unsigned int  producer_index;
+static volatile size_t  finished_count;
+static volatile size_t  foreign_count;
+
+static void
+consume(struct flt *flt, void *ud, size_t i)
+{
+    if (flt->index != producer_index) {
+        (void) __sync_add_and_fetch(&foreign_count, 1);
+    }
+    (void) __sync_add_and_fetch(&finished_count, 1);
+}
+
+static void
+produce(struct flt *flt, void *ud, size_t i)
+{
+    producer_index = flt->index;
+    for (i = 0; i < BURST_SIZE; i++) {
+        flt_run(flt, flt_task_new(flt, consume, NULL, i));
+    }
+    while (finished_count < BURST_SIZE) {
+        sched_yield();
+    }
+}
+
+START_TEST(test_foreign_tasks_are_returned)
+{
+    struct flt_fleet  *fleet;
+    size_t  bound = TASK_HIGH_WATER / TASK_BATCH_COUNT + 4;
+    unsigned int  round;
+    DESCRIBE_TEST;
+
+    fleet = flt_fleet_new();
+    flt_fleet_set_context_count(fleet, 2);
+    for (round = 0; round < 4; round++) {
+        struct flt_priv  *producer;
+        struct flt_priv  *thief;
+        size_t  batch_count;
+
+        finished_count = 0;
+        foreign_count = 0;
+        flt_fleet_run(fleet, produce, NULL, 0);
+        fail_unless_equal("Foreign tasks", "%zu",
+                          (size_t) BURST_SIZE, (size_t) foreign_count);
+
+        producer = fleet->contexts[producer_index];
+        thief = fleet->contexts[1 - producer_index];
+
+        /* The thief hands back each batch's worth of tasks as soon as it has
+         * freed them. */
+        fail_unless(thief->foreign_count < TASK_RETURN_COUNT,
+                    "Thief is holding on to %zu tasks", thief->foreign_count);
+
+        /* The producer takes back those tasks once it runs out of work, and
+         * frees the batches that they empty out, keeping only as many unused
+         * tasks as the high-water mark (plus whichever batches the thief's
+         * leftover tasks still pin). */
+        batch_count = cork_dllist_size(&producer->batches);
+        fail_unless(batch_count <= bound,
+                    "Producer kept %zu task batches (expected at most %zu)",
+                    batch_count, bound);
+        fail_unless(producer->unused_count <=
+                    TASK_HIGH_WATER + TASK_BATCH_COUNT,
+                    "Producer kept %zu unused tasks", producer->unused_count);
+    }
+    flt_fleet_free(fleet);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("task-batches");
+
+    TCase  *tc_batches = tcase_create("task-batches");
+    tcase_add_test(tc_batches, test_foreign_tasks_are_returned);
+    suite_add_tcase(s, tc_batches);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
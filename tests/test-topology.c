@@ -0,0 +1,278 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "fleet/topology.h"
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Fake sysfs trees
+ */
+
+/* We build a fake copy of /sys/devices/system/cpu for a machine with two
+ * sockets, each of which has two last-level caches shared by two cores, each of
+ * which has two hardware threads.  Like Linux, we number all of the first
+ * hardware threads before any of the second ones, so CPU N lives at
+ *
+ *   N = thread * 8 + socket * 4 + llc * 2 + core
+ *
+ * Each socket is its own NUMA node. */
+
+#define CPU_COUNT  16
+
+static void
+make_dir(const char *fmt, ...)
+{
+    char  path[PATH_MAX];
+    va_list  args;
+    va_start(args, fmt);
+    vsnprintf(path, sizeof(path), fmt, args);
+    va_end(args);
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+        fail("Cannot create %s: %s", path, strerror(errno));
+    }
+}
+
+static void
+write_file(const char *contents, const char *fmt, ...)
+{
+    char  path[PATH_MAX];
+    FILE  *file;
+    va_list  args;
+    va_start(args, fmt);
+    vsnprintf(path, sizeof(path), fmt, args);
+    va_end(args);
+    file = fopen(path, "w");
+    if (file == NULL) {
+        fail("Cannot create %s: %s", path, strerror(errno));
+    }
+    fprintf(file, "%s\n", contents);
+    fclose(file);
+}
+
+static void
+write_cache(const char *root, unsigned int cpu, unsigned int index,
+            const char *level, const char *type, const char *shared)
+{
+    make_dir("%s/cpu%u/cache/index%u", root, cpu, index);
+    write_file(level, "%s/cpu%u/cache/index%u/level", root, cpu, index);
+    write_file(type, "%s/cpu%u/cache/index%u/type", root, cpu, index);
+    write_file(shared, "%s/cpu%u/cache/index%u/shared_cpu_list",
+               root, cpu, index);
+}
+
+static void
+make_two_socket_tree(const char *root)
+{
+    unsigned int  cpu;
+    write_file("0-15", "%s/online", root);
+    for (cpu = 0; cpu < CPU_COUNT; cpu++) {
+        unsigned int  core = cpu % 8;
+        unsigned int  llc = cpu % 8 / 2 * 2;
+        unsigned int  socket = cpu % 8 / 4;
+        char  siblings[32];
+        char  llc_cpus[32];
+        snprintf(siblings, sizeof(siblings), "%u,%u", core, core + 8);
+        snprintf(llc_cpus, sizeof(llc_cpus), "%u-%u,%u-%u",
+                 llc, llc + 1, llc + 8, llc + 9);
+
+        make_dir("%s/cpu%u", root, cpu);
+        make_dir("%s/cpu%u/topology", root, cpu);
+        write_file(siblings, "%s/cpu%u/topology/thread_siblings_list",
+                   root, cpu);
+        make_dir("%s/cpu%u/cache", root, cpu);
+        write_cache(root, cpu, 0, "1", "Data", siblings);
+        write_cache(root, cpu, 1, "1", "Instruction", siblings);
+        write_cache(root, cpu, 2, "2", "Unified", siblings);
+        write_cache(root, cpu, 3, "3", "Unified", llc_cpus);
+        make_dir("%s/cpu%u/node%u", root, cpu, socket);
+    }
+}
+
+static int
+remove_entry(const char *path, const struct stat *sb, int flag,
+             struct FTW *ftw)
+{
+    return remove(path);
+}
+
+static void
+remove_tree(const char *root)
+{
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Topology
+ */
+
+START_TEST(test_two_socket_smt)
+{
+    char  root[] = "/tmp/fleet-topology-XXXXXX";
+    struct flt_topology  topology;
+    unsigned int  i;
+    DESCRIBE_TEST;
+
+    fail_if(mkdtemp(root) == NULL);
+    make_two_socket_tree(root);
+    flt_topology_init(&topology, root);
+    remove_tree(root);
+
+    fail_unless_equal("CPU count", "%u", CPU_COUNT, topology.cpu_count);
+    fail_unless_equal("Node count", "%u", 2, topology.node_count);
+    for (i = 0; i < CPU_COUNT; i++) {
+        const struct flt_cpu  *cpu = &topology.cpus[i];
+        fail_unless_equal("CPU ID", "%u", i, cpu->id);
+        fail_unless_equal("Core", "%u", i % 8, cpu->core);
+        fail_unless_equal("LLC", "%u", i % 8 / 2 * 2, cpu->llc);
+        fail_unless_equal("Node", "%u", i % 8 / 4, cpu->node);
+        fail_unless_equal("SMT index", "%u", i / 8, cpu->smt_index);
+    }
+
+    fail_unless_equal("Distance", "%d", FLT_TIER_SAME_CORE,
+        flt_topology_distance(&topology.cpus[0], &topology.cpus[8]));
+    fail_unless_equal("Distance", "%d", FLT_TIER_SAME_LLC,
+        flt_topology_distance(&topology.cpus[0], &topology.cpus[9]));
+    fail_unless_equal("Distance", "%d", FLT_TIER_SAME_NODE,
+        flt_topology_distance(&topology.cpus[0], &topology.cpus[3]));
+    fail_unless_equal("Distance", "%d", FLT_TIER_REMOTE,
+        flt_topology_distance(&topology.cpus[0], &topology.cpus[12]));
+
+    flt_topology_done(&topology);
+}
+END_TEST
+
+START_TEST(test_missing_sysfs)
+{
+    char  root[] = "/tmp/fleet-topology-XXXXXX";
+    struct flt_topology  topology;
+    unsigned int  i;
+    DESCRIBE_TEST;
+
+    /* An empty directory should give us a flat topology. */
+    fail_if(mkdtemp(root) == NULL);
+    flt_topology_init(&topology, root);
+    remove_tree(root);
+
+    fail_unless_equal("Node count", "%u", 1, topology.node_count);
+    for (i = 0; i < topology.cpu_count; i++) {
+        fail_unless_equal("Core", "%u", i, topology.cpus[i].core);
+        fail_unless_equal("LLC", "%u", 0, topology.cpus[i].llc);
+        fail_unless_equal("Node", "%u", 0, topology.cpus[i].node);
+    }
+    flt_topology_done(&topology);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Victim order
+ */
+
+/* Checks that the victims in each tier are exactly the CPUs in `expected`,
+ * which lists each tier's CPUs in order, with each tier ending in a -1. */
+static void
+check_victims(const char *root, unsigned int self, const int *expected)
+{
+    struct flt_topology  topology;
+    const struct flt_cpu  *cpus[CPU_COUNT];
+    unsigned int  victims[CPU_COUNT];
+    unsigned int  tier_end[FLT_TIER_COUNT];
+    unsigned int  tier;
+    unsigned int  i = 0;
+
+    flt_topology_init(&topology, root);
+    flt_topology_place
+        (&topology, FLT_AFFINITY_NONE, NULL, 0, CPU_COUNT, cpus);
+    flt_topology_order_victims(cpus, CPU_COUNT, self, victims, tier_end);
+
+    for (tier = 0; tier < FLT_TIER_COUNT; tier++) {
+        for (; *expected != -1; expected++, i++) {
+            fail_unless_equal("Victim", "%u",
+                              (unsigned int) *expected, victims[i]);
+        }
+        expected++;
+        fail_unless_equal("Tier end", "%u", i, tier_end[tier]);
+    }
+    fail_unless_equal("Victim count", "%u", CPU_COUNT - 1, i);
+    flt_topology_done(&topology);
+}
+
+START_TEST(test_victim_order)
+{
+    char  root[] = "/tmp/fleet-topology-XXXXXX";
+    static const int  from_0[] = {
+        8, -1,
+        1, 9, -1,
+        2, 3, 10, 11, -1,
+        4, 5, 6, 7, 12, 13, 14, 15, -1
+    };
+    static const int  from_13[] = {
+        5, -1,
+        4, 12, -1,
+        6, 7, 14, 15, -1,
+        0, 1, 2, 3, 8, 9, 10, 11, -1
+    };
+    DESCRIBE_TEST;
+
+    fail_if(mkdtemp(root) == NULL);
+    make_two_socket_tree(root);
+    check_victims(root, 0, from_0);
+    check_victims(root, 13, from_13);
+    remove_tree(root);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("topology");
+
+    TCase  *tc_topology = tcase_create("topology");
+    tcase_add_test(tc_topology, test_two_socket_smt);
+    tcase_add_test(tc_topology, test_missing_sysfs);
+    tcase_add_test(tc_topology, test_victim_order);
+    suite_add_tcase(s, tc_topology);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}